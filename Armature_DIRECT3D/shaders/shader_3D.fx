@@ -17,6 +17,16 @@ cbuffer cb_Lights
 	Light lights[2];
 };
 
+//how the vertices are decoded (see VertexFormat in 3D_lib.h) - the float format has a scale of 1 and an offset of 0
+cbuffer cb_VertexDecode : register(b1)
+{
+	float4 posScale;
+	float4 posOffset;
+	float2 texCoordScale;
+	float2 texCoordOffset;
+	int octahedralNormals;
+};
+
 Texture2D ObjTexture;
 SamplerState ObjSamplerState;
 
@@ -28,12 +38,25 @@ struct VS_OUTPUT
 	float3 normal: NORMALS;
 };
 
+//the square of the octahedral encoding folded back onto the octahedron (see OctahedralDecode in 3D_lib.cpp)
+float3 OctahedralDecode(float2 e)
+{
+	float3 n = float3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+	float t = saturate(-n.z);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return normalize(n);
+}
+
 VS_OUTPUT VS(float4 inPos: POSITION, float2 inTexCoord: TEXCOORD, float3 inNormal: NORMALS)
 {
 	VS_OUTPUT output;
-	output.Pos = mul(inPos, WVP);
-	output.TexCoord = inTexCoord;
-	output.normal = mul(inNormal,World);
+	float4 pos = float4(inPos.xyz * posScale.xyz + posOffset.xyz, 1.0f);
+	float3 normal = octahedralNormals ? OctahedralDecode(inNormal.xy) : inNormal;
+
+	output.Pos = mul(pos, WVP);
+	output.TexCoord = inTexCoord * texCoordScale + texCoordOffset;
+	output.normal = mul(normal,World);
 
 	return output;
 }
@@ -16,10 +16,15 @@
 
 
 #include "3D_lib.h"
+#include "point_cache.h"
+#include "mesh_simplify.h"
+#include "vertex_cache.h"
 
+#include <algorithm>
 
 
-void NormalizeVector(float* vSrc, float* vDst, int len)
+
+void NormalizeVector(const float* vSrc, float* vDst, int len)
 {
 	float length = 0;
 
@@ -35,7 +40,7 @@ void NormalizeVector(float* vSrc, float* vDst, int len)
 	}
 }
 
-void AddVectors(float* v1, float* v2, float* result, int len)
+void AddVectors(const float* v1, const float* v2, float* result, int len)
 {
 	for (int i = 0; i < len; i++)
 	{
@@ -43,7 +48,7 @@ void AddVectors(float* v1, float* v2, float* result, int len)
 	}
 }
 
-void SubVectors(float* v1, float* v2, float* result, int len)
+void SubVectors(const float* v1, const float* v2, float* result, int len)
 {
 	for (int i = 0; i < len; i++)
 	{
@@ -51,7 +56,7 @@ void SubVectors(float* v1, float* v2, float* result, int len)
 	}
 }
 
-float DotVectors(float* u, float* v, int len)
+float DotVectors(const float* u, const float* v, int len)
 {
 	float result = 0;
 	for (int vi = 0; vi < len; vi++)
@@ -62,7 +67,7 @@ float DotVectors(float* u, float* v, int len)
 	return result;
 }
 
-void CrossVectors(float* u, float* v, float* result)
+void CrossVectors(const float* u, const float* v, float* result)
 {
 	result[0] = u[1] * v[2] - u[2] * v[1];
 	result[1] = u[2] * v[0] - u[0] * v[2];
@@ -78,6 +83,52 @@ void ScaleVector(float* v, float scale, int len)
 
 }
 
+void OctahedralEncode(const float* n, short* result)
+{
+	float l1_norm = fabs(n[0]) + fabs(n[1]) + fabs(n[2]);
+	//a degenerate normal (of a vertex with no area around it) gets (0, 0, 1) rather than NaNs
+	if (l1_norm == 0.0f)
+	{
+		result[0] = 0;
+		result[1] = 0;
+		return;
+	}
+	float x = n[0] / l1_norm;
+	float y = n[1] / l1_norm;
+
+	//the lower half of the octahedron gets folded over the upper one
+	if (n[2] < 0.0f)
+	{
+		float x_folded = (1.0f - fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float y_folded = (1.0f - fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = x_folded;
+		y = y_folded;
+	}
+
+	result[0] = (short)lroundf(std::min(std::max(x, -1.0f), 1.0f) * 32767.0f);
+	result[1] = (short)lroundf(std::min(std::max(y, -1.0f), 1.0f) * 32767.0f);
+}
+
+void OctahedralDecode(const short* e, float* result)
+{
+	float x = e[0] / 32767.0f;
+	float y = e[1] / 32767.0f;
+	float z = 1.0f - fabs(x) - fabs(y);
+
+	if (z < 0.0f)
+	{
+		float x_unfolded = (1.0f - fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float y_unfolded = (1.0f - fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = x_unfolded;
+		y = y_unfolded;
+	}
+
+	result[0] = x;
+	result[1] = y;
+	result[2] = z;
+	NormalizeVector(result, result, 3);
+}
+
 void Quaternion:: Init(float w, float x, float y, float z)
 {
 	this->w = w;
@@ -96,7 +147,7 @@ void Quaternion::InitAxisAngle(float* axis, float angle)
 	this->z = axis_norm[2] * sinf(angle / 2.0f);
 }
 
-Quaternion Quaternion::Conjugation()
+Quaternion Quaternion::Conjugation() const
 {
 	Quaternion conj;
 	conj.w = this->w;
@@ -107,7 +158,7 @@ Quaternion Quaternion::Conjugation()
 	return conj;
 }
 
-float Quaternion::Norm()
+float Quaternion::Norm() const
 {
 	float norm = sqrt(pow(this->w, 2.0f) + pow(this->x, 2.0f) + pow(this->y, 2.0f) + pow(this->z, 2.0f));
 	return norm;
@@ -123,7 +174,7 @@ void Quaternion::Normalize()
 
 }
 
-Quaternion  Quaternion::Reciprocal()
+Quaternion  Quaternion::Reciprocal() const
 {
 	Quaternion rec = this->Conjugation();
 	float norm = this->Norm();
@@ -135,7 +186,7 @@ Quaternion  Quaternion::Reciprocal()
 }
 
 
-Quaternion HamiltonProd(Quaternion& q1, Quaternion& q2)
+Quaternion HamiltonProd(const Quaternion& q1, const Quaternion& q2)
 {
 	Quaternion result;
 
@@ -147,7 +198,7 @@ Quaternion HamiltonProd(Quaternion& q1, Quaternion& q2)
 	return result;
 }
 
-void Rotate(Quaternion* q, float* vSrc, float* vDst)
+void Rotate(const Quaternion* q, const float* vSrc, float* vDst)
 {
 	Quaternion recip = q->Reciprocal();
 
@@ -162,14 +213,24 @@ void Rotate(Quaternion* q, float* vSrc, float* vDst)
 	vDst[2] = temp.z;
 }
 
-float QuaternionDot(Quaternion* q1, Quaternion* q2)
+float QuaternionDot(const Quaternion* q1, const Quaternion* q2)
 {
 	float result = q1->w * q2->w + q1->x * q2->x + q1->y * q2->y + q1->z * q2->z;
 
 	return result;
 }
 
-Quaternion QuaternionSlerp(Quaternion* q1, Quaternion* q2, float t)
+float QuaternionAngle(const Quaternion* q1, const Quaternion* q2)
+{
+	//q and -q represent the same rotation, hence the absolute value
+	float dot = fabs(QuaternionDot(q1, q2));
+	if (dot > 1.0f)
+		dot = 1.0f;
+
+	return 2.0f * acos(dot);
+}
+
+Quaternion QuaternionSlerp(const Quaternion* q1, const Quaternion* q2, float t)
 {
 	float dot = QuaternionDot(q1, q2);
 	if (dot > 1.0)
@@ -195,6 +256,44 @@ Quaternion QuaternionSlerp(Quaternion* q1, Quaternion* q2, float t)
 	return result;
 }
 
+DualQuaternion DualQuaternionFromRotationTranslation(const Quaternion* q, const float* t)
+{
+	Quaternion qt;
+	qt.Init(0.0f, t[0] * 0.5f, t[1] * 0.5f, t[2] * 0.5f);
+
+	DualQuaternion result;
+	result.real = *q;
+	result.dual = HamiltonProd(qt, *q);
+
+	return result;
+}
+
+//The rotation uses v + 2r x (r x v + wv) instead of the q * v * q^-1 of Rotate, which is
+//a lot cheaper, and the translation is the vector part of 2 * dual * real^*.
+void TransformByDualQuaternion(const DualQuaternion* dq, const float* vSrc, float* vDst)
+{
+	const float* r = &dq->real.x;
+	const float* d = &dq->dual.x;
+	float rw = dq->real.w;
+	float dw = dq->dual.w;
+
+	float temp[3];
+	float rot[3];
+	CrossVectors(r, vSrc, temp);
+	temp[0] += rw * vSrc[0];
+	temp[1] += rw * vSrc[1];
+	temp[2] += rw * vSrc[2];
+	CrossVectors(r, temp, rot);
+
+	float trans[3];
+	CrossVectors(r, d, trans);
+
+	for (int ci = 0; ci < 3; ci++)
+	{
+		vDst[ci] = vSrc[ci] + 2.0f * rot[ci] + 2.0f * (rw * d[ci] - dw * r[ci] + trans[ci]);
+	}
+}
+
 void VertexSkinned:: SetVertices()
 {
 	for (int vi = 0; vi < this->vPointers.size(); vi++)
@@ -222,7 +321,7 @@ void Load_Vertex_Groups(std::vector <VertexSkinned>& vSkinnedList, const char* f
 		while (strncmp(line, "vertex", 5) != 0)
 		{
 			sscanf(line, "%s %f", bone_name, &weight);
-			vSkinnedList[vi].vGroups.push_back(VertexGroup(bone_name, weight));
+			vSkinnedList[vi].vGroups.emplace_back(bone_name, weight);
 			if (fgets(line, 256, file) == NULL)
 				break;;
 		}
@@ -248,13 +347,24 @@ Object3D:: ~Object3D()
 		free(this->vTrans);
 		this->vTrans = NULL;
 	}
+	if (this->pointCache != NULL)
+	{
+		delete this->pointCache;
+		this->pointCache = NULL;
+	}
 }
 void Object3D::ReleaseD3D()
 {
-	if (this->dataBuffer != NULL)
+	if (this->texCoordBuffer != NULL)
+	{
+		this->texCoordBuffer->Release();
+		this->texCoordBuffer = NULL;
+	}
+
+	if (this->decodeBuffer != NULL)
 	{
-		this->dataBuffer->Release();
-		this->dataBuffer = NULL;
+		this->decodeBuffer->Release();
+		this->decodeBuffer = NULL;
 	}
 
 	if (this->objTexture != NULL)
@@ -262,30 +372,135 @@ void Object3D::ReleaseD3D()
 		this->objTexture->Release();
 		this->objTexture = NULL;
 	}
+
+	if (this->indexBuffer != NULL)
+	{
+		this->indexBuffer->Release();
+		this->indexBuffer = NULL;
+	}
+
+	for (int li = 0; li < this->lodList.size(); li++)
+	{
+		if (this->lodList[li].indexBuffer != NULL)
+		{
+			this->lodList[li].indexBuffer->Release();
+			this->lodList[li].indexBuffer = NULL;
+		}
+	}
 }
 
 
 Object3D& Object3D:: operator=(Object3D&& other)
 {
+	if (this == &other)
+		return *this;
+
+	//Every member is handed over, in the order of the declaration - the vectors are moved, not copied, and other is
+	//left with empty ones. The vPointers of vSkinnedList and the vertices of normalDirtyVertices still point to the
+	//right places, as vTrans and the lists come along with them.
+	this->vList = std::move(other.vList);
+	this->UVList = std::move(other.UVList);
+	this->normalList = std::move(other.normalList);
+	this->normalListTrans = std::move(other.normalListTrans);
+
+	this->indexList = std::move(other.indexList);
+	this->numCorners = other.numCorners;
+
+	this->numVertices = other.numVertices;
+	free(this->vLocal);
 	this->vLocal = other.vLocal;
 	other.vLocal = NULL;
+	free(this->vTrans);
 	this->vTrans = other.vTrans;
 	other.vTrans = NULL;
-
-	this->vList = other.vList;
-	this->normalList = other.normalList;
-	this->normalListTrans = other.normalListTrans;
-	this->indexList = other.indexList;
-	this->numVertices = other.numVertices;
-
-	this->dataBuffer = other.dataBuffer;
-	other.dataBuffer = NULL;
+	this->texCoords = std::move(other.texCoords);
+	this->cornerVertices = std::move(other.cornerVertices);
+	this->vertexIndexList = std::move(other.vertexIndexList);
+
+	this->vSkinnedList = std::move(other.vSkinnedList);
+
+	this->vertexFormat = other.vertexFormat;
+	this->texCoordBuffer = other.texCoordBuffer;
+	other.texCoordBuffer = NULL;
+	this->vertexDecode = other.vertexDecode;
+	this->decodeBuffer = other.decodeBuffer;
+	other.decodeBuffer = NULL;
+	this->indexBuffer = other.indexBuffer;
+	other.indexBuffer = NULL;
 	this->objTexture = other.objTexture;
 	other.objTexture = NULL;
 
+	delete this->pointCache;
+	this->pointCache = other.pointCache;
+	other.pointCache = NULL;
+	this->pointCacheFrame = other.pointCacheFrame;
+
+	this->positionCorners = std::move(other.positionCorners);
+	this->normalCorners = std::move(other.normalCorners);
+
+	this->boneVertices = std::move(other.boneVertices);
+	this->boneBounds = std::move(other.boneBounds);
+	this->weightDeficit = other.weightDeficit;
+	this->unweightedVertices = other.unweightedVertices;
+	this->poseBounds = other.poseBounds;
+	this->poseBoundsVersion = other.poseBoundsVersion;
+	this->packBounds = other.packBounds;
+	this->skinStream = std::move(other.skinStream);
+
+	this->skinnedPoseVersion = other.skinnedPoseVersion;
+	this->skinnedMode = other.skinnedMode;
+	this->skinStamps = std::move(other.skinStamps);
+
+	this->normalsAllDirty = other.normalsAllDirty;
+	this->normalDirtyVertices = std::move(other.normalDirtyVertices);
+	this->normalDirtyFlags = std::move(other.normalDirtyFlags);
+	this->normalStamps = std::move(other.normalStamps);
+	this->normalStamp = other.normalStamp;
+
+	this->uploadDirty = other.uploadDirty;
+	this->ringGeneration = other.ringGeneration;
+	this->ringOffset = other.ringOffset;
+
+	this->vertexVersion = other.vertexVersion;
+	this->drawnVersion = other.drawnVersion;
+	for (int si = 0; si < FRAME_SLOTS; si++)
+	{
+		this->staged[si] = std::move(other.staged[si]);
+	}
+
+	this->lodList = std::move(other.lodList);
+	other.lodList.clear();
+	this->currentLOD = other.currentLOD;
+	this->skinnedLOD = other.skinnedLOD;
+	this->preparedStep = other.preparedStep;
+
 	return *this;
 }
-void Object3D::Load(ID3D11Device* devicePtr, const char* fname, bool vertexGroups, const char* vertexGroupsFname)
+
+//The numbers of the positions, UVs, normals and faces of an *.obj file, counted by a quick pass over its lines
+//beforehand - so the lists can be given their full size at once instead of growing line by line.
+static void CountObjLines(FILE* file, int* numPositions, int* numUVs, int* numNormals, int* numFaces)
+{
+	char line[256];
+	*numPositions = 0;
+	*numUVs = 0;
+	*numNormals = 0;
+	*numFaces = 0;
+	while (fgets(line, 256, file) != NULL)
+	{
+		if (line[0] == 'v' && line[1] == ' ')
+			(*numPositions)++;
+		else if (line[0] == 'v' && line[1] == 't')
+			(*numUVs)++;
+		else if (line[0] == 'v' && line[1] == 'n')
+			(*numNormals)++;
+		else if (line[0] == 'f' && line[1] == ' ')
+			(*numFaces)++;
+	}
+	rewind(file);
+}
+
+void Object3D::Load(RenderBackend* backendPtr, const char* fname, bool vertexGroups, const char* vertexGroupsFname)
 {
 
 	int num_unique_vertices = 0;
@@ -294,6 +509,13 @@ void Object3D::Load(ID3D11Device* devicePtr, const char* fname, bool vertexGroup
 
 	FILE* file = fopen(fname, "r");
 
+	int num_positions, num_uvs, num_normals, num_faces;
+	CountObjLines(file, &num_positions, &num_uvs, &num_normals, &num_faces);
+	this->vList.reserve(num_positions * 3);
+	this->UVList.reserve(num_uvs * 2);
+	this->normalList.reserve(num_normals * 3);
+	this->indexList.reserve(num_faces * 9);
+
 	line_ptr = fgets(line, 256, file);
 
 	while (line[0] != 'v')
@@ -385,24 +607,95 @@ void Object3D::Load(ID3D11Device* devicePtr, const char* fname, bool vertexGroup
 		this->indexList[vi] -= 1;
 	}
 
-	vLocal = (Vertex*)malloc(sizeof(float) * 8 * 3 * num_polys);
-	vTrans = (Vertex*)malloc(sizeof(float) * 8 * 3 * num_polys);
+	//Every distinct combination of a position, an UV and a normal becomes one vertex, shared by all the corners
+	//that use it - the triangles are drawn indexed.
+	this->numCorners = num_polys * 3;
+	std::vector<int> corner_vertices(this->numCorners);
+	std::vector<std::vector<int>> position_vertices(this->vList.size() / 3);
+	std::vector<int> vertex_corner;
+	vertex_corner.reserve(this->numCorners);
+	for (int ci = 0; ci < this->numCorners; ci++)
+	{
+		std::vector<int>& candidates = position_vertices[this->indexList[ci * 3 + 0]];
+		int vertex = -1;
+		for (int pvi = 0; pvi < candidates.size(); pvi++)
+		{
+			int first_corner = vertex_corner[candidates[pvi]];
+			if (this->indexList[first_corner * 3 + 1] == this->indexList[ci * 3 + 1] && this->indexList[first_corner * 3 + 2] == this->indexList[ci * 3 + 2])
+				vertex = candidates[pvi];
+		}
+		if (vertex == -1)
+		{
+			vertex = vertex_corner.size();
+			vertex_corner.push_back(ci);
+			candidates.push_back(vertex);
+		}
+		corner_vertices[ci] = vertex;
+	}
+	int num_vertices = vertex_corner.size();
+
+	//the triangles in the order the post-transform cache likes best, then the vertices in the order the triangles
+	//first use them, so the GPU fetches them - and the normals get summed up - walking through memory
+	std::vector<int> triangle_order;
+	OptimizeTriangleOrder(corner_vertices, num_vertices, triangle_order);
+
+	std::vector<int> index_list(this->indexList.size());
+	for (int ti = 0; ti < num_polys; ti++)
+	{
+		memcpy(&index_list[ti * 9], &this->indexList[triangle_order[ti] * 9], sizeof(int) * 9);
+	}
+
+	std::vector<int> new_vertex(num_vertices, -1);
+	std::vector<int> vertex_corner_ordered;
+	vertex_corner_ordered.reserve(num_vertices);
+	this->cornerVertices.resize(this->numCorners);
+	for (int ti = 0; ti < num_polys; ti++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			int old_corner = triangle_order[ti] * 3 + k;
+			int vertex = corner_vertices[old_corner];
+			if (new_vertex[vertex] == -1)
+			{
+				new_vertex[vertex] = vertex_corner_ordered.size();
+				vertex_corner_ordered.push_back(ti * 3 + k);
+			}
+			this->cornerVertices[ti * 3 + k] = new_vertex[vertex];
+		}
+	}
+
+#ifdef EDIT_STUFF
+	float acmr_file, atvr_file, acmr, atvr;
+	VertexCacheStatistics(corner_vertices, num_vertices, 16, &acmr_file, &atvr_file);
+	VertexCacheStatistics(this->cornerVertices, num_vertices, 16, &acmr, &atvr);
+	printf("%s: %d triangles, %d vertices (%d drawn without indices) - ACMR %.3f ATVR %.3f in the file order, ACMR %.3f ATVR %.3f optimized\n",
+		fname, num_polys, num_vertices, this->numCorners, acmr_file, atvr_file, acmr, atvr);
+#endif
+
+	this->indexList = std::move(index_list);
+
+	this->numVertices = num_vertices;
+	this->vertexIndexList.resize(this->numVertices * 3);
+	for (int vi = 0; vi < this->numVertices; vi++)
+	{
+		memcpy(&this->vertexIndexList[vi * 3], &this->indexList[vertex_corner_ordered[vi] * 3], sizeof(int) * 3);
+	}
+
+	vLocal = (Vertex*)malloc(sizeof(Vertex) * this->numVertices);
+	vTrans = (Vertex*)malloc(sizeof(Vertex) * this->numVertices);
+	this->texCoords.resize(this->numVertices);
 
-	this->numVertices = num_polys * 3;
 	for (int vi = 0; vi < this->numVertices; vi++)
 	{
-		int index_pos = this->indexList[vi * 3 + 0];
-		int index_UV = this->indexList[vi * 3 + 1];
-		int index_normal = this->indexList[vi * 3 + 2];
+		int index_pos = this->vertexIndexList[vi * 3 + 0];
+		int index_UV = this->vertexIndexList[vi * 3 + 1];
+		int index_normal = this->vertexIndexList[vi * 3 + 2];
 
 		this->vLocal[vi] = Vertex(this->vList[index_pos * 3 + 0], this->vList[index_pos * 3 + 1], this->vList[index_pos * 3 + 2],
-			this->UVList[index_UV * 2 + 0], this->UVList[index_UV * 2 + 1],
-			this->normalList[index_normal * 3 + 0], this->normalList[index_normal * 3 + 1], this->normalList[index_normal * 3 + 2]
-		);
-		this->vTrans[vi] = Vertex(this->vList[index_pos * 3 + 0], this->vList[index_pos * 3 + 1], this->vList[index_pos * 3 + 2],
-			this->UVList[index_UV * 2 + 0], this->UVList[index_UV * 2 + 1],
 			this->normalList[index_normal * 3 + 0], this->normalList[index_normal * 3 + 1], this->normalList[index_normal * 3 + 2]
 		);
+		this->vTrans[vi] = this->vLocal[vi];
+		this->texCoords[vi] = Float2(this->UVList[index_UV * 2 + 0], this->UVList[index_UV * 2 + 1]);
 
 		if (vertexGroups)
 		{
@@ -413,17 +706,88 @@ void Object3D::Load(ID3D11Device* devicePtr, const char* fname, bool vertexGroup
 	if (vertexGroups)
 		Load_Vertex_Groups(this->vSkinnedList, vertexGroupsFname);
 
+	//counted first, so every list of corners is allocated once, at its full size
+	std::vector<int> num_position_corners(this->vList.size() / 3, 0);
+	std::vector<int> num_normal_corners(this->normalList.size() / 3, 0);
+	for (int ci = 0; ci < this->numCorners; ci++)
+	{
+		num_position_corners[this->indexList[ci * 3 + 0]]++;
+		num_normal_corners[this->indexList[ci * 3 + 2]]++;
+	}
+	this->positionCorners.resize(num_position_corners.size());
+	for (int pi = 0; pi < num_position_corners.size(); pi++)
+	{
+		this->positionCorners[pi].reserve(num_position_corners[pi]);
+	}
+	this->normalCorners.resize(num_normal_corners.size());
+	for (int ni = 0; ni < num_normal_corners.size(); ni++)
+	{
+		this->normalCorners[ni].reserve(num_normal_corners[ni]);
+	}
+	for (int ci = 0; ci < this->numCorners; ci++)
+	{
+		this->positionCorners[this->indexList[ci * 3 + 0]].push_back(ci);
+		this->normalCorners[this->indexList[ci * 3 + 2]].push_back(ci);
+	}
+	this->normalDirtyFlags.resize(this->vList.size() / 3, 0);
+	this->normalStamps.resize(this->normalList.size() / 3, 0);
+	this->MarkAllDirty();
+
 
 	fclose(file);
 
-	this->dataBuffer = CreateVertexBuffer(devicePtr, (unsigned char*)this->vTrans, sizeof(float) * 8 * this->numVertices);
+	//the float format is drawn as it is
+	memset(&this->vertexDecode, 0, sizeof(VertexDecode));
+	for (int c = 0; c < 3; c++)
+		this->vertexDecode.posScale[c] = 1.0f;
+	this->vertexDecode.texCoordScale[0] = 1.0f;
+	this->vertexDecode.texCoordScale[1] = 1.0f;
+
+	//the tools load meshes without a rendering backend
+	if (backendPtr != NULL)
+	{
+		if (this->vertexFormat == VERTEX_FORMAT_PACKED)
+		{
+			float uv_min[2] = { FLT_MAX, FLT_MAX };
+			float uv_max[2] = { -FLT_MAX, -FLT_MAX };
+			for (int vi = 0; vi < this->numVertices; vi++)
+			{
+				uv_min[0] = std::min(uv_min[0], this->texCoords[vi].x);
+				uv_min[1] = std::min(uv_min[1], this->texCoords[vi].y);
+				uv_max[0] = std::max(uv_max[0], this->texCoords[vi].x);
+				uv_max[1] = std::max(uv_max[1], this->texCoords[vi].y);
+			}
+
+			std::vector<unsigned short> packed_tex_coords(this->numVertices * 2);
+			for (int c = 0; c < 2; c++)
+			{
+				float extent = uv_max[c] - uv_min[c];
+				float to_unorm = extent > 0.0f ? 65535.0f / extent : 0.0f;
+				for (int vi = 0; vi < this->numVertices; vi++)
+				{
+					float uv = c == 0 ? this->texCoords[vi].x : this->texCoords[vi].y;
+					packed_tex_coords[vi * 2 + c] = (unsigned short)lroundf((uv - uv_min[c]) * to_unorm);
+				}
+				this->vertexDecode.texCoordScale[c] = extent;
+				this->vertexDecode.texCoordOffset[c] = uv_min[c];
+			}
+			this->vertexDecode.octahedralNormals = 1;
+
+			this->texCoordBuffer = backendPtr->CreateBuffer(RENDER_BUFFER_VERTEX, packed_tex_coords.data(), sizeof(unsigned short) * 2 * this->numVertices);
+		}
+		else
+		{
+			this->texCoordBuffer = backendPtr->CreateBuffer(RENDER_BUFFER_VERTEX, this->texCoords.data(), sizeof(Float2) * this->numVertices);
+		}
+		this->indexBuffer = backendPtr->CreateBuffer(RENDER_BUFFER_INDEX, this->cornerVertices.data(), sizeof(int) * this->numCorners);
+		this->decodeBuffer = backendPtr->CreateBuffer(RENDER_BUFFER_CONSTANT, &this->vertexDecode, sizeof(VertexDecode));
+	}
 
 }
 
-void Object3D::LoadTexture(ID3D11Device* devicePtr, ID3D11DeviceContext* devConPtr, const wchar_t* fname)
+void Object3D::LoadTexture(RenderBackend* backendPtr, const wchar_t* fname)
 {
-	HRESULT hr = CreateWICTextureFromFileEx(devicePtr, devConPtr, fname, 0, D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0, WIC_LOADER_IGNORE_SRGB,
-		(ID3D11Resource**)NULL, &this->objTexture);
+	this->objTexture = backendPtr->LoadTexture(fname);
 
 }
 
@@ -431,6 +795,7 @@ void Object3D::LoadTexture(ID3D11Device* devicePtr, ID3D11DeviceContext* devConP
 //translation by a vector of all the vertices
 void Object3D::TranslateByVector(float* vec)
 {
+	this->MarkAllDirty();
 	for (int vi = 0; vi < this->numVertices; vi++)
 	{
 		this->vTrans[vi].pos.x = this->vLocal[vi].pos.x + vec[0];
@@ -442,6 +807,7 @@ void Object3D::TranslateByVector(float* vec)
 //rotation by a queternion of all the vertices
 void Object3D::RotateByQuaternion(Quaternion* q)
 {
+	this->MarkAllDirty();
 	for (int vi = 0; vi < this->numVertices; vi++)
 	{
 		Rotate(q, &this->vLocal[vi].pos.x, &vTrans[vi].pos.x);
@@ -451,6 +817,7 @@ void Object3D::RotateByQuaternion(Quaternion* q)
 //combined rotation and translation
 void Object3D::RotateAndTranslate(Quaternion* q, float* vec)
 {
+	this->MarkAllDirty();
 	for (int vi = 0; vi < this->numVertices; vi++)
 	{
 		Rotate(q, &this->vLocal[vi].pos.x, &vTrans[vi].pos.x);
@@ -478,10 +845,148 @@ void Object3D::Scale(float scale_factor)
 //The algorithm is the same as the one used in Blender for smooth shading - the wider the angle 
 //is between the edges originating from the vertex the greater the influence the triangle will have on the
 //final values of the normal coordinates for this vertex
+//the angle weighted normal of the triangle of the given corner, as RecalculateNormals adds it to the normal of the corner
+static void CornerNormal(const Vertex* vertices, const int* cornerVertices, int corner, float* result)
+{
+	int first = corner - corner % 3;
+	const float* corners[3];
+	for (int ci = 0; ci < 3; ci++)
+	{
+		corners[ci] = &vertices[cornerVertices[first + ci]].pos.x;
+	}
+
+	float u[3], v[3];
+	SubVectors(corners[0], corners[2], u, 3);
+	SubVectors(corners[0], corners[1], v, 3);
+	CrossVectors(v, u, result);
+
+	float length = sqrt(DotVectors(result, result, 3));
+	if (length == 0.0f)
+		return;
+
+	int ci = corner % 3;
+	SubVectors(corners[(ci + 1) % 3], corners[ci], u, 3);
+	SubVectors(corners[(ci + 2) % 3], corners[ci], v, 3);
+	NormalizeVector(u, u, 3);
+	NormalizeVector(v, v, 3);
+
+	float dot_u_v = std::min(std::max(DotVectors(u, v, 3), -1.0f), 1.0f);
+	ScaleVector(result, acos(dot_u_v) / length, 3);
+}
+
 void Object3D::RecalculateNormals()
 {
-	
-	for (int pi = 0; pi < this->numVertices / 3; pi++)
+	//a simplified level has triangles of its own, all of its normals are summed up from them every time it moves
+	if (this->currentLOD > 0)
+	{
+		for (int di = 0; di < this->normalDirtyVertices.size(); di++)
+		{
+			this->normalDirtyFlags[this->normalDirtyVertices[di]] = 0;
+		}
+		this->normalDirtyVertices.clear();
+
+		if (!this->normalsAllDirty)
+			return;
+
+		const std::vector<int>& corner_list = this->lodList[this->currentLOD - 1].cornerList;
+		for (int lci = 0; lci < corner_list.size(); lci++)
+		{
+			memset(&this->normalListTrans[this->indexList[corner_list[lci] * 3 + 2] * 3], 0, sizeof(float) * 3);
+		}
+
+		for (int lci = 0; lci < corner_list.size(); lci += 3)
+		{
+			const float* corners[3];
+			for (int ci = 0; ci < 3; ci++)
+			{
+				corners[ci] = &this->vTrans[this->cornerVertices[corner_list[lci + ci]]].pos.x;
+			}
+
+			//Weighted by the area instead of the angle - the cross product as it is, with no square roots or arc cosines.
+			//From far enough away the difference can't be seen.
+			float u[3], v[3], normal_temp[3];
+			SubVectors(corners[1], corners[0], u, 3);
+			SubVectors(corners[2], corners[0], v, 3);
+			CrossVectors(u, v, normal_temp);
+
+			for (int ci = 0; ci < 3; ci++)
+			{
+				float* normal = &this->normalListTrans[this->indexList[corner_list[lci + ci] * 3 + 2] * 3];
+				AddVectors(normal, normal_temp, normal, 3);
+			}
+		}
+
+		//every normal is normalized by the first of its corners and copied to the rest as it is
+		this->normalStamp++;
+		for (int lci = 0; lci < corner_list.size(); lci++)
+		{
+			int normal_index = this->indexList[corner_list[lci] * 3 + 2];
+			float* normal = &this->normalListTrans[normal_index * 3];
+			if (this->normalStamps[normal_index] != this->normalStamp)
+			{
+				this->normalStamps[normal_index] = this->normalStamp;
+				if (DotVectors(normal, normal, 3) > 0.0f)
+					NormalizeVector(normal, normal, 3);
+			}
+			memcpy(&this->vTrans[this->cornerVertices[corner_list[lci]]].normal, normal, sizeof(float) * 3);
+		}
+
+		this->normalsAllDirty = false;
+		this->uploadDirty = true;
+		return;
+	}
+
+	//when many vertices moved recalculating all the normals is cheaper, since every triangle is visited once
+	if (this->normalDirtyVertices.size() > this->positionCorners.size() / 4)
+		this->normalsAllDirty = true;
+
+	if (!this->normalsAllDirty)
+	{
+		//Only the normals shared by the triangles around the moved vertices can change. Each of them is summed up again
+		//from all of its corners, the stamps make sure that happens once per normal.
+		this->normalStamp++;
+		for (int di = 0; di < this->normalDirtyVertices.size(); di++)
+		{
+			int vi = this->normalDirtyVertices[di];
+			this->normalDirtyFlags[vi] = 0;
+
+			for (int pci = 0; pci < this->positionCorners[vi].size(); pci++)
+			{
+				int first = this->positionCorners[vi][pci] / 3 * 3;
+				for (int ci = first; ci < first + 3; ci++)
+				{
+					int normal_index = this->indexList[ci * 3 + 2];
+					if (this->normalStamps[normal_index] == this->normalStamp)
+						continue;
+					this->normalStamps[normal_index] = this->normalStamp;
+
+					float* normal = &this->normalListTrans[normal_index * 3];
+					memset(normal, 0, sizeof(float) * 3);
+					const std::vector<int>& corners = this->normalCorners[normal_index];
+					for (int nci = 0; nci < corners.size(); nci++)
+					{
+						float normal_temp[3];
+						CornerNormal(this->vTrans, this->cornerVertices.data(), corners[nci], normal_temp);
+						AddVectors(normal, normal_temp, normal, 3);
+					}
+					if (DotVectors(normal, normal, 3) > 0.0f)
+						NormalizeVector(normal, normal, 3);
+
+					for (int nci = 0; nci < corners.size(); nci++)
+					{
+						memcpy(&this->vTrans[this->cornerVertices[corners[nci]]].normal, normal, sizeof(float) * 3);
+					}
+				}
+			}
+		}
+		this->normalDirtyVertices.clear();
+		return;
+	}
+
+	//the sums start from zero every time, otherwise the previous normals would leak into the new ones
+	memset(this->normalListTrans.data(), 0, sizeof(float) * this->normalListTrans.size());
+
+	for (int pi = 0; pi < this->numCorners / 3; pi++)
 	{
 		float u[3], v[3], normal_temp[3];
 		int normal_index;
@@ -495,9 +1000,9 @@ void Object3D::RecalculateNormals()
 		memcpy(v1, &this->v_local[pi * 3 + 1].pos.x, sizeof(float) * 3);
 		memcpy(v2, &this->v_local[pi * 3 + 2].pos.x, sizeof(float) * 3);*/
 
-		memcpy(v0, &this->vTrans[pi * 3 + 0].pos.x, sizeof(float) * 3);
-		memcpy(v1, &this->vTrans[pi * 3 + 1].pos.x, sizeof(float) * 3);
-		memcpy(v2, &this->vTrans[pi * 3 + 2].pos.x, sizeof(float) * 3);
+		memcpy(v0, &this->vTrans[this->cornerVertices[pi * 3 + 0]].pos.x, sizeof(float) * 3);
+		memcpy(v1, &this->vTrans[this->cornerVertices[pi * 3 + 1]].pos.x, sizeof(float) * 3);
+		memcpy(v2, &this->vTrans[this->cornerVertices[pi * 3 + 2]].pos.x, sizeof(float) * 3);
 
 		
 		SubVectors(v0, v2, u, 3);
@@ -572,117 +1077,605 @@ void Object3D::RecalculateNormals()
 	
 	for (int vi = 0; vi < this->numVertices; vi++)
 	{
-		int normal_index = this->indexList[vi * 3 + 2];
+		int normal_index = this->vertexIndexList[vi * 3 + 2];
 		memcpy(&this->vTrans[vi].normal, &this->normalListTrans[normal_index * 3], sizeof(float) * 3);
 
 	}
 
+	//from now on the moved vertices are tracked one by one
+	for (int di = 0; di < this->normalDirtyVertices.size(); di++)
+	{
+		this->normalDirtyFlags[this->normalDirtyVertices[di]] = 0;
+	}
+	this->normalDirtyVertices.clear();
+	this->normalsAllDirty = false;
+	this->uploadDirty = true;
 }
 
-void Object3D::DrawObject(ID3D11DeviceContext* devConPtr)
+void Object3D::MarkVertexDirty(int vi)
 {
-	UINT  stride = sizeof(float) * 8;
-	UINT  offset = 0;
-
-	devConPtr->UpdateSubresource(this->dataBuffer, 0, NULL, this->vTrans, 0, 0);
-	devConPtr->IASetVertexBuffers(0, 1, &this->dataBuffer, &stride, &offset);
-	devConPtr->Draw(this->numVertices, 0);
+	if (!this->normalDirtyFlags[vi])
+	{
+		this->normalDirtyFlags[vi] = 1;
+		this->normalDirtyVertices.push_back(vi);
+	}
+	this->uploadDirty = true;
 }
 
-
-
-
-Bone::Bone(Bone&& other)
+void Object3D::MarkAllDirty()
 {
-	this->name = other.name;
-	this->parentName = other.parentName;
-	this->parent = other.parent;
-	this->size = other.size;
-
-	this->qLocal = other.qLocal;
-	memcpy(this->posLocal, other.posLocal, sizeof(float) * 3);
-
-	this->qBasis = other.qBasis;
-	memcpy(this->posBasis, other.posBasis, sizeof(float) * 3);
-
-	this->qBasisCurrent = other.qBasisCurrent;
-	memcpy(this->posBasisCurrent, other.posBasisCurrent, sizeof(float) * 3);
-
-	this->numFrames = other.numFrames;
-	this->frameList = other.frameList;
-
-	this->object3d = std::move(other.object3d);
+	this->normalsAllDirty = true;
+	this->uploadDirty = true;
 }
 
-
-
-//Compute the final tranformations of all the bones
-//It's a recursive process. For each bone it's final transformation equals: a composition of it's basis transformation, its local transformation,
-//the reverse local transformation of its parent  and it's parents final tranformation
-//(so we in turn need to compute it. The recursive process end's up once we arriave at the root bone).
-//For a better explanation check out this thread on blender.stackexchange.com (I could have never explained it better myself):
-//https://blender.stackexchange.com/questions/44637/how-can-i-manually-calculate-bpy-types-posebone-matrix-using-blenders-python-ap
-TransformPair Bone::ComputeFinalOrientationPos()
+void Object3D::ReorderPositions(const std::vector<int>& order)
 {
-	Quaternion q_temp = HamiltonProd(this->qLocal, this->qBasisCurrent);
-	float pos_temp[3];
-	Rotate(&this->qLocal, this->posBasis, pos_temp);
+	std::vector<int> new_index(order.size());
+	for (int pi = 0; pi < order.size(); pi++)
+	{
+		new_index[order[pi]] = pi;
+	}
 
-	TransformPair result;
-	AddVectors(pos_temp, this->posLocal, pos_temp, 3);
+	std::vector<float> v_list(this->vList.size());
+	std::vector<std::vector<int>> position_corners(this->positionCorners.size());
+	for (int pi = 0; pi < order.size(); pi++)
+	{
+		memcpy(&v_list[pi * 3], &this->vList[order[pi] * 3], sizeof(float) * 3);
+		position_corners[pi] = std::move(this->positionCorners[order[pi]]);
+	}
+	this->vList = std::move(v_list);
+	this->positionCorners = std::move(position_corners);
 
-	if (this->parent == NULL)
+	//the vertices keep pointing to the same corners of vTrans, only their place in the list changes
+	if (this->vSkinnedList.size() == order.size())
 	{
-		result.orient = q_temp;
-		memcpy(result.pos, pos_temp, sizeof(float) * 3);
+		std::vector<VertexSkinned> v_skinned_list(order.size());
+		for (int pi = 0; pi < order.size(); pi++)
+		{
+			v_skinned_list[pi] = std::move(this->vSkinnedList[order[pi]]);
+		}
+		this->vSkinnedList = std::move(v_skinned_list);
+	}
 
-		this->qFinal = result.orient;
-		memcpy(this->posFinal, result.pos, sizeof(float) * 3);
-		return result;
+	for (int ci = 0; ci < this->numCorners; ci++)
+	{
+		this->indexList[ci * 3] = new_index[this->indexList[ci * 3]];
 	}
-	else
+	for (int vi = 0; vi < this->numVertices; vi++)
 	{
-		Quaternion parent_inverse_orient = this->parent->qLocal.Reciprocal();
-		float parent_inverse_pos[] = { -this->parent->posLocal[0], -this->parent->posLocal[1], -this->parent->posLocal[2] };
+		this->vertexIndexList[vi * 3] = new_index[this->vertexIndexList[vi * 3]];
+	}
 
-		TransformPair parent_final_transform = parent->ComputeFinalOrientationPos();
+	this->normalDirtyVertices.clear();
+	this->normalDirtyFlags.assign(order.size(), 0);
+	this->MarkAllDirty();
+}
 
-		q_temp = HamiltonProd(parent_inverse_orient, q_temp);
+void Object3D::ComputeNormals(const float* positions, float* normals) const
+{
+	memset(normals, 0, sizeof(float) * this->normalList.size());
 
-		result.orient = HamiltonProd(parent_final_transform.orient, q_temp);
+	for (int pi = 0; pi < this->numCorners / 3; pi++)
+	{
+		const float* corners[3];
+		for (int ci = 0; ci < 3; ci++)
+		{
+			corners[ci] = &positions[this->indexList[pi * 9 + ci * 3] * 3];
+		}
 
-		AddVectors(pos_temp, parent_inverse_pos, pos_temp, 3);
+		//all three corners of the triangle share the same normal, they differ only in the angle
+		float u[3], v[3], normal_temp[3];
+		SubVectors(corners[0], corners[2], u, 3);
+		SubVectors(corners[0], corners[1], v, 3);
+		CrossVectors(v, u, normal_temp);
 
-		Rotate(&parent_inverse_orient, pos_temp, pos_temp);
-		Rotate(&parent_final_transform.orient, pos_temp, pos_temp);
+		float length = sqrt(DotVectors(normal_temp, normal_temp, 3));
+		if (length == 0.0f)
+			continue;
+		ScaleVector(normal_temp, 1.0f / length, 3);
 
-		AddVectors(pos_temp, parent_final_transform.pos, result.pos, 3);
+		for (int ci = 0; ci < 3; ci++)
+		{
+			SubVectors(corners[(ci + 1) % 3], corners[ci], u, 3);
+			SubVectors(corners[(ci + 2) % 3], corners[ci], v, 3);
 
-		this->qFinal = result.orient;
-		memcpy(this->posFinal, result.pos, sizeof(float) * 3);
+			NormalizeVector(u, u, 3);
+			NormalizeVector(v, v, 3);
 
-		return result;
+			//the wider the angle the greater the influence
+			float dot_u_v = std::min(std::max(DotVectors(u, v, 3), -1.0f), 1.0f);
+			float alpha = acos(dot_u_v);
+
+			float* normal = &normals[this->indexList[pi * 9 + ci * 3 + 2] * 3];
+			for (int k = 0; k < 3; k++)
+			{
+				normal[k] += normal_temp[k] * alpha;
+			}
+		}
 	}
 
+	for (int ni = 0; ni < this->normalList.size() / 3; ni++)
+	{
+		if (DotVectors(&normals[ni * 3], &normals[ni * 3], 3) > 0.0f)
+			NormalizeVector(&normals[ni * 3], &normals[ni * 3], 3);
+	}
 }
 
-//Transformation of a vertex by the bone. At first the relative position of a vertex to the bone is computed, when
-//the bone is in its "rest pose" and then this position is transformed by the final orientation and position of the bone.
-//A very innefficient way of doing it. The better way would be to convert all the translations and rotation to matrices
-//and stack them all together. Although I intended to keep this as simple as possible it can't be stressed enough
-//that this it the worst way of conducting this operation!
-void Bone::TransformVertexByBone(float* vSrc, float* vDst)
+bool Object3D::LoadPointCache(const char* fname)
 {
-	float v_temp[3];
-	SubVectors(vSrc, this->posLocal, v_temp, 3);
-	Quaternion q_temp = this->qLocal.Reciprocal();
-	Rotate(&q_temp, v_temp, v_temp);
-	Rotate(&this->qFinal, v_temp, v_temp);
-	AddVectors(v_temp, this->posFinal, vDst, 3);
+	PointCachePlayer* player = new PointCachePlayer();
+	if (!player->Open(fname) || player->GetHeader().numPositions != this->vList.size() / 3 ||
+		player->GetHeader().numNormals != this->normalList.size() / 3)
+	{
+		delete player;
+		return false;
+	}
+
+	delete this->pointCache;
+	this->pointCache = player;
+	this->pointCacheFrame = -FLT_MAX;
+	return true;
 }
 
+void Object3D::PlayPointCache(float frame)
+{
+	if (frame == this->pointCacheFrame)
+		return;
+	this->pointCacheFrame = frame;
+
+	const float* positions;
+	const float* normals;
+	this->pointCache->Sample(frame, &positions, &normals);
+	this->MarkAllDirty();
+	//the baked positions are interpolated between the frames of the cache, not between the poses of the bones
+	this->packBounds.empty = true;
+
+	for (int vi = 0; vi < this->numVertices; vi++)
+	{
+		memcpy(&this->vTrans[vi].pos, &positions[this->vertexIndexList[vi * 3] * 3], sizeof(float) * 3);
+		memcpy(&this->vTrans[vi].normal, &normals[this->vertexIndexList[vi * 3 + 2] * 3], sizeof(float) * 3);
+	}
+}
+
+void Object3D::BuildLODs(RenderBackend* backendPtr, const std::vector<float>& triangleRatios, const std::vector<int>& maxInfluences,
+	float weightPenalty)
+{
+	std::vector<std::vector<int>> level_corners;
+	SimplifyMesh(this, triangleRatios, weightPenalty, level_corners);
+
+	for (int li = 0; li < this->lodList.size(); li++)
+	{
+		if (this->lodList[li].indexBuffer != NULL)
+			this->lodList[li].indexBuffer->Release();
+	}
+	this->lodList.assign(level_corners.size(), MeshLOD());
+	for (int li = 0; li < level_corners.size(); li++)
+	{
+		MeshLOD& lod = this->lodList[li];
+		lod.cornerList = level_corners[li];
+
+		std::vector<char> used(this->vSkinnedList.size(), 0);
+		for (int lci = 0; lci < lod.cornerList.size(); lci++)
+		{
+			int vi = this->indexList[lod.cornerList[lci] * 3];
+			if (vi < used.size() && !used[vi])
+			{
+				used[vi] = 1;
+				lod.vertices.push_back(vi);
+			}
+		}
+
+		//the heaviest vertex groups only, rescaled so the vertex is not pulled towards the origin
+		lod.vGroups.resize(lod.vertices.size());
+		for (int lvi = 0; lvi < lod.vertices.size(); lvi++)
+		{
+			std::vector<VertexGroup>& v_groups = lod.vGroups[lvi];
+			v_groups = this->vSkinnedList[lod.vertices[lvi]].vGroups;
+			std::stable_sort(v_groups.begin(), v_groups.end(),
+				[](const VertexGroup& a, const VertexGroup& b) { return a.weight > b.weight; });
+			if (v_groups.size() > maxInfluences[li])
+				v_groups.erase(v_groups.begin() + maxInfluences[li], v_groups.end());
+
+			float weight_sum = 0.0f;
+			for (int gi = 0; gi < v_groups.size(); gi++)
+			{
+				weight_sum += v_groups[gi].weight;
+			}
+			for (int gi = 0; gi < v_groups.size() && weight_sum > 0.0f; gi++)
+			{
+				v_groups[gi].weight /= weight_sum;
+			}
+			lod.numInfluences += v_groups.size();
+		}
+
+		if (backendPtr != NULL && !lod.cornerList.empty())
+		{
+			std::vector<int> indices(lod.cornerList.size());
+			for (int lci = 0; lci < lod.cornerList.size(); lci++)
+			{
+				indices[lci] = this->cornerVertices[lod.cornerList[lci]];
+			}
+			lod.indexBuffer = backendPtr->CreateBuffer(RENDER_BUFFER_INDEX, indices.data(), sizeof(int) * indices.size());
+		}
+	}
+
+#ifdef EDIT_STUFF
+	for (int li = 0; li < this->lodList.size(); li++)
+	{
+		printf("LOD %d: %d triangles, %d vertices to skin (of %d, %d)\n", li + 1, (int)this->lodList[li].cornerList.size() / 3,
+			(int)this->lodList[li].vertices.size(), this->numCorners / 3, (int)this->vSkinnedList.size());
+	}
+#endif
+}
+
+//Writes the vertices to result in VERTEX_FORMAT_PACKED - the positions within the given box (if it is empty, the
+//box of the vertices themselves), which goes to posScale and posOffset of decode.
+static void PackVertices(const Vertex* vertices, int numVertices, const BoneBounds& bounds, PackedVertex* result, VertexDecode* decode)
+{
+	float pos_min[3], pos_max[3];
+	if (!bounds.empty)
+	{
+		memcpy(pos_min, bounds.min, sizeof(float) * 3);
+		memcpy(pos_max, bounds.max, sizeof(float) * 3);
+	}
+	else
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			pos_min[c] = FLT_MAX;
+			pos_max[c] = -FLT_MAX;
+		}
+		for (int vi = 0; vi < numVertices; vi++)
+		{
+			const float* pos = &vertices[vi].pos.x;
+			for (int c = 0; c < 3; c++)
+			{
+				pos_min[c] = std::min(pos_min[c], pos[c]);
+				pos_max[c] = std::max(pos_max[c], pos[c]);
+			}
+		}
+	}
+
+	float to_snorm[3];
+	for (int c = 0; c < 3; c++)
+	{
+		float half_extent = (pos_max[c] - pos_min[c]) * 0.5f;
+		decode->posScale[c] = half_extent;
+		decode->posOffset[c] = (pos_min[c] + pos_max[c]) * 0.5f;
+		to_snorm[c] = half_extent > 0.0f ? 32767.0f / half_extent : 0.0f;
+	}
+
+	//a box not found from the vertices may still miss one of them by a little - it is clamped to the edge instead of
+	//wrapping around to the other side
+	for (int vi = 0; vi < numVertices; vi++)
+	{
+		const float* pos = &vertices[vi].pos.x;
+		for (int c = 0; c < 3; c++)
+		{
+			float packed = (pos[c] - decode->posOffset[c]) * to_snorm[c];
+			result[vi].pos[c] = (short)lroundf(std::min(std::max(packed, -32767.0f), 32767.0f));
+		}
+		result[vi].pos[3] = 0;
+		OctahedralEncode(&vertices[vi].normal.x, result[vi].normal);
+	}
+}
+
+void Object3D::DrawObject(RenderBackend* backendPtr, DynamicVertexRing* ringPtr)
+{
+	unsigned int vertex_size = this->vertexFormat == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+
+	if (this->uploadDirty || this->ringGeneration != ringPtr->generation)
+	{
+		void* mapped = ringPtr->Allocate(backendPtr, vertex_size * this->numVertices, &this->ringOffset);
+		if (mapped == NULL)
+			return;
+		if (this->vertexFormat == VERTEX_FORMAT_PACKED)
+		{
+			PackVertices(this->vTrans, this->numVertices, this->packBounds, (PackedVertex*)mapped, &this->vertexDecode);
+		}
+		else
+		{
+			memcpy(mapped, this->vTrans, sizeof(Vertex) * this->numVertices);
+		}
+		ringPtr->Unmap(backendPtr);
+		this->ringGeneration = ringPtr->generation;
+		this->uploadDirty = false;
+
+		if (this->vertexFormat == VERTEX_FORMAT_PACKED)
+			backendPtr->UpdateBuffer(this->decodeBuffer, &this->vertexDecode, sizeof(VertexDecode));
+	}
+
+	this->DrawFromRing(backendPtr, ringPtr, this->currentLOD);
+}
+
+void Object3D::StageVertices(int slot, bool visible)
+{
+	StagedVertices& staged = this->staged[slot];
+	staged.visible = visible;
+	staged.lod = this->currentLOD;
+	if (!visible)
+		return;
+
+	if (this->uploadDirty)
+	{
+		this->vertexVersion++;
+		this->uploadDirty = false;
+	}
+	if (staged.version == this->vertexVersion)
+		return;
+
+	staged.decode = this->vertexDecode;
+	if (this->vertexFormat == VERTEX_FORMAT_PACKED)
+	{
+		staged.data.resize(sizeof(PackedVertex) * this->numVertices);
+		PackVertices(this->vTrans, this->numVertices, this->packBounds, (PackedVertex*)staged.data.data(), &staged.decode);
+	}
+	else
+	{
+		staged.data.resize(sizeof(Vertex) * this->numVertices);
+		memcpy(staged.data.data(), this->vTrans, staged.data.size());
+	}
+	staged.version = this->vertexVersion;
+}
+
+void Object3D::DrawStaged(RenderBackend* backendPtr, DynamicVertexRing* ringPtr, int slot)
+{
+	const StagedVertices& staged = this->staged[slot];
+	if (!staged.visible || staged.version == 0)
+		return;
+
+	if (staged.version != this->drawnVersion || this->ringGeneration != ringPtr->generation)
+	{
+		void* mapped = ringPtr->Allocate(backendPtr, staged.data.size(), &this->ringOffset);
+		if (mapped == NULL)
+			return;
+		memcpy(mapped, staged.data.data(), staged.data.size());
+		ringPtr->Unmap(backendPtr);
+		this->ringGeneration = ringPtr->generation;
+		this->drawnVersion = staged.version;
+
+		if (this->vertexFormat == VERTEX_FORMAT_PACKED)
+			backendPtr->UpdateBuffer(this->decodeBuffer, &staged.decode, sizeof(VertexDecode));
+	}
+
+	this->DrawFromRing(backendPtr, ringPtr, staged.lod);
+}
+
+void Object3D::DrawFromRing(RenderBackend* backendPtr, DynamicVertexRing* ringPtr, int lod)
+{
+	unsigned int vertex_size = this->vertexFormat == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+	unsigned int tex_coord_size = this->vertexFormat == VERTEX_FORMAT_PACKED ? sizeof(unsigned short) * 2 : sizeof(Float2);
+
+	RenderBuffer* buffers[2] = { ringPtr->buffer, this->texCoordBuffer };
+	unsigned int strides[2] = { vertex_size, tex_coord_size };
+	unsigned int offsets[2] = { this->ringOffset, 0 };
+
+	backendPtr->SetVertexConstantBuffer(1, this->decodeBuffer);
+	backendPtr->SetVertexBuffers(2, buffers, strides, offsets);
+	if (lod > 0)
+	{
+		const MeshLOD& mesh_lod = this->lodList[lod - 1];
+		backendPtr->SetIndexBuffer(mesh_lod.indexBuffer);
+		backendPtr->DrawIndexed(mesh_lod.cornerList.size());
+	}
+	else
+	{
+		backendPtr->SetIndexBuffer(this->indexBuffer);
+		backendPtr->DrawIndexed(this->numCorners);
+	}
+}
+
+
+
+
+Bone::Bone(Bone&& other)
+{
+	this->name = std::move(other.name);
+	this->ID = other.ID;
+	this->parentName = std::move(other.parentName);
+	this->parent = other.parent;
+	this->parentIndex = other.parentIndex;
+	this->size = other.size;
+
+	this->qLocal = other.qLocal;
+	memcpy(this->posLocal, other.posLocal, sizeof(float) * 3);
+
+	this->qBasis = other.qBasis;
+	memcpy(this->posBasis, other.posBasis, sizeof(float) * 3);
+
+	this->qBasisCurrent = other.qBasisCurrent;
+	memcpy(this->posBasisCurrent, other.posBasisCurrent, sizeof(float) * 3);
+
+	this->numFrames = other.numFrames;
+	this->frameList = std::move(other.frameList);
+
+	this->object3d = std::move(other.object3d);
+}
+
+
+
+Quaternion Bone::InterpolateFrames(float frame) const
+{
+	if (this->frameList.size() == 0)
+		return this->qBasis;
+
+	for (int fi = 1; fi < this->frameList.size(); fi++)
+	{
+		if (frame < this->frameList[fi].numFrame)
+		{
+			float frame_full_dist = this->frameList[fi].numFrame - this->frameList[fi - 1].numFrame;
+			float frame_dist = frame - this->frameList[fi - 1].numFrame;
+			float t = std::max(frame_dist / frame_full_dist, 0.0f);
+			return QuaternionSlerp(&this->frameList[fi - 1].orientation, &this->frameList[fi].orientation, t);
+		}
+	}
+
+	return this->frameList.back().orientation;
+}
+
+//Compute the final tranformations of all the bones
+//It's a recursive process. For each bone it's final transformation equals: a composition of it's basis transformation, its local transformation,
+//the reverse local transformation of its parent  and it's parents final tranformation
+//(so we in turn need to compute it. The recursive process end's up once we arriave at the root bone).
+//For a better explanation check out this thread on blender.stackexchange.com (I could have never explained it better myself):
+//https://blender.stackexchange.com/questions/44637/how-can-i-manually-calculate-bpy-types-posebone-matrix-using-blenders-python-ap
+TransformPair Bone::ComputeFinalOrientationPos()
+{
+	Quaternion q_temp = HamiltonProd(this->qLocal, this->qBasisCurrent);
+	float pos_temp[3];
+	Rotate(&this->qLocal, this->posBasis, pos_temp);
+
+	TransformPair result;
+	AddVectors(pos_temp, this->posLocal, pos_temp, 3);
+
+	if (this->parent == NULL)
+	{
+		result.orient = q_temp;
+		memcpy(result.pos, pos_temp, sizeof(float) * 3);
+
+		this->qFinal = result.orient;
+		memcpy(this->posFinal, result.pos, sizeof(float) * 3);
+		return result;
+	}
+	else
+	{
+		Quaternion parent_inverse_orient = this->parent->qLocal.Reciprocal();
+		float parent_inverse_pos[] = { -this->parent->posLocal[0], -this->parent->posLocal[1], -this->parent->posLocal[2] };
+
+		TransformPair parent_final_transform = parent->ComputeFinalOrientationPos();
+
+		q_temp = HamiltonProd(parent_inverse_orient, q_temp);
+
+		result.orient = HamiltonProd(parent_final_transform.orient, q_temp);
+
+		AddVectors(pos_temp, parent_inverse_pos, pos_temp, 3);
+
+		Rotate(&parent_inverse_orient, pos_temp, pos_temp);
+		Rotate(&parent_final_transform.orient, pos_temp, pos_temp);
+
+		AddVectors(pos_temp, parent_final_transform.pos, result.pos, 3);
+
+		this->qFinal = result.orient;
+		memcpy(this->posFinal, result.pos, sizeof(float) * 3);
+
+		return result;
+	}
+
+}
+
+//Transformation of a vertex by the bone. At first the relative position of a vertex to the bone is computed, when
+//the bone is in its "rest pose" and then this position is transformed by the final orientation and position of the bone.
+//A very innefficient way of doing it. The better way would be to convert all the translations and rotation to matrices
+//and stack them all together. Although I intended to keep this as simple as possible it can't be stressed enough
+//that this it the worst way of conducting this operation!
+void Bone::TransformVertexByBone(float* vSrc, float* vDst)
+{
+	float v_temp[3];
+	SubVectors(vSrc, this->posLocal, v_temp, 3);
+	Quaternion q_temp = this->qLocal.Reciprocal();
+	Rotate(&q_temp, v_temp, v_temp);
+	Rotate(&this->qFinal, v_temp, v_temp);
+	AddVectors(v_temp, this->posFinal, vDst, 3);
+}
+
+
+
+
+void Bone::TransformVertexByBone(const TransformPair* boneTransform, const float* vSrc, float* vDst) const
+{
+	float v_temp[3];
+	SubVectors(vSrc, this->posLocal, v_temp, 3);
+	Quaternion q_temp = this->qLocal.Reciprocal();
+	Rotate(&q_temp, v_temp, v_temp);
+	Rotate(&boneTransform->orient, v_temp, v_temp);
+	AddVectors(v_temp, boneTransform->pos, vDst, 3);
+}
+
+
+//The vertex is moved to the bone space by qLocal^-1 and posLocal and then to the world by the final transformation, so
+//the combined rotation is qFinal * qLocal^-1 and the translation is whatever it takes to map posLocal onto posFinal.
+DualQuaternion Bone::SkinningDualQuaternion(const TransformPair* boneTransform) const
+{
+	Quaternion q_local_recip = this->qLocal.Reciprocal();
+	Quaternion q = HamiltonProd(boneTransform->orient, q_local_recip);
+	q.Normalize();
+
+	float t[3];
+	Rotate(&q, this->posLocal, t);
+	SubVectors(boneTransform->pos, t, t, 3);
+
+	return DualQuaternionFromRotationTranslation(&q, t);
+}
+
+void Bone::SkinningMatrix(const TransformPair* boneTransform, float* matrix) const
+{
+	//the translation is where the origin ends up, the columns of the rotation where the axes do relative to it
+	float origin[3] = { 0.0f, 0.0f, 0.0f };
+	float t[3];
+	this->TransformVertexByBone(boneTransform, origin, t);
+
+	for (int ai = 0; ai < 3; ai++)
+	{
+		float axis[3] = { 0.0f, 0.0f, 0.0f };
+		axis[ai] = 1.0f;
+		float image[3];
+		this->TransformVertexByBone(boneTransform, axis, image);
+		for (int ri = 0; ri < 3; ri++)
+		{
+			matrix[ri * 4 + ai] = image[ri] - t[ri];
+		}
+	}
+	for (int ri = 0; ri < 3; ri++)
+	{
+		matrix[ri * 4 + 3] = t[ri];
+	}
+}
+
+void Armature::SetChangeTolerance(float angularTolerance, float positionalTolerance)
+{
+	this->changeAngularTolerance = angularTolerance;
+	this->changePositionalTolerance = positionalTolerance;
+}
+
+void Armature::DetectChangedBones()
+{
+	this->poseVersion++;
+
+	bool exact = this->changeAngularTolerance <= 0.0f && this->changePositionalTolerance <= 0.0f;
+	for (int bi = 0; bi < this->numBones; bi++)
+	{
+		Bone& curr_bone = this->boneList[bi];
 
+		bool changed;
+		if (curr_bone.changedVersion == 0)
+		{
+			changed = true;
+		}
+		else if (memcmp(&curr_bone.qFinal, &curr_bone.qCommitted, sizeof(Quaternion)) == 0 &&
+			memcmp(curr_bone.posFinal, curr_bone.posCommitted, sizeof(float) * 3) == 0)
+		{
+			changed = false;
+		}
+		else if (exact)
+		{
+			changed = true;
+		}
+		else
+		{
+			float diff[3];
+			SubVectors(curr_bone.posFinal, curr_bone.posCommitted, diff, 3);
+			changed = sqrt(DotVectors(diff, diff, 3)) > this->changePositionalTolerance ||
+				QuaternionAngle(&curr_bone.qFinal, &curr_bone.qCommitted) > this->changeAngularTolerance;
+		}
 
+		if (changed)
+		{
+			curr_bone.qCommitted = curr_bone.qFinal;
+			memcpy(curr_bone.posCommitted, curr_bone.posFinal, sizeof(float) * 3);
+			curr_bone.changedVersion = this->poseVersion;
+		}
+	}
+}
 
 void Armature::ReleaseD3D()
 {
@@ -694,7 +1687,7 @@ void Armature::ReleaseD3D()
 }
 
 //For better understading of the loading code please open and examine the file itself
-void Armature::Load(ID3D11Device* devicePtr, const char* filename, const char* modelFilename, bool anim)
+void Armature::Load(RenderBackend* backendPtr, const char* filename, const char* modelFilename, bool anim)
 {
 	char line[256];
 	FILE* f = fopen(filename, "r");
@@ -702,6 +1695,9 @@ void Armature::Load(ID3D11Device* devicePtr, const char* filename, const char* m
 	fgets(line, 256, f);
 	sscanf(line, "%*s %d", &this->numBones);
 
+	//room for all the bones at once, so none of them is moved while the others are loaded
+	this->boneList.reserve(this->boneList.size() + this->numBones);
+
 	//loop over all the bones
 	for (int bi = 0; bi < this->numBones; bi++)
 	{
@@ -709,8 +1705,9 @@ void Armature::Load(ID3D11Device* devicePtr, const char* filename, const char* m
 		boneList.push_back(Bone());
 		Bone& curr_bone = boneList.back();
 
-		//load the bone model
-		curr_bone.object3d.Load(devicePtr, modelFilename);
+		//load the bone model (headless tools pass no model at all)
+		if (modelFilename != NULL)
+			curr_bone.object3d.Load(backendPtr, modelFilename);
 
 		curr_bone.ID = bi;
 		//skip this line
@@ -781,7 +1778,10 @@ void Armature::Load(ID3D11Device* devicePtr, const char* filename, const char* m
 		if (anim)
 		{
 
-			//read w values for all the frames
+			//read w values for all the frames - the bones are usually keyed at the same frames, so as many of them
+			//as the previous bone had are expected
+			if (this->boneList.size() > 1)
+				curr_bone.frameList.reserve(this->boneList[this->boneList.size() - 2].frameList.size());
 			fgets(line, 256, f);
 			fgets(line, 256, f);
 			while (line[0] != 'x')
@@ -795,7 +1795,11 @@ void Armature::Load(ID3D11Device* devicePtr, const char* filename, const char* m
 			//now we know how many frames there are
 			size_t temp_num_frames = curr_bone.frameList.size();
 
+			this->firstFrame = curr_bone.frameList.front().numFrame;
 			this->lastFrame = curr_bone.frameList.back().numFrame;
+			//the steps of AnimateSteps start at the beginning of the clip, whatever frame it begins with
+			this->stepFrame = this->firstFrame;
+			this->prevStepFrame = this->firstFrame;
 
 			//"x"
 			for (int fi = 0; fi < temp_num_frames; fi++)
@@ -844,26 +1848,391 @@ void Armature::Load(ID3D11Device* devicePtr, const char* filename, const char* m
 	{
 		Bone& curr_bone = this->boneList[bi];
 		curr_bone.parent = NULL;
+		curr_bone.parentIndex = -1;
 		for (int bi2 = 0; bi2 < this->numBones; bi2++)
 		{
 			if (curr_bone.parentName == this->boneList[bi2].name)
 			{
 				curr_bone.parent = &this->boneList[bi2];
+				curr_bone.parentIndex = bi2;
 				break;
 			}
 		}
 
 	}
 
-}
-
-void Armature::Animate(float progress)
-{
-	this->currFrame += progress;
-	if (this->currFrame > this->lastFrame)
+	//order the bones so that every parent comes before its children - repeatedly take the bones
+	//whose parents have already been taken
+	std::vector<bool> ordered(this->numBones, false);
+	this->evalOrder.clear();
+	while (this->evalOrder.size() < this->numBones)
 	{
-		this->currFrame = 1;
+		size_t num_ordered = this->evalOrder.size();
+		for (int bi = 0; bi < this->numBones; bi++)
+		{
+			int parent_index = this->boneList[bi].parentIndex;
+			if (!ordered[bi] && (parent_index == -1 || ordered[parent_index]))
+			{
+				ordered[bi] = true;
+				this->evalOrder.push_back(bi);
+			}
+		}
+
+		//a cycle in the hierarchy - should never happen with files exported from Blender
+		if (this->evalOrder.size() == num_ordered)
+			break;
 	}
+
+}
+
+void Armature::Save(const char* filename)
+{
+	FILE* f = fopen(filename, "w");
+
+	fprintf(f, "NUM_BONES: %d\n\n", this->numBones);
+
+	for (int bi = 0; bi < this->numBones; bi++)
+	{
+		Bone& curr_bone = this->boneList[bi];
+
+		//undo the swap of z and y done by Load (left handed coordinated system vs right handed)
+		fprintf(f, "////////BONE_ID: %s//////////\n", curr_bone.name.c_str());
+		fprintf(f, "Parent_ID: %s\n", curr_bone.parentName.c_str());
+		fprintf(f, "Size: %.9g\n", curr_bone.size);
+		fprintf(f, "Quaternion local: %.9g %.9g %.9g %.9g\n", curr_bone.qLocal.w, curr_bone.qLocal.x, -curr_bone.qLocal.z, curr_bone.qLocal.y);
+		fprintf(f, "Location local: %.9g %.9g %.9g\n", curr_bone.posLocal[0], -curr_bone.posLocal[2], curr_bone.posLocal[1]);
+		fprintf(f, "Quaternion basis: %.9g %.9g %.9g %.9g\n", curr_bone.qBasis.w, curr_bone.qBasis.x, -curr_bone.qBasis.z, curr_bone.qBasis.y);
+		fprintf(f, "Location basis: %.9g %.9g %.9g\n", curr_bone.posBasis[0], -curr_bone.posBasis[2], curr_bone.posBasis[1]);
+
+		if (curr_bone.frameList.size() > 0)
+		{
+			fprintf(f, "w :\n");
+			for (int fi = 0; fi < curr_bone.frameList.size(); fi++)
+				fprintf(f, "%.9g, %.9g\n", curr_bone.frameList[fi].numFrame, curr_bone.frameList[fi].orientation.w);
+
+			fprintf(f, "x :\n");
+			for (int fi = 0; fi < curr_bone.frameList.size(); fi++)
+				fprintf(f, "%.9g, %.9g\n", curr_bone.frameList[fi].numFrame, curr_bone.frameList[fi].orientation.x);
+
+			fprintf(f, "y :\n");
+			for (int fi = 0; fi < curr_bone.frameList.size(); fi++)
+				fprintf(f, "%.9g, %.9g\n", curr_bone.frameList[fi].numFrame, -curr_bone.frameList[fi].orientation.z);
+
+			fprintf(f, "z :\n");
+			for (int fi = 0; fi < curr_bone.frameList.size(); fi++)
+				fprintf(f, "%.9g, %.9g\n", curr_bone.frameList[fi].numFrame, curr_bone.frameList[fi].orientation.y);
+		}
+
+		fprintf(f, "\n");
+	}
+
+	fclose(f);
+}
+
+//The reduction is the Ramer-Douglas-Peucker algorithm applied to the orientation curve of every bone:
+//we keep the first and the last key, find the key which is the worst reconstructed by the SLERP between them,
+//and if its error exceeds the tolerance we keep it and repeat the same for both halves.
+//
+//A rotation error of a bone moves everything below it in the hierarchy - the tip of a descendant at the
+//distance d from the bone's head gets displaced by (at most) error * d. The errors of all the bones on the way
+//from the root to an end effector add up, so the positional budget is split evenly over the longest chain
+//passing through the bone. The distances are taken from the rest pose, which is fine since the animation
+//only rotates the bones and thus never changes them.
+int Armature::ReduceKeyframes(float angularTolerance, float positionalTolerance)
+{
+	this->poseEvaluated = false;
+
+	if (angularTolerance <= 0.0f && positionalTolerance <= 0.0f)
+		return 0;
+
+	//the greatest distance from the bone's head to the tip of the bone itself or any of its descendants
+	std::vector<float> reach(this->numBones, 0.0f);
+	//number of bones from the bone to the root (including both)
+	std::vector<int> depth(this->numBones, 0);
+	//number of bones on the longest chain below the bone
+	std::vector<int> chainBelow(this->numBones, 0);
+
+	for (int bi = 0; bi < this->numBones; bi++)
+	{
+		Bone& curr_bone = this->boneList[bi];
+
+		//bones point along their local y axis
+		float tip[3];
+		float bone_axis[] = { 0.0f, curr_bone.size, 0.0f };
+		Rotate(&curr_bone.qLocal, bone_axis, tip);
+		AddVectors(tip, curr_bone.posLocal, tip, 3);
+
+		int level = 0;
+		for (Bone* ancestor = &curr_bone; ancestor != NULL; ancestor = ancestor->parent)
+		{
+			float diff[3];
+			SubVectors(tip, ancestor->posLocal, diff, 3);
+			float dist = sqrt(DotVectors(diff, diff, 3));
+
+			if (dist > reach[ancestor->ID])
+				reach[ancestor->ID] = dist;
+			if (level > chainBelow[ancestor->ID])
+				chainBelow[ancestor->ID] = level;
+			level++;
+		}
+		depth[bi] = level;
+	}
+
+	int num_removed = 0;
+
+	for (int bi = 0; bi < this->numBones; bi++)
+	{
+		std::vector<FRAME>& frames = this->boneList[bi].frameList;
+		int num_frames = frames.size();
+
+		if (num_frames <= 2)
+			continue;
+
+		float tolerance = angularTolerance > 0.0f ? angularTolerance : FLT_MAX;
+		if (positionalTolerance > 0.0f && reach[bi] > 0.0f)
+		{
+			float chain_length = depth[bi] + chainBelow[bi];
+			tolerance = std::min(tolerance, positionalTolerance / (reach[bi] * chain_length));
+		}
+
+		std::vector<bool> keep(num_frames, false);
+		keep[0] = true;
+		keep[num_frames - 1] = true;
+
+		std::vector<std::pair<int, int>> segments;
+		segments.push_back(std::make_pair(0, num_frames - 1));
+
+		while (!segments.empty())
+		{
+			int first = segments.back().first;
+			int last = segments.back().second;
+			segments.pop_back();
+
+			float max_error = 0.0f;
+			int max_index = -1;
+			for (int fi = first + 1; fi < last; fi++)
+			{
+				//the same interpolation ComputeCurrBasis will use once the keys in between are gone
+				float t = (frames[fi].numFrame - frames[first].numFrame) / (frames[last].numFrame - frames[first].numFrame);
+				Quaternion q_interp = QuaternionSlerp(&frames[first].orientation, &frames[last].orientation, t);
+				q_interp.Normalize();
+
+				float error = QuaternionAngle(&q_interp, &frames[fi].orientation);
+				if (error > max_error)
+				{
+					max_error = error;
+					max_index = fi;
+				}
+			}
+
+			if (max_index != -1 && max_error > tolerance)
+			{
+				keep[max_index] = true;
+				segments.push_back(std::make_pair(first, max_index));
+				segments.push_back(std::make_pair(max_index, last));
+			}
+		}
+
+		int num_kept = 0;
+		for (int fi = 0; fi < num_frames; fi++)
+		{
+			if (keep[fi])
+			{
+				frames[num_kept] = frames[fi];
+				num_kept++;
+			}
+		}
+		frames.resize(num_kept);
+		num_removed += num_frames - num_kept;
+	}
+
+	return num_removed;
+}
+
+size_t Armature::ResampleClip(float samplesPerFrame)
+{
+	this->poseEvaluated = false;
+
+	this->sampleList.clear();
+	this->sampleRate = 0;
+	this->numSamples = 0;
+
+	if (samplesPerFrame <= 0.0f)
+		return 0;
+
+	//one more sample past the last frame (if the clip length is not a multiple of the sampling interval)
+	//so the interpolation never runs out of samples
+	this->sampleRate = samplesPerFrame;
+	this->numSamples = (int)ceil((this->lastFrame - this->firstFrame) * samplesPerFrame) + 1;
+	if (this->numSamples < 2)
+		this->numSamples = 2;
+
+	this->sampleList.resize(this->numBones * this->numSamples);
+
+	for (int bi = 0; bi < this->numBones; bi++)
+	{
+		Quaternion* samples = &this->sampleList[bi * this->numSamples];
+		for (int si = 0; si < this->numSamples; si++)
+		{
+			samples[si] = this->boneList[bi].InterpolateFrames(this->firstFrame + si / samplesPerFrame);
+		}
+	}
+
+	return this->sampleList.size() * sizeof(Quaternion);
+}
+
+void Armature::EvaluateCurrentPose()
+{
+	if (this->poseEvaluated && this->evaluatedFrame == this->currFrame)
+		return;
+
+	if (this->HasPoseCache())
+	{
+		//the final transforms of all bones interpolated from the precomputed ones
+		this->SamplePoseCache();
+	}
+	else
+	{
+		//computes the current basis - a detailed description in the method implementation
+		this->ComputeCurrBasis();
+
+		//computes the final transforms of all bones - a detailed description in the implementation of the method of the same name for the bone class
+		this->ComputeFinalOrientationPos();
+	}
+
+	this->poseEvaluated = true;
+	this->evaluatedFrame = this->currFrame;
+}
+
+void Armature::PrepareMesh(Object3D* objPtr)
+{
+	int num_entries = this->BeginMeshDeform(objPtr);
+	if (num_entries > 0)
+	{
+		this->MeshDeformRange(objPtr, 0, num_entries);
+		this->EndMeshDeform(objPtr);
+	}
+
+	this->PrepareNormals(objPtr);
+}
+
+void Armature::PrepareNormals(Object3D* objPtr)
+{
+	if (objPtr->pointCache == NULL)
+		objPtr->RecalculateNormals();
+}
+
+void Armature::PreparePose()
+{
+	this->EvaluateCurrentPose();
+	this->ComputeSkinTransforms();
+}
+
+void Armature::ComputeMeshBounds(Object3D* objPtr, float margin, float* boundsMin, float* boundsMax)
+{
+	this->EvaluateCurrentPose();
+
+	//the box of a pose is found once however many times it is asked for - by the culling and then by BeginSkinning
+	BoneBounds& pose_bounds = objPtr->poseBounds;
+	if (objPtr->poseBoundsVersion != this->poseVersion)
+	{
+		pose_bounds.empty = true;
+		for (int bi = 0; bi < objPtr->boneBounds.size(); bi++)
+		{
+			const BoneBounds& bounds = objPtr->boneBounds[bi];
+			if (bounds.empty)
+				continue;
+
+			const Bone& curr_bone = this->boneList[bi];
+
+			//the center is moved like a vertex, the extents by the absolute values of the rotation matrix
+			float center[3], extents[3], world_center[3], world_extents[3];
+			for (int ci = 0; ci < 3; ci++)
+			{
+				center[ci] = (bounds.min[ci] + bounds.max[ci]) * 0.5f;
+				extents[ci] = (bounds.max[ci] - bounds.min[ci]) * 0.5f;
+			}
+			Rotate(&curr_bone.qFinal, center, world_center);
+			AddVectors(world_center, curr_bone.posFinal, world_center, 3);
+
+			memset(world_extents, 0, sizeof(float) * 3);
+			for (int ai = 0; ai < 3; ai++)
+			{
+				float axis[3] = { 0.0f, 0.0f, 0.0f };
+				axis[ai] = 1.0f;
+				Rotate(&curr_bone.qFinal, axis, axis);
+				for (int ci = 0; ci < 3; ci++)
+				{
+					world_extents[ci] += fabs(axis[ci]) * extents[ai];
+				}
+			}
+
+			for (int ci = 0; ci < 3; ci++)
+			{
+				float lo = world_center[ci] - world_extents[ci];
+				float hi = world_center[ci] + world_extents[ci];
+				pose_bounds.min[ci] = pose_bounds.empty ? lo : std::min(pose_bounds.min[ci], lo);
+				pose_bounds.max[ci] = pose_bounds.empty ? hi : std::max(pose_bounds.max[ci], hi);
+			}
+			pose_bounds.empty = false;
+		}
+
+		//weights summing up to less than 1 pull the vertex towards the origin, which may be outside of the box
+		for (int ci = 0; ci < 3 && !pose_bounds.empty; ci++)
+		{
+			float reach = std::max(fabs(pose_bounds.min[ci]), fabs(pose_bounds.max[ci]));
+			pose_bounds.min[ci] -= reach * objPtr->weightDeficit;
+			pose_bounds.max[ci] += reach * objPtr->weightDeficit;
+		}
+		objPtr->poseBoundsVersion = this->poseVersion;
+	}
+
+	if (pose_bounds.empty)
+	{
+		memset(boundsMin, 0, sizeof(float) * 3);
+		memset(boundsMax, 0, sizeof(float) * 3);
+		return;
+	}
+
+	for (int ci = 0; ci < 3; ci++)
+	{
+		boundsMin[ci] = pose_bounds.min[ci] - margin;
+		boundsMax[ci] = pose_bounds.max[ci] + margin;
+	}
+}
+
+void Armature::Animate(float progress)
+{
+	this->currFrame += progress;
+	if (this->currFrame > this->lastFrame)
+	{
+		this->currFrame = this->firstFrame;
+	}
+}
+
+void Armature::AnimateSteps(int numSteps, float stepProgress, float alpha)
+{
+	for (int si = 0; si < numSteps; si++)
+	{
+		this->prevStepFrame = this->stepFrame;
+		this->stepFrame += stepProgress;
+		if (this->stepFrame > this->lastFrame)
+		{
+			this->stepFrame = this->firstFrame;
+		}
+	}
+
+	//nothing to interpolate from before the first step
+	if (this->prevStepFrame == this->stepFrame)
+	{
+		this->currFrame = this->stepFrame;
+		return;
+	}
+
+	//going from the second last step rather than back from the last one, the clip wraps around the same way as
+	//with Animate
+	this->currFrame = this->prevStepFrame;
+	this->Animate(stepProgress * alpha);
 }
 
 //This method computes the current value of the basis transformation.
@@ -872,25 +2241,28 @@ void Armature::Animate(float progress)
 //is the distance beetween the frame counter and the previous frame divided by the distance of these
 //two frames. The resulting interpolations (SLERP for orientation and LERP for position) constitute
 //the current basis transformation.
+//If the clip has been resampled (ResampleClip) the two samples are found directly from the current frame
+//and they are the same for all the bones.
 void Armature::ComputeCurrBasis()
 {
-	for (int bi = 0; bi < this->numBones; bi++)
+	if (this->numSamples > 0)
 	{
-		Bone& curr_bone = this->boneList[bi];
+		float sample = (this->currFrame - this->firstFrame) * this->sampleRate;
+		int si = std::min(std::max((int)floor(sample), 0), this->numSamples - 2);
+		float t = std::min(std::max(sample - si, 0.0f), 1.0f);
 
-		for (int fi = 0; fi < curr_bone.frameList.size(); fi++)
+		for (int bi = 0; bi < this->numBones; bi++)
 		{
-			if (this->currFrame < curr_bone.frameList[fi].numFrame)
-			{
-				float frame_full_dist = curr_bone.frameList[fi].numFrame - curr_bone.frameList[fi - 1].numFrame;
-				float frame_dist = this->currFrame - curr_bone.frameList[fi - 1].numFrame;
-				float t = frame_dist / frame_full_dist;
-				curr_bone.qBasisCurrent = QuaternionSlerp(&curr_bone.frameList[fi - 1].orientation, &curr_bone.frameList[fi].orientation, t);
-				break;
-
-			}
+			Quaternion* samples = &this->sampleList[bi * this->numSamples];
+			this->boneList[bi].qBasisCurrent = QuaternionSlerp(&samples[si], &samples[si + 1], t);
 		}
+		return;
+	}
 
+	for (int bi = 0; bi < this->numBones; bi++)
+	{
+		Bone& curr_bone = this->boneList[bi];
+		curr_bone.qBasisCurrent = curr_bone.InterpolateFrames(this->currFrame);
 	}
 
 }
@@ -902,30 +2274,198 @@ void Armature::ComputeFinalOrientationPos()
 	{
 		this->boneList[bi].ComputeFinalOrientationPos();
 	}
+	this->DetectChangedBones();
+
+}
+
+size_t Armature::BuildPoseCache(float samplesPerFrame)
+{
+	this->poseEvaluated = false;
+
+	this->poseCache.clear();
+	this->poseCacheRate = 0;
+	this->numPoseSamples = 0;
+
+	if (samplesPerFrame <= 0.0f)
+		return 0;
+
+	int num_samples = (int)ceil((this->lastFrame - this->firstFrame) * samplesPerFrame) + 1;
+	if (num_samples < 2)
+		num_samples = 2;
+
+	this->poseCache.resize(this->numBones * num_samples);
+
+	for (int si = 0; si < num_samples; si++)
+	{
+		this->EvaluatePose(this->firstFrame + si / samplesPerFrame, &this->poseCache[si * this->numBones]);
+	}
 
+	this->poseCacheRate = samplesPerFrame;
+	this->numPoseSamples = num_samples;
+
+	return this->poseCache.size() * sizeof(TransformPair);
 }
 
+//The same computations as ComputeCurrBasis and Bone::ComputeFinalOrientationPos, but the results go to the pose buffer
+//and not to the bones. Going through the bones parents first lets every bone use the already computed final
+//transformation of its parent instead of recomputing the whole chain up to the root.
+void Armature::EvaluatePose(float frame, TransformPair* poseBuffer) const
+{
+	frame = std::min(std::max(frame, this->firstFrame), this->lastFrame);
+
+	int si = 0;
+	float t = 0.0f;
+	if (this->numSamples > 0)
+	{
+		float sample = (frame - this->firstFrame) * this->sampleRate;
+		si = std::min(std::max((int)floor(sample), 0), this->numSamples - 2);
+		t = std::min(std::max(sample - si, 0.0f), 1.0f);
+	}
+
+	for (int oi = 0; oi < this->evalOrder.size(); oi++)
+	{
+		int bi = this->evalOrder[oi];
+		const Bone& curr_bone = this->boneList[bi];
+
+		Quaternion q_basis;
+		if (this->numSamples > 0)
+		{
+			const Quaternion* samples = &this->sampleList[bi * this->numSamples];
+			q_basis = QuaternionSlerp(&samples[si], &samples[si + 1], t);
+		}
+		else
+		{
+			q_basis = curr_bone.InterpolateFrames(frame);
+		}
+
+		Quaternion q_temp = HamiltonProd(curr_bone.qLocal, q_basis);
+		float pos_temp[3];
+		Rotate(&curr_bone.qLocal, curr_bone.posBasis, pos_temp);
+		AddVectors(pos_temp, curr_bone.posLocal, pos_temp, 3);
+
+		TransformPair& result = poseBuffer[bi];
+
+		if (curr_bone.parentIndex == -1)
+		{
+			result.orient = q_temp;
+			memcpy(result.pos, pos_temp, sizeof(float) * 3);
+		}
+		else
+		{
+			const Bone& parent = this->boneList[curr_bone.parentIndex];
+			const TransformPair& parent_final_transform = poseBuffer[curr_bone.parentIndex];
+
+			Quaternion parent_inverse_orient = parent.qLocal.Reciprocal();
 
-void Armature::Draw(ID3D11DeviceContext* devConPtr)
+			q_temp = HamiltonProd(parent_inverse_orient, q_temp);
+			result.orient = HamiltonProd(parent_final_transform.orient, q_temp);
+
+			SubVectors(pos_temp, parent.posLocal, pos_temp, 3);
+			Rotate(&parent_inverse_orient, pos_temp, pos_temp);
+			Rotate(&parent_final_transform.orient, pos_temp, pos_temp);
+			AddVectors(pos_temp, parent_final_transform.pos, result.pos, 3);
+		}
+	}
+}
+
+void Armature::ApplyPose(const TransformPair* poseBuffer)
+{
+	this->poseEvaluated = false;
+
+	for (int bi = 0; bi < this->numBones; bi++)
+	{
+		this->boneList[bi].qFinal = poseBuffer[bi].orient;
+		memcpy(this->boneList[bi].posFinal, poseBuffer[bi].pos, sizeof(float) * 3);
+	}
+	this->DetectChangedBones();
+}
+
+//The cached poses are close enough for a normalized LERP (NLERP) of the orientations to be
+//indistinguishable from a SLERP - and it's much cheaper.
+void Armature::SamplePoseCache()
+{
+	float sample = (this->currFrame - this->firstFrame) * this->poseCacheRate;
+	int si = std::min(std::max((int)floor(sample), 0), this->numPoseSamples - 2);
+	float t = std::min(std::max(sample - si, 0.0f), 1.0f);
+
+	TransformPair* pose_a = &this->poseCache[si * this->numBones];
+	TransformPair* pose_b = &this->poseCache[(si + 1) * this->numBones];
+
+	for (int bi = 0; bi < this->numBones; bi++)
+	{
+		Bone& curr_bone = this->boneList[bi];
+		Quaternion& q_a = pose_a[bi].orient;
+		Quaternion& q_b = pose_b[bi].orient;
+
+		//q and -q are the same rotation - take the shorter way
+		float t_b = QuaternionDot(&q_a, &q_b) < 0.0f ? -t : t;
+
+		curr_bone.qFinal.w = q_a.w * (1.0f - t) + q_b.w * t_b;
+		curr_bone.qFinal.x = q_a.x * (1.0f - t) + q_b.x * t_b;
+		curr_bone.qFinal.y = q_a.y * (1.0f - t) + q_b.y * t_b;
+		curr_bone.qFinal.z = q_a.z * (1.0f - t) + q_b.z * t_b;
+		curr_bone.qFinal.Normalize();
+
+		for (int ci = 0; ci < 3; ci++)
+		{
+			curr_bone.posFinal[ci] = pose_a[bi].pos[ci] * (1.0f - t) + pose_b[bi].pos[ci] * t;
+		}
+	}
+	this->DetectChangedBones();
+}
+
+void Armature::Draw(RenderBackend* backendPtr, DynamicVertexRing* ringPtr)
 {
 	for (int bi = 0; bi < this->numBones; bi++)
 	{
 		this->boneList[bi].object3d.RotateAndTranslate(&this->boneList[bi].qLocal, this->boneList[bi].posLocal);
-		this->boneList[bi].object3d.DrawObject(devConPtr);
+		this->boneList[bi].gizmoVersion = 0;
+		this->boneList[bi].object3d.DrawObject(backendPtr, ringPtr);
 
 	}
 }
 
-void Armature::DrawFinal(ID3D11DeviceContext* devConPtr)
+void Armature::DrawFinal(RenderBackend* backendPtr, DynamicVertexRing* ringPtr)
 {
+	this->EvaluateCurrentPose();
+
 	for (int bi = 0; bi < this->numBones; bi++)
 	{
-		this->boneList[bi].object3d.RotateAndTranslate(&this->boneList[bi].qFinal, this->boneList[bi].posFinal);
-		this->boneList[bi].object3d.DrawObject(devConPtr);
+		Bone& curr_bone = this->boneList[bi];
+		if (curr_bone.gizmoVersion == 0 || curr_bone.changedVersion > curr_bone.gizmoVersion)
+		{
+			curr_bone.object3d.RotateAndTranslate(&curr_bone.qFinal, curr_bone.posFinal);
+			curr_bone.gizmoVersion = this->poseVersion;
+		}
+		curr_bone.object3d.DrawObject(backendPtr, ringPtr);
 
 	}
 }
 
+void Armature::StageFinal(int slot)
+{
+	this->EvaluateCurrentPose();
+
+	for (int bi = 0; bi < this->numBones; bi++)
+	{
+		Bone& curr_bone = this->boneList[bi];
+		if (curr_bone.gizmoVersion == 0 || curr_bone.changedVersion > curr_bone.gizmoVersion)
+		{
+			curr_bone.object3d.RotateAndTranslate(&curr_bone.qFinal, curr_bone.posFinal);
+			curr_bone.gizmoVersion = this->poseVersion;
+		}
+		curr_bone.object3d.StageVertices(slot, true);
+	}
+}
+
+void Armature::DrawStaged(RenderBackend* backendPtr, DynamicVertexRing* ringPtr, int slot)
+{
+	for (int bi = 0; bi < this->numBones; bi++)
+	{
+		this->boneList[bi].object3d.DrawStaged(backendPtr, ringPtr, slot);
+	}
+}
+
 
 void Armature::AssignBoneIndicesToVertexGroups(Object3D* objPtr)
 {
@@ -946,6 +2486,406 @@ void Armature::AssignBoneIndicesToVertexGroups(Object3D* objPtr)
 		}
 	}
 
+	//The dominant bone of every vertex, then the rest of its bones - vertices with the same bones end up next to each other.
+	//The order within those runs stays the one of the file, which follows the surface.
+	//(the groups are sorted by their indices, not copied - a copy of every group and its bone name would cost
+	//a few allocations per vertex)
+	std::vector<std::vector<int>> sort_keys(objPtr->vSkinnedList.size());
+	for (int vi = 0; vi < objPtr->vSkinnedList.size(); vi++)
+	{
+		const std::vector<VertexGroup>& v_groups = objPtr->vSkinnedList[vi].vGroups;
+		std::vector<int>& key = sort_keys[vi];
+		key.resize(v_groups.size());
+		for (int gi = 0; gi < v_groups.size(); gi++)
+		{
+			key[gi] = gi;
+		}
+		std::stable_sort(key.begin(), key.end(), [&](int a, int b) { return v_groups[a].weight > v_groups[b].weight; });
+		for (int gi = 0; gi < v_groups.size(); gi++)
+		{
+			key[gi] = v_groups[key[gi]].boneIndex;
+		}
+		std::sort(key.begin() + std::min((int)key.size(), 1), key.end());
+	}
+
+	std::vector<int> order(objPtr->vSkinnedList.size());
+	for (int vi = 0; vi < order.size(); vi++)
+	{
+		order[vi] = vi;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return sort_keys[a] < sort_keys[b]; });
+
+#ifdef EDIT_STUFF
+	//how many different bones the vertices of every run of 64 use on average, before and after
+	auto bones_per_block = [&](const std::vector<int>& vertex_order)
+	{
+		std::vector<char> seen(this->boneList.size());
+		int num_blocks = 0, num_bones = 0;
+		for (int first = 0; first < vertex_order.size(); first += 64)
+		{
+			memset(seen.data(), 0, seen.size());
+			for (int oi = first; oi < std::min(first + 64, (int)vertex_order.size()); oi++)
+			{
+				const std::vector<int>& key = sort_keys[vertex_order[oi]];
+				for (int ki = 0; ki < key.size(); ki++)
+				{
+					num_bones += !seen[key[ki]];
+					seen[key[ki]] = 1;
+				}
+			}
+			num_blocks++;
+		}
+		return num_blocks > 0 ? (float)num_bones / num_blocks : 0.0f;
+	};
+	std::vector<int> file_order(order.size());
+	for (int vi = 0; vi < file_order.size(); vi++)
+	{
+		file_order[vi] = vi;
+	}
+	printf("bones per 64 vertices: %.2f in the file order, %.2f sorted by bone\n", bones_per_block(file_order), bones_per_block(order));
+#endif
+
+	objPtr->ReorderPositions(order);
+
+	objPtr->boneVertices.assign(this->boneList.size(), std::vector<int>());
+	for (int vi = 0; vi < objPtr->vSkinnedList.size(); vi++)
+	{
+		VertexSkinned& curr_vert = objPtr->vSkinnedList[vi];
+		for (int gi = 0; gi < curr_vert.vGroups.size(); gi++)
+		{
+			objPtr->boneVertices[curr_vert.vGroups[gi].boneIndex].push_back(vi);
+		}
+	}
+	objPtr->skinStamps.assign(objPtr->vSkinnedList.size(), 0);
+	objPtr->skinnedPoseVersion = 0;
+
+	//the rest positions in the spaces of all the bones influencing them
+	objPtr->boneBounds.assign(this->boneList.size(), BoneBounds());
+	objPtr->weightDeficit = 0.0f;
+	objPtr->unweightedVertices = false;
+	objPtr->poseBoundsVersion = 0;
+	for (int vi = 0; vi < objPtr->vSkinnedList.size(); vi++)
+	{
+		VertexSkinned& curr_vert = objPtr->vSkinnedList[vi];
+		float weight_sum = 0.0f;
+		for (int gi = 0; gi < curr_vert.vGroups.size(); gi++)
+		{
+			int bi = curr_vert.vGroups[gi].boneIndex;
+			weight_sum += curr_vert.vGroups[gi].weight;
+
+			float v_bone[3];
+			SubVectors(curr_vert.posLocal, this->boneList[bi].posLocal, v_bone, 3);
+			Quaternion q_local_recip = this->boneList[bi].qLocal.Reciprocal();
+			Rotate(&q_local_recip, v_bone, v_bone);
+
+			BoneBounds& bounds = objPtr->boneBounds[bi];
+			for (int ci = 0; ci < 3; ci++)
+			{
+				bounds.min[ci] = bounds.empty ? v_bone[ci] : std::min(bounds.min[ci], v_bone[ci]);
+				bounds.max[ci] = bounds.empty ? v_bone[ci] : std::max(bounds.max[ci], v_bone[ci]);
+			}
+			bounds.empty = false;
+		}
+		if (!curr_vert.vGroups.empty())
+			objPtr->weightDeficit = std::max(objPtr->weightDeficit, 1.0f - weight_sum);
+		else
+			objPtr->unweightedVertices = true;
+	}
+
+	//the buckets keep the order of the vertices, so the writes to vTrans stay as close together as they were
+	SkinStream& stream = objPtr->skinStream;
+	stream.vertices.clear();
+	stream.positions.clear();
+	stream.boneIndices.clear();
+	stream.weights.clear();
+	for (int bi = 0; bi < SKIN_BUCKETS; bi++)
+	{
+		stream.bucketStart[bi] = stream.vertices.size();
+		stream.influenceStart[bi] = stream.boneIndices.size();
+		for (int vi = 0; vi < objPtr->vSkinnedList.size(); vi++)
+		{
+			VertexSkinned& curr_vert = objPtr->vSkinnedList[vi];
+			int num_groups = curr_vert.vGroups.size();
+			bool last_bucket = bi == SKIN_BUCKETS - 1;
+			if (last_bucket ? (num_groups > 0 && num_groups < SKIN_BUCKETS) : num_groups != bi + 1)
+				continue;
+
+			stream.vertices.push_back(vi);
+			stream.positions.insert(stream.positions.end(), curr_vert.posLocal, curr_vert.posLocal + 3);
+			if (last_bucket)
+				continue;
+			for (int gi = 0; gi < num_groups; gi++)
+			{
+				stream.boneIndices.push_back(curr_vert.vGroups[gi].boneIndex);
+				stream.weights.push_back(curr_vert.vGroups[gi].weight);
+			}
+		}
+	}
+	stream.bucketStart[SKIN_BUCKETS] = stream.vertices.size();
+
+#ifdef EDIT_STUFF
+	printf("skinning buckets:");
+	for (int bi = 0; bi < SKIN_BUCKETS; bi++)
+	{
+		printf(" %d", stream.bucketStart[bi + 1] - stream.bucketStart[bi]);
+	}
+	printf("\n");
+#endif
+
+}
+
+//Every vertex blends the dual quaternions of its bones by weight - flipped to the same hemisphere as the first one,
+//since q and -q are the same rotation but would cancel each other out - and is then transformed by the normalized sum.
+static void SkinVertexDualQuaternion(const std::vector<VertexGroup>& vGroups, const float* posLocal, const DualQuaternion* boneTransforms, float* vDst)
+{
+	DualQuaternion blend;
+	memset(&blend, 0, sizeof(DualQuaternion));
+
+	const Quaternion* pivot = &boneTransforms[vGroups[0].boneIndex].real;
+	for (int gi = 0; gi < vGroups.size(); gi++)
+	{
+		const DualQuaternion& dq = boneTransforms[vGroups[gi].boneIndex];
+		float weight = vGroups[gi].weight;
+		if (QuaternionDot(pivot, &dq.real) < 0.0f)
+			weight = -weight;
+
+		blend.real.w += dq.real.w * weight;
+		blend.real.x += dq.real.x * weight;
+		blend.real.y += dq.real.y * weight;
+		blend.real.z += dq.real.z * weight;
+		blend.dual.w += dq.dual.w * weight;
+		blend.dual.x += dq.dual.x * weight;
+		blend.dual.y += dq.dual.y * weight;
+		blend.dual.z += dq.dual.z * weight;
+	}
+
+	float norm = blend.real.Norm();
+	float inv_norm = norm > 0.0f ? 1.0f / norm : 0.0f;
+	blend.real.w *= inv_norm;
+	blend.real.x *= inv_norm;
+	blend.real.y *= inv_norm;
+	blend.real.z *= inv_norm;
+	blend.dual.w *= inv_norm;
+	blend.dual.x *= inv_norm;
+	blend.dual.y *= inv_norm;
+	blend.dual.z *= inv_norm;
+
+	TransformByDualQuaternion(&blend, posLocal, vDst);
+}
+
+static inline void TransformByMatrix(const float* matrix, const float* vSrc, float* vDst)
+{
+	for (int ri = 0; ri < 3; ri++)
+	{
+		vDst[ri] = matrix[ri * 4 + 0] * vSrc[0] + matrix[ri * 4 + 1] * vSrc[1] + matrix[ri * 4 + 2] * vSrc[2] + matrix[ri * 4 + 3];
+	}
+}
+
+//The weighted sum of the vertex transformed by every bone is the vertex transformed by the weighted sum of their
+//skinning matrices - one transformation instead of one for every bone.
+static void SkinVertexLinear(const std::vector<VertexGroup>& vGroups, const float* posLocal, const float* boneMatrices, float* vDst)
+{
+	float blend[12];
+	memset(blend, 0, sizeof(float) * 12);
+	for (int gi = 0; gi < vGroups.size(); gi++)
+	{
+		const float* matrix = &boneMatrices[vGroups[gi].boneIndex * 12];
+		float weight = vGroups[gi].weight;
+		for (int mi = 0; mi < 12; mi++)
+		{
+			blend[mi] += matrix[mi] * weight;
+		}
+	}
+	TransformByMatrix(blend, posLocal, vDst);
+}
+
+//Where the skinned positions of SkinBuckets go - to the vertices of the mesh (and from them to vTrans)
+//or to an array of 3 floats for every vertex of vSkinnedList.
+struct SkinToMesh
+{
+	VertexSkinned* vertices;
+
+	void Write(int vi, const float* pos) const
+	{
+		memcpy(this->vertices[vi].posTrans, pos, sizeof(float) * 3);
+		this->vertices[vi].SetVertices();
+	}
+};
+
+struct SkinToArray
+{
+	float* positions;
+
+	void Write(int vi, const float* pos) const
+	{
+		memcpy(&this->positions[vi * 3], pos, sizeof(float) * 3);
+	}
+};
+
+//The linear blend skinning of the bucket of the vertices with NumInfluences bones each. The number of bones is known
+//at compile time, so the loops over them are unrolled and nothing branches on it inside of the loop over the vertices.
+//The vertices bound to a single bone just follow it - a plain rigid transformation, still scaled by the weight
+//(a weight short of 1 pulls the vertex towards the origin).
+template <int NumInfluences, class Layout>
+static void SkinBucketLinear(const SkinStream& stream, int begin, int end, const float* boneMatrices, Layout output)
+{
+	const int bucket = NumInfluences - 1;
+	int first = std::max(begin, stream.bucketStart[bucket]);
+	int last = std::min(end, stream.bucketStart[bucket + 1]);
+	if (first >= last)
+		return;
+
+	const float* positions = stream.positions.data() + first * 3;
+	const int* bone_indices = stream.boneIndices.data() + stream.influenceStart[bucket] + (first - stream.bucketStart[bucket]) * NumInfluences;
+	const float* weights = stream.weights.data() + stream.influenceStart[bucket] + (first - stream.bucketStart[bucket]) * NumInfluences;
+	for (int si = first; si < last; si++)
+	{
+		float pos[3];
+		if (NumInfluences == 1)
+		{
+			TransformByMatrix(&boneMatrices[bone_indices[0] * 12], positions, pos);
+			ScaleVector(pos, weights[0], 3);
+		}
+		else
+		{
+			float blend[12];
+			const float* matrix = &boneMatrices[bone_indices[0] * 12];
+			for (int mi = 0; mi < 12; mi++)
+			{
+				blend[mi] = matrix[mi] * weights[0];
+			}
+			for (int ii = 1; ii < NumInfluences; ii++)
+			{
+				matrix = &boneMatrices[bone_indices[ii] * 12];
+				for (int mi = 0; mi < 12; mi++)
+				{
+					blend[mi] += matrix[mi] * weights[ii];
+				}
+			}
+			TransformByMatrix(blend, positions, pos);
+		}
+		output.Write(stream.vertices[si], pos);
+
+		positions += 3;
+		bone_indices += NumInfluences;
+		weights += NumInfluences;
+	}
+}
+
+//The same for the dual quaternion skinning (see SkinVertexDualQuaternion). A single bone needs no blending
+//and no normalization, its matrix is used as it is.
+template <int NumInfluences, class Layout>
+static void SkinBucketDualQuaternion(const SkinStream& stream, int begin, int end, const float* boneMatrices, const DualQuaternion* boneTransforms,
+	Layout output)
+{
+	const int bucket = NumInfluences - 1;
+	int first = std::max(begin, stream.bucketStart[bucket]);
+	int last = std::min(end, stream.bucketStart[bucket + 1]);
+	if (first >= last)
+		return;
+
+	const float* positions = stream.positions.data() + first * 3;
+	const int* bone_indices = stream.boneIndices.data() + stream.influenceStart[bucket] + (first - stream.bucketStart[bucket]) * NumInfluences;
+	const float* weights = stream.weights.data() + stream.influenceStart[bucket] + (first - stream.bucketStart[bucket]) * NumInfluences;
+	for (int si = first; si < last; si++)
+	{
+		float pos[3];
+		if (NumInfluences == 1)
+		{
+			TransformByMatrix(&boneMatrices[bone_indices[0] * 12], positions, pos);
+		}
+		else
+		{
+			const DualQuaternion& pivot = boneTransforms[bone_indices[0]];
+			float blend[8] = { pivot.real.w * weights[0], pivot.real.x * weights[0], pivot.real.y * weights[0], pivot.real.z * weights[0],
+				pivot.dual.w * weights[0], pivot.dual.x * weights[0], pivot.dual.y * weights[0], pivot.dual.z * weights[0] };
+			for (int ii = 1; ii < NumInfluences; ii++)
+			{
+				const DualQuaternion& dq = boneTransforms[bone_indices[ii]];
+				float weight = QuaternionDot(&pivot.real, &dq.real) < 0.0f ? -weights[ii] : weights[ii];
+				blend[0] += dq.real.w * weight;
+				blend[1] += dq.real.x * weight;
+				blend[2] += dq.real.y * weight;
+				blend[3] += dq.real.z * weight;
+				blend[4] += dq.dual.w * weight;
+				blend[5] += dq.dual.x * weight;
+				blend[6] += dq.dual.y * weight;
+				blend[7] += dq.dual.z * weight;
+			}
+
+			float norm = sqrt(blend[0] * blend[0] + blend[1] * blend[1] + blend[2] * blend[2] + blend[3] * blend[3]);
+			float inv_norm = norm > 0.0f ? 1.0f / norm : 0.0f;
+			DualQuaternion blended;
+			blended.real.Init(blend[0] * inv_norm, blend[1] * inv_norm, blend[2] * inv_norm, blend[3] * inv_norm);
+			blended.dual.Init(blend[4] * inv_norm, blend[5] * inv_norm, blend[6] * inv_norm, blend[7] * inv_norm);
+			TransformByDualQuaternion(&blended, positions, pos);
+		}
+		output.Write(stream.vertices[si], pos);
+
+		positions += 3;
+		bone_indices += NumInfluences;
+		weights += NumInfluences;
+	}
+}
+
+//Skins the vertices begin to end - 1 of the stream - every bucket by the kernel made for it, once per bucket, and
+//the vertices of the last one (many bones or none) one by one.
+template <class Layout>
+static void SkinBuckets(const SkinStream& stream, const std::vector<VertexSkinned>& vSkinnedList, SkinningMode mode, int begin, int end,
+	const float* boneMatrices, const DualQuaternion* boneTransforms, Layout output)
+{
+	if (mode == SKINNING_DUAL_QUATERNION)
+	{
+		SkinBucketDualQuaternion<1>(stream, begin, end, boneMatrices, boneTransforms, output);
+		SkinBucketDualQuaternion<2>(stream, begin, end, boneMatrices, boneTransforms, output);
+		SkinBucketDualQuaternion<3>(stream, begin, end, boneMatrices, boneTransforms, output);
+	}
+	else
+	{
+		SkinBucketLinear<1>(stream, begin, end, boneMatrices, output);
+		SkinBucketLinear<2>(stream, begin, end, boneMatrices, output);
+		SkinBucketLinear<3>(stream, begin, end, boneMatrices, output);
+	}
+
+	int last_first = std::max(begin, stream.bucketStart[SKIN_BUCKETS - 1]);
+	int last_end = std::min(end, stream.bucketStart[SKIN_BUCKETS]);
+	for (int si = last_first; si < last_end; si++)
+	{
+		int vi = stream.vertices[si];
+		const VertexSkinned& curr_ver = vSkinnedList[vi];
+
+		float pos[3];
+		if (mode == SKINNING_DUAL_QUATERNION && !curr_ver.vGroups.empty())
+			SkinVertexDualQuaternion(curr_ver.vGroups, curr_ver.posLocal, boneTransforms, pos);
+		else
+			SkinVertexLinear(curr_ver.vGroups, curr_ver.posLocal, boneMatrices, pos);
+		output.Write(vi, pos);
+	}
+}
+
+void Armature::ComputeSkinTransforms()
+{
+	if (this->skinTransformsVersion == this->poseVersion && this->skinTransformsMode == this->skinningMode &&
+		this->skinMatrices.size() == this->boneList.size() * 12)
+		return;
+
+	this->skinMatrices.resize(this->boneList.size() * 12);
+	if (this->skinningMode == SKINNING_DUAL_QUATERNION)
+		this->skinTransforms.resize(this->boneList.size());
+
+	for (int bi = 0; bi < this->boneList.size(); bi++)
+	{
+		TransformPair final_transform;
+		final_transform.orient = this->boneList[bi].qFinal;
+		memcpy(final_transform.pos, this->boneList[bi].posFinal, sizeof(float) * 3);
+
+		this->boneList[bi].SkinningMatrix(&final_transform, &this->skinMatrices[bi * 12]);
+		if (this->skinningMode == SKINNING_DUAL_QUATERNION)
+			this->skinTransforms[bi] = this->boneList[bi].SkinningDualQuaternion(&final_transform);
+	}
+
+	this->skinTransformsVersion = this->poseVersion;
+	this->skinTransformsMode = this->skinningMode;
 }
 
 //The algorith is as follows:
@@ -955,25 +2895,201 @@ void Armature::AssignBoneIndicesToVertexGroups(Object3D* objPtr)
 //for that vertex.
 void Armature::MeshDeform(Object3D* objPtr)
 {
-	for (int vi = 0; vi < objPtr->vSkinnedList.size(); vi++)
+	int num_entries = this->BeginSkinning(objPtr, 0);
+	if (num_entries > 0)
 	{
-		VertexSkinned& curr_ver = objPtr->vSkinnedList[vi];
+		this->SkinRange(objPtr, 0, 0, num_entries);
+		this->EndSkinning(objPtr, 0);
+	}
+}
+
+void Armature::MeshDeformLOD(Object3D* objPtr, int lod)
+{
+	int num_entries = this->BeginSkinning(objPtr, lod);
+	if (num_entries > 0)
+	{
+		this->SkinRange(objPtr, lod, 0, num_entries);
+		this->EndSkinning(objPtr, lod);
+	}
+}
 
-		float v_result[3];
-		memset(v_result, 0, sizeof(float) * 3);
-		for (int gi = 0; gi < curr_ver.vGroups.size(); gi++)
+int Armature::BeginSkinning(Object3D* objPtr, int lod)
+{
+	this->ComputePackBounds(objPtr);
+
+	//a simplified level is skinned as a whole on every change
+	if (lod > 0)
+	{
+		if (objPtr->skinnedLOD == lod && objPtr->skinnedPoseVersion == this->poseVersion && objPtr->skinnedMode == this->skinningMode)
+			return 0;
+
+		this->ComputeSkinTransforms();
+		return (int)objPtr->lodList[lod - 1].vertices.size();
+	}
+
+	//everything gets skinned the first time, after a change of the skinning mode, after a simplified level
+	//or if the reverse index is missing
+	bool skin_all = objPtr->skinnedPoseVersion == 0 || objPtr->skinnedMode != this->skinningMode ||
+		objPtr->skinnedLOD != 0 || objPtr->boneVertices.size() != this->boneList.size();
+
+	//the pose has not been set since the last time
+	if (!skin_all && objPtr->skinnedPoseVersion == this->poseVersion)
+		return 0;
+
+	//once most of the mesh moves, going through it all at once is cheaper than vertex by vertex
+	if (!skin_all)
+	{
+		size_t num_influences = 0;
+		for (int bi = 0; bi < this->boneList.size(); bi++)
 		{
-			Bone& curr_bone = this->boneList[curr_ver.vGroups[gi].boneIndex];
-			float v_temp[3];
+			if (this->boneList[bi].changedVersion > objPtr->skinnedPoseVersion)
+				num_influences += objPtr->boneVertices[bi].size();
+		}
+		skin_all = num_influences > objPtr->vSkinnedList.size() / 2;
+	}
+
+	this->ComputeSkinTransforms();
 
-			curr_bone.TransformVertexByBone(curr_ver.posLocal, v_temp);
-			ScaleVector(v_temp, curr_ver.vGroups[gi].weight, 3);
-			AddVectors(v_result, v_temp, v_result, 3);
+	if (skin_all)
+		return (int)objPtr->skinStream.vertices.size();
 
+	//the vertices of the bones that moved since the last time, every vertex once even if more of its bones did
+	for (int bi = 0; bi < this->boneList.size(); bi++)
+	{
+		if (this->boneList[bi].changedVersion <= objPtr->skinnedPoseVersion)
+			continue;
+
+		const std::vector<int>& bone_vertices = objPtr->boneVertices[bi];
+		for (int bvi = 0; bvi < bone_vertices.size(); bvi++)
+		{
+			int vi = bone_vertices[bvi];
+			if (objPtr->skinStamps[vi] == this->poseVersion)
+				continue;
+			objPtr->skinStamps[vi] = this->poseVersion;
+
+			VertexSkinned& curr_ver = objPtr->vSkinnedList[vi];
+			if (this->skinningMode == SKINNING_DUAL_QUATERNION && !curr_ver.vGroups.empty())
+			{
+				SkinVertexDualQuaternion(curr_ver.vGroups, curr_ver.posLocal, this->skinTransforms.data(), curr_ver.posTrans);
+			}
+			else
+			{
+				SkinVertexLinear(curr_ver.vGroups, curr_ver.posLocal, this->skinMatrices.data(), curr_ver.posTrans);
+			}
+			curr_ver.SetVertices();
+			objPtr->MarkVertexDirty(vi);
+		}
+	}
+
+	objPtr->skinnedPoseVersion = this->poseVersion;
+	objPtr->skinnedMode = this->skinningMode;
+	objPtr->skinnedLOD = 0;
+	return 0;
+}
+
+void Armature::ComputePackBounds(Object3D* objPtr)
+{
+	BoneBounds& pack_bounds = objPtr->packBounds;
+	this->ComputeMeshBounds(objPtr, 0.0f, pack_bounds.min, pack_bounds.max);
+	pack_bounds.empty = objPtr->poseBounds.empty;
+	if (pack_bounds.empty)
+		return;
+
+	//The box holds the linear blend of the bones exactly, but a dual quaternion blend bulges out of it a little and the
+	//vertices of the bones that moved less than the change tolerance (see SetChangeTolerance) lag behind their bones -
+	//an eighth of the size more covers both, for a few bits of the 16 the positions are packed to.
+	for (int ci = 0; ci < 3; ci++)
+	{
+		float pad = (pack_bounds.max[ci] - pack_bounds.min[ci]) * 0.125f;
+		pack_bounds.min[ci] -= pad;
+		pack_bounds.max[ci] += pad;
+		if (objPtr->unweightedVertices)
+		{
+			pack_bounds.min[ci] = std::min(pack_bounds.min[ci], 0.0f);
+			pack_bounds.max[ci] = std::max(pack_bounds.max[ci], 0.0f);
+		}
+	}
+}
+
+void Armature::SkinRange(Object3D* objPtr, int lod, int begin, int end) const
+{
+	if (lod == 0)
+	{
+		//bucket by bucket, see SkinBuckets
+		SkinToMesh output = { objPtr->vSkinnedList.data() };
+		SkinBuckets(objPtr->skinStream, objPtr->vSkinnedList, this->skinningMode, begin, end, this->skinMatrices.data(), this->skinTransforms.data(), output);
+		return;
+	}
+
+	const MeshLOD& curr_lod = objPtr->lodList[lod - 1];
+	for (int lvi = begin; lvi < end; lvi++)
+	{
+		VertexSkinned& curr_ver = objPtr->vSkinnedList[curr_lod.vertices[lvi]];
+		const std::vector<VertexGroup>& v_groups = curr_lod.vGroups[lvi];
+
+		if (this->skinningMode == SKINNING_DUAL_QUATERNION && !v_groups.empty())
+		{
+			SkinVertexDualQuaternion(v_groups, curr_ver.posLocal, this->skinTransforms.data(), curr_ver.posTrans);
+		}
+		else
+		{
+			SkinVertexLinear(v_groups, curr_ver.posLocal, this->skinMatrices.data(), curr_ver.posTrans);
 		}
-		memcpy(curr_ver.posTrans, v_result, sizeof(float) * 3);
 		curr_ver.SetVertices();
 	}
+}
+
+void Armature::EndSkinning(Object3D* objPtr, int lod)
+{
+	objPtr->MarkAllDirty();
+
+	objPtr->skinnedPoseVersion = this->poseVersion;
+	objPtr->skinnedMode = this->skinningMode;
+	objPtr->skinnedLOD = lod;
+}
+
+int Armature::BeginMeshDeform(Object3D* objPtr)
+{
+	//a baked mesh needs no pose at all
+	if (objPtr->pointCache != NULL)
+	{
+		objPtr->PlayPointCache(this->currFrame);
+		return 0;
+	}
 
+	this->EvaluateCurrentPose();
+	return this->BeginSkinning(objPtr, objPtr->currentLOD);
+}
 
-}
\ No newline at end of file
+void Armature::MeshDeformRange(Object3D* objPtr, int begin, int end) const
+{
+	this->SkinRange(objPtr, objPtr->currentLOD, begin, end);
+}
+
+void Armature::EndMeshDeform(Object3D* objPtr)
+{
+	this->EndSkinning(objPtr, objPtr->currentLOD);
+}
+
+void Armature::ComputePoseSkinTransforms(const TransformPair* poseBuffer, PoseSkinTransforms* transforms) const
+{
+	//the same size for every pose, so only the first one allocates
+	transforms->matrices.resize(this->boneList.size() * 12);
+	if (this->skinningMode == SKINNING_DUAL_QUATERNION)
+		transforms->dualQuaternions.resize(this->boneList.size());
+
+	for (int bi = 0; bi < this->boneList.size(); bi++)
+	{
+		this->boneList[bi].SkinningMatrix(&poseBuffer[bi], &transforms->matrices[bi * 12]);
+		if (this->skinningMode == SKINNING_DUAL_QUATERNION)
+			transforms->dualQuaternions[bi] = this->boneList[bi].SkinningDualQuaternion(&poseBuffer[bi]);
+	}
+}
+
+void Armature::SkinVertices(const Object3D* objPtr, const PoseSkinTransforms& transforms, float* positions) const
+{
+	//the vertices with no bones at all end up at the origin, as they do in MeshDeform
+	SkinToArray output = { positions };
+	SkinBuckets(objPtr->skinStream, objPtr->vSkinnedList, this->skinningMode, 0, (int)objPtr->skinStream.vertices.size(),
+		transforms.matrices.data(), transforms.dualQuaternions.data(), output);
+}
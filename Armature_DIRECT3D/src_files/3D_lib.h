@@ -18,57 +18,71 @@
 #include <time.h>
 #include <iostream>
 #include <cstdio>
-#include <io.h>
-#include<fcntl.h>
-#include <dinput.h>
-#include <windows.h>
-#include <d3d11.h>
 #include <vector>
+#include <float.h>
+#include <math.h>
+#include <string.h>
 
-#include <d3dcompiler.h>
-#include <DirectXPackedVector.h>
-#include <DirectXMath.h>
-#include <dxgidebug.h>
+//Direct3D is reached through the rendering backend only, so the meshes can be loaded, animated and drawn without it
+#include "render_backend.h"
+#include "frame_pipeline.h"
 
 
-#include "../DirectXTK/WICTextureLoader.h"
-#include "../DirectXTK/DDSTextureLoader.h"
-#include "d3d_wrappers.h"
+//vectors of floats laid out like the ones of DirectXMath
+struct Float2
+{
+	Float2() = default;
+	Float2(float x, float y) : x(x), y(y) {}
 
+	float x, y;
+};
 
-using namespace DirectX;
+struct Float3
+{
+	Float3() = default;
+	Float3(float x, float y, float z) : x(x), y(y), z(z) {}
+
+	float x, y, z;
+};
+//The part of a vertex that changes when the mesh is deformed and is uploaded every frame - the UVs never change
+//and are kept in a stream of their own (see Object3D::texCoords).
 struct Vertex
 {
 	Vertex() {};
-	Vertex(float x, float y, float z, float u, float v, float nx, float ny, float nz) : pos(x, y, z), texCoord(u, v), normal(nx, ny, nz) {}
+	Vertex(float x, float y, float z, float nx, float ny, float nz) : pos(x, y, z), normal(nx, ny, nz) {}
 
 
-	XMFLOAT3 pos;
-	XMFLOAT2 texCoord;
-	XMFLOAT3 normal;
+	Float3 pos;
+	Float3 normal;
 };
 
-void NormalizeVector(float* vSrc, float* vDst, int len);
+void NormalizeVector(const float* vSrc, float* vDst, int len);
 
-void AddVectors(float* v1, float* v2, float* result, int len);
+void AddVectors(const float* v1, const float* v2, float* result, int len);
 
-void SubVectors(float* v1, float* v2, float* result, int len);
+void SubVectors(const float* v1, const float* v2, float* result, int len);
 
-float DotVectors(float* u, float* v, int len);
+float DotVectors(const float* u, const float* v, int len);
 
-void CrossVectors(float* u, float* v, float* result);
+void CrossVectors(const float* u, const float* v, float* result);
 
 void ScaleVector(float* v, float scale, int len);
 
+//Octahedral encoding of a unit vector into two signed 16 bit values (and back). The unit sphere is projected onto
+//an octahedron and the octahedron unfolded onto a square - the error stays below 0.01 degree.
+void OctahedralEncode(const float* n, short* result);
+
+void OctahedralDecode(const short* e, float* result);
+
 
 struct Quaternion
 {
 	void Init(float w, float x, float y, float z);
 	void InitAxisAngle(float* axis, float angle);
-	Quaternion Conjugation();
-	float Norm();
+	Quaternion Conjugation() const;
+	float Norm() const;
 	void Normalize();
-	Quaternion Reciprocal();
+	Quaternion Reciprocal() const;
 	
 
 	float w;
@@ -77,13 +91,39 @@ struct Quaternion
 	float z;
 };
 
-Quaternion HamiltonProd(Quaternion& q1, Quaternion& q2);
+Quaternion HamiltonProd(const Quaternion& q1, const Quaternion& q2);
+
+void Rotate(const Quaternion* q, const float* vSrc, float* vDst);
+
+float QuaternionDot(const Quaternion* q1, const Quaternion* q2);
+
+//the angle (in radians) of the rotation taking q1 to q2 - both are expected to be normalized
+float QuaternionAngle(const Quaternion* q1, const Quaternion* q2);
 
-void Rotate(Quaternion* q, float* vSrc, float* vDst);
+Quaternion QuaternionSlerp(const Quaternion* q1, const Quaternion* q2, float t);
 
-float QuaternionDot(Quaternion* q1, Quaternion* q2);
+//A rigid transformation - a rotation followed by a translation - written as a dual quaternion. The real part is
+//the rotation, the dual part is half of the translation (as a pure quaternion) times the rotation. A weighted sum
+//of dual quaternions, once normalized, is still a rigid transformation, which is what dual quaternion skinning uses.
+struct DualQuaternion
+{
+	Quaternion real;
+	Quaternion dual;
+};
+
+DualQuaternion DualQuaternionFromRotationTranslation(const Quaternion* q, const float* t);
 
-Quaternion QuaternionSlerp(Quaternion* q1, Quaternion* q2, float t);
+//transforms a point by a dual quaternion with a unit real part
+void TransformByDualQuaternion(const DualQuaternion* dq, const float* vSrc, float* vDst);
+
+//how the armature blends the transformations of all the bones influencing a vertex
+enum SkinningMode
+{
+	//the weighted sum of the vertex transformed by every bone - cheap, but twisted joints collapse into a "candy wrapper"
+	SKINNING_LINEAR,
+	//the weighted sum of the bone transformations as dual quaternions, applied to the vertex once - keeps the volume
+	SKINNING_DUAL_QUATERNION
+};
 
 
 struct VertexGroup
@@ -116,7 +156,7 @@ struct VertexSkinned
 
 	//in this list are listed all the bones that affect the vertex transformations and the influence they have via weights
 	std::vector<VertexGroup> vGroups;
-	std::vector<DirectX::XMFLOAT3*> vPointers;
+	std::vector<Float3*> vPointers;
 
 
 	void SetVertices();
@@ -125,6 +165,95 @@ struct VertexSkinned
 
 void LoadVertexGroups(std::vector <VertexSkinned>& vSkinnedList, const char* fname);
 
+class PointCachePlayer;
+
+//An axis aligned box in the space of a bone (see Bone::TransformVertexByBone) around the rest positions of all
+//the vertices of a mesh the bone influences. Transformed by the final transformation of the bone it encloses
+//those vertices as the bone moves them.
+struct BoneBounds
+{
+	bool empty = true;
+	float min[3];
+	float max[3];
+};
+
+//A simplified version of a mesh for drawing it from far away (see Object3D::BuildLODs). The triangles are drawn from
+//the vertex buffer of the full mesh through an index buffer of their own, so only the vertices they use need to be
+//skinned - with fewer bones each.
+struct MeshLOD
+{
+	//the corners of the full mesh making up the triangles, three for every triangle
+	std::vector<int> cornerList;
+	//the vertices of vSkinnedList the triangles use and the vertex groups they are skinned with
+	std::vector<int> vertices;
+	std::vector<std::vector<VertexGroup>> vGroups;
+	//the size of all of vGroups together
+	int numInfluences = 0;
+
+	RenderBuffer* indexBuffer = NULL;
+};
+
+//the vertices are skinned in buckets by the number of bones influencing them - 1, 2, 3 and the rest (4 or more, or none)
+#define SKIN_BUCKETS 4
+
+//The vertices of vSkinnedList regrouped by the number of their vertex groups (filled by Armature::AssignBoneIndicesToVertexGroups).
+//Bucket bi is vertices[bucketStart[bi]] to vertices[bucketStart[bi + 1] - 1], their rest positions follow in the same order
+//in positions (3 floats each) and - for all the buckets but the last one - their bi + 1 bone indices and weights in
+//boneIndices and weights, starting at influenceStart[bi]. MeshDeform goes through every bucket with a loop of its own,
+//straight through memory and with no branching on the number of bones.
+struct SkinStream
+{
+	std::vector<int> vertices;
+	int bucketStart[SKIN_BUCKETS + 1] = {};
+	std::vector<float> positions;
+
+	int influenceStart[SKIN_BUCKETS] = {};
+	std::vector<int> boneIndices;
+	std::vector<float> weights;
+};
+
+//How the vertices are laid out in the vertex buffers drawn from (see Object3D::vertexFormat)
+enum VertexFormat
+{
+	//the float positions and normals of Vertex (24 bytes) and float UVs
+	VERTEX_FORMAT_FLOAT,
+	//Positions as 16 bit signed normalized values within the bounds of the mesh (the fourth one being padding) and
+	//octahedral normals as two more (see OctahedralEncode) - 12 bytes. The UVs are 16 bit unsigned normalized values
+	//within their bounds.
+	VERTEX_FORMAT_PACKED
+};
+
+struct PackedVertex
+{
+	short pos[4];
+	short normal[2];
+};
+
+//The constants the vertex shaders decode the vertices with (cb_VertexDecode) - the packed positions and UVs are scaled
+//and offset back to their bounds and the normals unfolded from the octahedron.
+struct VertexDecode
+{
+	float posScale[4];
+	float posOffset[4];
+	float texCoordScale[2];
+	float texCoordOffset[2];
+	int octahedralNormals;
+	int padding[3];
+};
+
+//A frame of a mesh as the update thread leaves it for the render thread (see FramePipeline) - the deformed vertices
+//already in the vertex format of the mesh, so drawing them takes no more than a copy to the ring.
+struct StagedVertices
+{
+	std::vector<unsigned char> data;
+	VertexDecode decode;
+	//Object3D::vertexVersion of the vertices in data (0 - none yet)
+	unsigned int version = 0;
+	//whether the mesh is drawn in the frame at all and at which level of detail (see Object3D::currentLOD)
+	bool visible = false;
+	int lod = 0;
+};
+
 class Object3D
 {
 public:
@@ -133,16 +262,93 @@ public:
 	std::vector<float> normalList;
 	std::vector<float> normalListTrans;
 
+	//the position, UV and normal index of every corner - three corners for every triangle
 	std::vector<int> indexList;
+	int numCorners = 0;
 
+	//The vertices drawn - every distinct combination of a position, an UV and a normal once. The triangles are drawn
+	//indexed by cornerVertices (the vertex of every corner), reordered at load time for the post-transform cache
+	//(see vertex_cache.h), and the vertices follow in the order the triangles first use them.
+	//vertexIndexList holds the position, UV and normal index of every vertex.
 	int numVertices = 0;
 	Vertex* vLocal = NULL;
 	Vertex* vTrans = NULL;
+	std::vector<Float2> texCoords;
+	std::vector<int> cornerVertices;
+	std::vector<int> vertexIndexList;
 
 	std::vector <VertexSkinned> vSkinnedList;
 
-	ID3D11Buffer *dataBuffer = NULL;
-	ID3D11ShaderResourceView *objTexture = NULL;
+	//vTrans is drawn from the copy DrawObject makes in a DynamicVertexRing (slot 0), texCoords from the immutable
+	//texCoordBuffer (slot 1), both in vertexFormat - set it before Load
+	VertexFormat vertexFormat = VERTEX_FORMAT_FLOAT;
+	RenderBuffer *texCoordBuffer = NULL;
+	VertexDecode vertexDecode;
+	RenderBuffer *decodeBuffer = NULL;
+	RenderBuffer *indexBuffer = NULL;
+	RenderTexture *objTexture = NULL;
+
+	//when set, the mesh is played back from a point cache instead of being skinned (see LoadPointCache)
+	PointCachePlayer* pointCache = NULL;
+	//the frame of the animation vTrans was last played back at
+	float pointCacheFrame = -FLT_MAX;
+
+	//the corners using every unique position of vList and every normal of normalList
+	std::vector<std::vector<int>> positionCorners;
+	std::vector<std::vector<int>> normalCorners;
+
+	//Filled by Armature::AssignBoneIndicesToVertexGroups - the vertices of vSkinnedList every bone influences.
+	//Armature::MeshDeform uses it to re-skin only the vertices of the bones that moved.
+	std::vector<std::vector<int>> boneVertices;
+	//filled by Armature::AssignBoneIndicesToVertexGroups as well, for Armature::ComputeMeshBounds - a box for every bone and
+	//the largest amount by which the weights of a vertex fall short of summing up to 1
+	std::vector<BoneBounds> boneBounds;
+	float weightDeficit = 0.0f;
+	//whether any vertex has no vertex groups at all (and so ends up at the origin)
+	bool unweightedVertices = false;
+	//the box ComputeMeshBounds last found (with no margin) and the version of the armature's pose it is for
+	BoneBounds poseBounds;
+	unsigned int poseBoundsVersion = 0;
+	//The box of the pose vTrans was last skinned at, which the positions are packed into for VERTEX_FORMAT_PACKED -
+	//set by Armature::BeginSkinning. Empty for a mesh that wasn't skinned, its box is then found from the vertices.
+	BoneBounds packBounds;
+	//and the vertices bucketed for the skinning
+	SkinStream skinStream;
+
+	//the version of the armature's pose the mesh was last skinned at (0 - never) and the skinning mode used
+	unsigned int skinnedPoseVersion = 0;
+	SkinningMode skinnedMode = SKINNING_LINEAR;
+	std::vector<unsigned int> skinStamps;
+
+	//the vertices of vSkinnedList moved since the last RecalculateNormals - unless all of them need it
+	bool normalsAllDirty = true;
+	std::vector<int> normalDirtyVertices;
+	std::vector<char> normalDirtyFlags;
+	std::vector<unsigned int> normalStamps;
+	unsigned int normalStamp = 0;
+
+	//whether vTrans changed since it was last copied to the ring, the generation of the ring (see DynamicVertexRing)
+	//the copy was made in and its offset there
+	bool uploadDirty = true;
+	int ringGeneration = -1;
+	unsigned int ringOffset = 0;
+
+	//With the update running on a thread of its own the vertices are drawn from one of the staged copies instead - one
+	//for every slot of the FramePipeline, so the next frame can be staged while this one is drawn. vertexVersion goes up
+	//every time vTrans changes, drawnVersion is the version last copied to the ring from any of them.
+	unsigned int vertexVersion = 0;
+	unsigned int drawnVersion = 0;
+	StagedVertices staged[FRAME_SLOTS];
+
+	//the simplified versions of the mesh, lodList[0] being the first one below the full mesh (see BuildLODs)
+	std::vector<MeshLOD> lodList;
+	//the level drawn - 0 for the full mesh, li + 1 for lodList[li]
+	int currentLOD = 0;
+	//the level vTrans was last skinned at
+	int skinnedLOD = 0;
+	//the step of the animation (see AnimationClock) the mesh was last prepared at - for the meshes deformed less often
+	//than the frames are drawn, -1 if it never was
+	long long preparedStep = -1;
 
 	//we need to call it before destructor!
 	void ReleaseD3D();
@@ -153,9 +359,10 @@ public:
 	Object3D& operator=(Object3D&& other);
 
 
-	void Load(ID3D11Device* devicePtr, const char* fname, bool vertexGroups = false, const char* vertexGroupsFname = NULL);
+	//backendPtr may be NULL for the tools, which never draw the mesh
+	void Load(RenderBackend* backendPtr, const char* fname, bool vertexGroups = false, const char* vertexGroupsFname = NULL);
 
-	void LoadTexture(ID3D11Device* devicePtr, ID3D11DeviceContext* devConPtr, const wchar_t* fname);
+	void LoadTexture(RenderBackend* backendPtr, const wchar_t* fname);
 
 	//translation by a vector of all the vertices
 	void TranslateByVector(float* vec);
@@ -173,8 +380,52 @@ public:
 	//The algorithm is the same as the one used in Blender for smooth shading - the wider the angle 
 	//is between the edges originating from the vertex the greater the influence the triangle will have on the
 	//final values of the normal coordinates for tihs vertex
+	//After an Armature::MeshDeform only the normals of the triangles around the moved vertices are recalculated.
 	void RecalculateNormals();
-	void DrawObject(ID3D11DeviceContext* devConPtr);
+
+	//marks the vertex positions of vSkinnedList[vi] as changed, for RecalculateNormals and the upload in DrawObject
+	void MarkVertexDirty(int vi);
+
+	//marks all of vTrans as changed
+	void MarkAllDirty();
+
+	//Renumbers the unique positions (vList and vSkinnedList) so that position order[pi] becomes position pi, remapping
+	//the triangles to match. Anything built on the old numbering - a point cache, the reverse indices of
+	//Armature::AssignBoneIndicesToVertexGroups, the levels of detail - has to be built again afterwards.
+	void ReorderPositions(const std::vector<int>& order);
+
+	//The same algorithm as RecalculateNormals, but working on the unique positions given by the caller
+	//(3 floats for every vertex of vList) and writing to normals (3 floats for every normal of normalList)
+	//instead of the object's own vertices - so it can be run on many poses of the mesh at once.
+	void ComputeNormals(const float* positions, float* normals) const;
+
+	//Opens a point cache baked for this mesh (see point_cache.h). Returns false if the file can't be opened
+	//or was baked for a different mesh - the mesh is then skinned as usual.
+	bool LoadPointCache(const char* fname);
+
+	//Fills vTrans with the positions and normals of the point cache at the given frame of the animation,
+	//replacing MeshDeform and RecalculateNormals.
+	void PlayPointCache(float frame);
+
+	//Builds a simplified version of the mesh for every ratio of the number of triangles (decreasing, see SimplifyMesh),
+	//where every vertex keeps at most maxInfluences[li] of its heaviest vertex groups, rescaled to sum up to 1.
+	//The bone indices of the vertex groups need to be assigned (Armature::AssignBoneIndicesToVertexGroups) beforehand.
+	void BuildLODs(RenderBackend* backendPtr, const std::vector<float>& triangleRatios, const std::vector<int>& maxInfluences,
+		float weightPenalty);
+
+	//Copies vTrans to the ring unless it hasn't changed since its last copy there, which can still be drawn from.
+	void DrawObject(RenderBackend* backendPtr, DynamicVertexRing* ringPtr);
+
+	//The update thread's half of DrawObject - brings staged[slot] up to date with vTrans (unless the mesh isn't
+	//visible in the frame), converted to vertexFormat. Only the copies older than vTrans are rewritten.
+	void StageVertices(int slot, bool visible);
+
+	//The render thread's half - draws staged[slot] if the mesh is visible in it, copying it to the ring first unless
+	//the same vertices are still there from an earlier frame. A mesh is drawn either this way or by DrawObject.
+	void DrawStaged(RenderBackend* backendPtr, DynamicVertexRing* ringPtr, int slot);
+
+	//binds the copy of the vertices at ringOffset and draws the given level of detail
+	void DrawFromRing(RenderBackend* backendPtr, DynamicVertexRing* ringPtr, int lod);
 
 };
 
@@ -184,6 +435,15 @@ struct TransformPair
 	float pos[3];
 };
 
+//The skinning matrices (12 floats each) and - for SKINNING_DUAL_QUATERNION - the dual quaternions of all the bones
+//at a pose computed by Armature::EvaluatePose. Kept by the caller from one pose to the next, so they are allocated
+//only once (see Armature::ComputePoseSkinTransforms).
+struct PoseSkinTransforms
+{
+	std::vector<float> matrices;
+	std::vector<DualQuaternion> dualQuaternions;
+};
+
 
 struct FRAME
 {
@@ -198,6 +458,8 @@ struct Bone
 	int ID;
 	std::string parentName;
 	Bone* parent;
+	//index of the parent in the armature's bone list, -1 for the root
+	int parentIndex = -1;
 
 	float size; 
 	Quaternion qLocal;
@@ -212,7 +474,15 @@ struct Bone
 	Quaternion qFinal;
 	float posFinal[3];
 
+	//the final transformation the last time it counted as changed and the pose version of that change
+	//(see Armature::SetChangeTolerance)
+	Quaternion qCommitted;
+	float posCommitted[3];
+	unsigned int changedVersion = 0;
+
 	Object3D object3d;
+	//the pose version object3d was last placed at by Armature::DrawFinal (0 - never)
+	unsigned int gizmoVersion = 0;
 
 	int numFrames;
 	std::vector<FRAME> frameList;
@@ -224,6 +494,9 @@ struct Bone
 
 	Bone(Bone&& other);
 
+	//the orientation of the keyframe curve at the given frame - a SLERP between the two keys surrounding it
+	Quaternion InterpolateFrames(float frame) const;
+
 	//Compute the final tranformations of all the bones
 	//It's a recursive process. For each bone it's final transformatin equals: a composition of it's basis transformation, reverse local transformation  
 	//and it's parents final tranformation (so we in turn need to compute is. The recursive process end's up once we arriave at the root bone).
@@ -240,6 +513,15 @@ struct Bone
 	//that this it the worst way of conducting this operation!
 	void TransformVertexByBone(float* vSrc, float* vDst);
 
+	//the same as above, but with the final transformation of the bone taken from a pose computed by Armature::EvaluatePose
+	void TransformVertexByBone(const TransformPair* boneTransform, const float* vSrc, float* vDst) const;
+
+	//the same transformation as TransformVertexByBone as a single dual quaternion
+	DualQuaternion SkinningDualQuaternion(const TransformPair* boneTransform) const;
+
+	//the same transformation as a 3x4 matrix (row by row) - the rotation in the first three columns, the translation in the last one
+	void SkinningMatrix(const TransformPair* boneTransform, float* matrix) const;
+
 };
 
 
@@ -250,16 +532,85 @@ class Armature
 	int numBones = 0;
 	std::vector<Bone> boneList;
 
+	//indices of the bones ordered so that parents always come before their children
+	std::vector<int> evalOrder;
+
+	float firstFrame = 1;
 	float lastFrame;
 	float currFrame = 1;
 
+	//the clip resampled by ResampleClip - numSamples orientations of a bone stored one after another,
+	//the bones one after another (so the samples of bone bi start at sampleList[bi * numSamples])
+	float sampleRate = 0;
+	int numSamples = 0;
+	std::vector<Quaternion> sampleList;
+
+	//the pose cache built by BuildPoseCache - final transformations of all the bones at poseCacheRate samples per frame,
+	//numBones transforms per sample
+	float poseCacheRate = 0;
+	int numPoseSamples = 0;
+	std::vector<TransformPair> poseCache;
+
+	SkinningMode skinningMode = SKINNING_LINEAR;
+	//the skinning matrices (12 floats each) and - for SKINNING_DUAL_QUATERNION - the dual quaternions of all the bones,
+	//recomputed by ComputeSkinTransforms once per pose and skinning mode
+	std::vector<float> skinMatrices;
+	std::vector<DualQuaternion> skinTransforms;
+	unsigned int skinTransformsVersion = 0;
+	SkinningMode skinTransformsMode = SKINNING_LINEAR;
+
+	void ComputeSkinTransforms();
+
+	//incremented every time the final transformations are set - the bones that moved get it as their changedVersion
+	unsigned int poseVersion = 0;
+	float changeAngularTolerance = 0.0f;
+	float changePositionalTolerance = 0.0f;
+
+	//compares the final transformations of all the bones with their committed ones, called whenever they are set
+	void DetectChangedBones();
+
+	//the frame EvaluateCurrentPose last evaluated the bones at, if they still hold that pose
+	bool poseEvaluated = false;
+	float evaluatedFrame = 0.0f;
+
+	//the frames of the clip at the last two steps of AnimateSteps - the current frame is interpolated between them
+	float stepFrame = 1;
+	float prevStepFrame = 1;
+
 public:
 	void ReleaseD3D();
 
-	void Load(ID3D11Device* devicePtr, const char* filename, const char* modelFilename, bool anim = true);
+	int GetNumBones() const { return this->numBones; }
+	Bone& GetBone(int index) { return this->boneList[index]; }
+	float GetFirstFrame() const { return this->firstFrame; }
+	float GetLastFrame() const { return this->lastFrame; }
+	float GetCurrentFrame() const { return this->currFrame; }
+
+	void Load(RenderBackend* backendPtr, const char* filename, const char* modelFilename, bool anim = true);
+
+	//writes the armature back in the same format Load reads it
+	void Save(const char* filename);
+
+	//Drops the keyframes which can be reconstructed by the SLERP of their neighbours (see ComputeCurrBasis).
+	//A key is kept whenever dropping it would rotate the bone by more than angularTolerance (radians) or
+	//move the tip of any bone further down the hierarchy by more than positionalTolerance (scene units).
+	//Returns the number of removed keyframes.
+	int ReduceKeyframes(float angularTolerance, float positionalTolerance);
+
+	//Resamples the keyframes of all the bones at a fixed rate (samples per frame). Once done ComputeCurrBasis
+	//finds the two samples around the current frame by a single index computation instead of searching the keyframes
+	//of every bone. It costs numBones * ((lastFrame - firstFrame) * samplesPerFrame + 1) quaternions of memory,
+	//the number of bytes used is returned. Call it after any changes to the keyframes (e.g. ReduceKeyframes).
+	size_t ResampleClip(float samplesPerFrame);
 
 	void Animate(float progress);
 
+	//Runs numSteps fixed steps of the animation (see AnimationClock), each moving the clip on by stepProgress frames,
+	//and sets the current frame alpha (0 to 1) of the way from the second last step to the last one. The frames drawn
+	//in between the steps get the pose interpolated between them, a step late - the same as interpolating
+	//the poses, as the pose is a function of the frame alone.
+	void AnimateSteps(int numSteps, float stepProgress, float alpha);
+
 
 
 	//This method computes the current value of the basis transformation.
@@ -273,11 +624,86 @@ public:
 	//a method computing the final orientations and positions of all the bones
 	void ComputeFinalOrientationPos();
 
-	void Draw(ID3D11DeviceContext* devConPtr);
+	//Computes the final orientations and positions of all the bones at the given frame of the clip and writes them
+	//to poseBuffer (GetNumBones() transforms, in the order of the bone list). Unlike ComputeCurrBasis and
+	//ComputeFinalOrientationPos it changes nothing in the armature, so any number of threads may evaluate
+	//the same armature at different frames at the same time.
+	void EvaluatePose(float frame, TransformPair* poseBuffer) const;
+
+	//copies a pose computed by EvaluatePose to the final orientations and positions of the bones
+	void ApplyPose(const TransformPair* poseBuffer);
+
+	//Precomputes the final orientations and positions of all the bones over the whole clip at the given
+	//number of samples per frame. Returns the number of bytes used by the cache (0 removes the cache).
+	size_t BuildPoseCache(float samplesPerFrame);
+
+	bool HasPoseCache() { return this->numPoseSamples > 0; }
+
+	//Sets the final orientations and positions of all the bones by interpolating between the two cached poses
+	//around the current frame - it replaces both ComputeCurrBasis and ComputeFinalOrientationPos.
+	//The interpolation happens in the world space, so no hierarchy has to be evaluated.
+	void SamplePoseCache();
+
+	//Sets the final orientations and positions of all the bones for the current frame - by SamplePoseCache if there
+	//is a pose cache, by ComputeCurrBasis and ComputeFinalOrientationPos otherwise - unless they are set already.
+	//Everything that needs the pose pulls it through here, so nothing is evaluated if nothing is drawn.
+	void EvaluateCurrentPose();
+
+	//Brings the mesh up to date with the current frame right before it is drawn: plays it back from its point cache
+	//or deforms it by the pose, and recalculates the normals. The work done is only what changed since the mesh was
+	//last prepared - a mesh hidden for a while catches up on all the bones that moved meanwhile.
+	//A mesh drawn at one of its simplified levels (objPtr->currentLOD) gets only the vertices of that level deformed.
+	void PrepareMesh(Object3D* objPtr);
+
+	//The normals of a mesh deformed by BeginMeshDeform and the rest - nothing for a mesh played back from its point
+	//cache, which has them cached along with the positions.
+	void PrepareNormals(Object3D* objPtr);
+
+	//PrepareMesh (without the normals) split up for many threads. BeginMeshDeform does what can't be split - plays
+	//the mesh back from its point cache or re-skins the vertices of the few bones that moved - and returns 0, or
+	//returns the number of vertices to be skinned as a whole at objPtr->currentLOD (in the order of the SkinStream for
+	//the full mesh). MeshDeformRange skins the vertices begin to end - 1 of them and may run for different ranges on
+	//different threads at once (after PreparePose), EndMeshDeform follows once all of them are skinned.
+	int BeginMeshDeform(Object3D* objPtr);
+	void MeshDeformRange(Object3D* objPtr, int begin, int end) const;
+	void EndMeshDeform(Object3D* objPtr);
+
+	//Evaluates the current pose and everything the skinning derives from it. Once it is done PrepareMesh,
+	//BeginMeshDeform, PrepareNormals and ComputeMeshBounds only read the armature, so they may run for different meshes
+	//on different threads at once.
+	void PreparePose();
+
+	//An axis aligned box (in world space) around the mesh at the current frame, made of the boxes of the bones moved by
+	//their final transformations - so it can be computed, and the mesh culled, before the mesh is deformed at all.
+	//It is conservative for the linear blend skinning and the margin (in scene units) covers the slight bulging
+	//of the dual quaternion skinning.
+	void ComputeMeshBounds(Object3D* objPtr, float margin, float* boundsMin, float* boundsMax);
+
+	void Draw(RenderBackend* backendPtr, DynamicVertexRing* ringPtr);
+
+	//draws the bones at their current pose - only the bones that moved since the last time get their models transformed
+	void DrawFinal(RenderBackend* backendPtr, DynamicVertexRing* ringPtr);
+
+	//DrawFinal split between the threads of a FramePipeline - StageFinal places the bones at the current pose and stages
+	//their models in the slot, DrawStaged draws them from there.
+	void StageFinal(int slot);
+	void DrawStaged(RenderBackend* backendPtr, DynamicVertexRing* ringPtr, int slot);
+
+	//Links the vertex groups of the mesh with the bones and builds everything MeshDeform needs. The unique vertices are
+	//first sorted by the bone with the largest weight (and then by the rest of their bones), so the vertices skinned one
+	//after another mostly use the same few bone matrices instead of jumping around the whole armature.
+	//This is only a change of the layout - the palette of a rig like Megan's fits in L1 anyway, and skinning in this
+	//order measures within noise of the file order (a few percent at best). It can only pay off for rigs with far more
+	//bones.
+	void AssignBoneIndicesToVertexGroups(Object3D* objPtr);
 
-	void DrawFinal(ID3D11DeviceContext* devConPtr);
+	//A bone counts as moved (and its vertices get re-skinned by MeshDeform) once its final transformation differs
+	//from the one it was last skinned with by more than angularTolerance (radians) or positionalTolerance (scene units).
+	//0 for both - the default - re-skins on any change at all.
+	void SetChangeTolerance(float angularTolerance, float positionalTolerance);
 
-	void AssignBoneIndicesToVertexGroups(Object3D* objPtr);
+	void SetSkinningMode(SkinningMode mode) { this->skinningMode = mode; }
+	SkinningMode GetSkinningMode() const { return this->skinningMode; }
 
 
 	//The algorith is as follows:
@@ -285,7 +711,36 @@ public:
 	//that has any influence (i.e. weight) over it and multiply the result by the bones weight. Sum all the
 	//results to achieve the final vertex position. Basically a weighted sum of all the transformations off all the bones
 	//for that vertex.
+	//In practice the weighted sum of the skinning matrices of the bones transforms the vertex once, and the vertices
+	//are skinned bucket by bucket of the same number of bones (see SkinStream) - the ones of a single bone by a plain
+	//rigid transformation.
+	//With SKINNING_DUAL_QUATERNION the bone transformations are blended as dual quaternions instead and the vertex
+	//is transformed only once by the result.
+	//Only the vertices of the bones that moved since the mesh was last deformed are transformed - none at all if the
+	//animation is paused.
 	void MeshDeform(Object3D* objPtr);
 
+	//MeshDeform for the simplified version objPtr->lodList[lod - 1] - only its vertices, with their reduced vertex groups.
+	//Everything it uses is skinned again on every change of the pose, as a level far enough to be drawn has few vertices.
+	void MeshDeformLOD(Object3D* objPtr, int lod);
+
+	//The skinning transformations of the bones at a pose computed by EvaluatePose, for SkinVertices - once per pose,
+	//however many meshes are skinned by it.
+	void ComputePoseSkinTransforms(const TransformPair* poseBuffer, PoseSkinTransforms* transforms) const;
+
+	//The same skinning as MeshDeform, but with the bone transformations taken from ComputePoseSkinTransforms.
+	//The results go to positions (3 floats for every vertex of objPtr->vSkinnedList) and neither the armature
+	//nor the object is changed, so it is safe to call from many threads at once.
+	void SkinVertices(const Object3D* objPtr, const PoseSkinTransforms& transforms, float* positions) const;
+
+private:
+	//MeshDeform and MeshDeformLOD in three parts, as BeginMeshDeform, MeshDeformRange and EndMeshDeform have them
+	int BeginSkinning(Object3D* objPtr, int lod);
+	void SkinRange(Object3D* objPtr, int lod, int begin, int end) const;
+	void EndSkinning(Object3D* objPtr, int lod);
+
+	//sets objPtr->packBounds to the box of the mesh at the current pose (see ComputeMeshBounds), padded for whatever
+	//the skinning may put outside of it
+	void ComputePackBounds(Object3D* objPtr);
 };
 
@@ -0,0 +1,98 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The replaced global operator new and delete counting the allocations - see allocation_tracker.h.
+
+
+
+#include "allocation_tracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+
+
+//relaxed - the counts of the other threads are only read once their work is known to be done anyway
+static std::atomic<long long> numAllocations{ 0 };
+static std::atomic<long long> numBytes{ 0 };
+
+static void* Allocate(std::size_t size)
+{
+	numAllocations.fetch_add(1, std::memory_order_relaxed);
+	numBytes.fetch_add((long long)size, std::memory_order_relaxed);
+
+	//malloc(0) may return NULL, operator new may not
+	return std::malloc(size > 0 ? size : 1);
+}
+
+AllocationCounts operator-(const AllocationCounts& a, const AllocationCounts& b)
+{
+	AllocationCounts counts;
+	counts.numAllocations = a.numAllocations - b.numAllocations;
+	counts.numBytes = a.numBytes - b.numBytes;
+	return counts;
+}
+
+AllocationCounts GetAllocationCounts()
+{
+	AllocationCounts counts;
+	counts.numAllocations = numAllocations.load(std::memory_order_relaxed);
+	counts.numBytes = numBytes.load(std::memory_order_relaxed);
+	return counts;
+}
+
+void* operator new(std::size_t size)
+{
+	void* ptr = Allocate(size);
+	if (ptr == NULL)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+	void* ptr = Allocate(size);
+	if (ptr == NULL)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return Allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return Allocate(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	std::free(ptr);
+}
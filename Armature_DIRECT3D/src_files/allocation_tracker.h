@@ -0,0 +1,28 @@
+#pragma once
+
+//Counts the heap allocations of the whole program - allocation_tracker.cpp replaces the global operator new and
+//delete, so every new and every std::vector, std::string or std::function growing on any thread is counted. It costs
+//two atomic additions per allocation and nothing otherwise, so it is always on.
+//
+//What a piece of code allocates is the difference of the counts around it:
+//	AllocationCounts before = GetAllocationCounts();
+//	...
+//	AllocationCounts allocated = GetAllocationCounts() - before;
+//
+//Only what goes through operator new is counted - malloc called directly, and the memory of the driver and of
+//Direct3D, are not.
+
+//how many frames the frame loop runs before nothing is allowed to allocate any more - the vectors and the arenas
+//reach their full size over the first frames
+#define ALLOCATION_WARMUP_FRAMES 10
+
+struct AllocationCounts
+{
+	long long numAllocations = 0;
+	long long numBytes = 0;
+};
+
+AllocationCounts operator-(const AllocationCounts& a, const AllocationCounts& b);
+
+//everything allocated (not what is still allocated - the frees are not subtracted) since the program started
+AllocationCounts GetAllocationCounts();
@@ -0,0 +1,57 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The fixed step clock of the animation - see animation_clock.h.
+
+
+
+#include "animation_clock.h"
+
+
+
+AnimationClock::AnimationClock(double stepSeconds, int maxStepsPerFrame)
+{
+	this->SetStep(stepSeconds, maxStepsPerFrame);
+}
+
+void AnimationClock::SetStep(double stepSeconds, int maxStepsPerFrame)
+{
+	this->stepSeconds = stepSeconds > 0.0 ? stepSeconds : 1.0 / 60.0;
+	this->maxStepsPerFrame = maxStepsPerFrame > 0 ? maxStepsPerFrame : 1;
+}
+
+int AnimationClock::Advance(double elapsedSeconds)
+{
+	if (elapsedSeconds > 0.0)
+		this->accumulator += elapsedSeconds;
+
+	int num_steps = (int)(this->accumulator / this->stepSeconds);
+	if (num_steps > this->maxStepsPerFrame)
+	{
+		//the whole steps that don't fit are dropped, not carried over to the next frames - only the fraction
+		//of a step the frame is into the next one stays
+		double dropped = (num_steps - this->maxStepsPerFrame) * this->stepSeconds;
+		this->droppedSeconds += dropped;
+		this->accumulator -= dropped;
+		num_steps = this->maxStepsPerFrame;
+	}
+
+	this->accumulator -= num_steps * this->stepSeconds;
+	this->stepCount += num_steps;
+	return num_steps;
+}
+
+float AnimationClock::GetAlpha() const
+{
+	float alpha = (float)(this->accumulator / this->stepSeconds);
+	return alpha > 0.0f ? (alpha < 1.0f ? alpha : 1.0f) : 0.0f;
+}
+
+long long AnimationClock::GetStepCount() const
+{
+	return this->stepCount;
+}
+
+double AnimationClock::GetDroppedSeconds() const
+{
+	return this->droppedSeconds;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+//Turns the real time passed between the frames into fixed steps of the animation, so the animation runs at the same
+//speed whatever the frame rate (or VSync) is. A frame gets as many steps as fit into the time accumulated so far, and
+//the time left over - a fraction of a step - tells how far the frame is between the last two steps, for interpolation.
+//
+//A frame never gets more than maxStepsPerFrame steps. The time beyond that (a hitch, the window being dragged around)
+//is dropped, so the animation slows down for a moment instead of the next frames taking ever longer to catch up.
+class AnimationClock
+{
+public:
+	AnimationClock(double stepSeconds = 1.0 / 60.0, int maxStepsPerFrame = 4);
+
+	void SetStep(double stepSeconds, int maxStepsPerFrame);
+
+	//Adds the time (in seconds) passed since the last frame and returns the number of steps the frame has to run.
+	int Advance(double elapsedSeconds);
+
+	//how far (0 to 1) the current frame is past the last step towards the next one
+	float GetAlpha() const;
+
+	//the steps run since the clock was started - counts up by the result of every Advance
+	long long GetStepCount() const;
+
+	//the time dropped so far by the limit on the steps per frame
+	double GetDroppedSeconds() const;
+
+	double GetStepSeconds() const { return this->stepSeconds; }
+
+private:
+	double stepSeconds;
+	int maxStepsPerFrame;
+
+	//the time not turned into steps yet, always less than a step after Advance
+	double accumulator = 0.0;
+	long long stepCount = 0;
+	double droppedSeconds = 0.0;
+};
@@ -116,6 +116,16 @@ void BindCrtHandlesToStdHandles(bool bindStdIn, bool bindStdOut, bool bindStdErr
 }
 
 
+void AttachParentConsole()
+{
+	//a windows subsystem application has no console of its own
+	if (AttachConsole(ATTACH_PARENT_PROCESS))
+	{
+		FILE* dummyFile;
+		freopen_s(&dummyFile, "CONOUT$", "w", stdout);
+		freopen_s(&dummyFile, "CONOUT$", "w", stderr);
+	}
+}
 
 
 ID3D11Buffer* CreateConstantBuffer(ID3D11Device* devicePtr, unsigned char* data, size_t sz)
@@ -181,3 +191,64 @@ ID3D11Buffer* CreateVertexBuffer(ID3D11Device* devicePtr, unsigned char* data, s
 
 	return buffer;
 }
+
+ID3D11Buffer* CreateImmutableVertexBuffer(ID3D11Device* devicePtr, unsigned char* data, size_t sz)
+{
+	ID3D11Buffer* buffer;
+
+
+	D3D11_BUFFER_DESC vertexBufferDesc;
+
+	ZeroMemory(&vertexBufferDesc, sizeof(D3D11_BUFFER_DESC));
+	vertexBufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	vertexBufferDesc.ByteWidth = sz;
+	vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	vertexBufferDesc.CPUAccessFlags = 0;
+	vertexBufferDesc.MiscFlags = 0;
+
+	D3D11_SUBRESOURCE_DATA tbsd;
+	tbsd.pSysMem = data;
+	HRESULT hr = devicePtr->CreateBuffer(&vertexBufferDesc, &tbsd, &buffer);
+
+	return buffer;
+}
+
+ID3D11Buffer* CreateDynamicVertexBuffer(ID3D11Device* devicePtr, size_t sz)
+{
+	ID3D11Buffer* buffer;
+
+
+	D3D11_BUFFER_DESC vertexBufferDesc;
+
+	ZeroMemory(&vertexBufferDesc, sizeof(D3D11_BUFFER_DESC));
+	vertexBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	vertexBufferDesc.ByteWidth = sz;
+	vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	vertexBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	vertexBufferDesc.MiscFlags = 0;
+
+	HRESULT hr = devicePtr->CreateBuffer(&vertexBufferDesc, NULL, &buffer);
+
+	return buffer;
+}
+
+ID3D11Buffer* CreateIndexBuffer(ID3D11Device* devicePtr, unsigned char* data, size_t sz)
+{
+	ID3D11Buffer* buffer;
+
+
+	D3D11_BUFFER_DESC indexBufferDesc;
+
+	ZeroMemory(&indexBufferDesc, sizeof(D3D11_BUFFER_DESC));
+	indexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
+	indexBufferDesc.ByteWidth = sz;
+	indexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	indexBufferDesc.CPUAccessFlags = 0;
+	indexBufferDesc.MiscFlags = 0;
+
+	D3D11_SUBRESOURCE_DATA tbsd;
+	tbsd.pSysMem = data;
+	HRESULT hr = devicePtr->CreateBuffer(&indexBufferDesc, &tbsd, &buffer);
+
+	return buffer;
+}
@@ -22,6 +22,18 @@
 
 void BindCrtHandlesToStdHandles(bool bindStdIn, bool bindStdOut, bool bindStdErr);
 
+//Redirects stdout and stderr to the console of the command prompt the program has been run from (if any).
+void AttachParentConsole();
+
 ID3D11Buffer* CreateConstantBuffer(ID3D11Device* devicePtr, unsigned char* data, size_t sz);
 
-ID3D11Buffer* CreateVertexBuffer(ID3D11Device* devicePtr, unsigned char* data, size_t sz);
\ No newline at end of file
+ID3D11Buffer* CreateVertexBuffer(ID3D11Device* devicePtr, unsigned char* data, size_t sz);
+
+//a vertex buffer that is never written after it has been created
+ID3D11Buffer* CreateImmutableVertexBuffer(ID3D11Device* devicePtr, unsigned char* data, size_t sz);
+
+//a vertex buffer the CPU writes to by mapping it (see DynamicVertexRing)
+ID3D11Buffer* CreateDynamicVertexBuffer(ID3D11Device* devicePtr, size_t sz);
+
+//a buffer of 32 bit indices
+ID3D11Buffer* CreateIndexBuffer(ID3D11Device* devicePtr, unsigned char* data, size_t sz);
\ No newline at end of file
@@ -0,0 +1,225 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The cost model balancing the skinning over the threads - see deform_scheduler.h.
+
+
+
+#include "3D_lib.h"
+#include "deform_scheduler.h"
+
+#include <algorithm>
+
+
+
+//The bone influences of the vertices 0 to entry - 1 skinned by MeshDeformRange - the vertices of the last bucket
+//(more bones or none) are counted as SKIN_BUCKETS each, the ones of a simplified level as the average of the level.
+static double InfluencesBefore(const Object3D* objPtr, int entry)
+{
+	if (objPtr->currentLOD > 0)
+	{
+		const MeshLOD& lod = objPtr->lodList[objPtr->currentLOD - 1];
+		return lod.vertices.empty() ? 0.0 : (double)lod.numInfluences * entry / lod.vertices.size();
+	}
+
+	const SkinStream& stream = objPtr->skinStream;
+	double influences = 0.0;
+	for (int bi = 0; bi < SKIN_BUCKETS; bi++)
+	{
+		int bucket_entries = std::min(entry, stream.bucketStart[bi + 1]) - stream.bucketStart[bi];
+		if (bucket_entries <= 0)
+			break;
+		influences += (double)bucket_entries * (bi + 1);
+	}
+	return influences;
+}
+
+//the first entry past begin where the influences from begin reach the given number (at most end)
+static int FindEntry(const Object3D* objPtr, int begin, int end, double influences)
+{
+	double target = InfluencesBefore(objPtr, begin) + influences;
+	int lo = begin;
+	int hi = end;
+	while (lo < hi)
+	{
+		int mid = lo + (hi - lo) / 2;
+		if (InfluencesBefore(objPtr, mid) < target)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void DeformScheduler::AddMesh(Object3D* objPtr, int numEntries, int finishJob)
+{
+	DeformMesh mesh;
+	mesh.objPtr = objPtr;
+	mesh.numEntries = numEntries;
+	mesh.finishJob = finishJob;
+	mesh.nsPerInfluence = this->FindCost(objPtr).nsPerInfluence;
+	this->meshes.push_back(mesh);
+}
+
+void DeformScheduler::AddJobs(JobSystem* jobSystem, const Armature* armature)
+{
+	this->pieces.clear();
+	this->chunks.clear();
+	this->numThreads = jobSystem->GetNumThreads();
+
+	double total_ms = 0.0;
+	for (int mi = 0; mi < this->meshes.size(); mi++)
+	{
+		const DeformMesh& mesh = this->meshes[mi];
+		total_ms += InfluencesBefore(mesh.objPtr, mesh.numEntries) * mesh.nsPerInfluence * 1e-6;
+	}
+	this->predictedMs = total_ms;
+	if (this->meshes.empty())
+		return;
+
+	//a single thread gets one chunk, nothing would run alongside the others
+	double chunk_ms = this->numThreads > 1 ? total_ms / (this->numThreads * DEFORM_CHUNKS_PER_THREAD) : total_ms;
+	chunk_ms = std::max(chunk_ms, DEFORM_MIN_CHUNK_MS);
+
+	//A chunk is only closed once it is full, so there is at most one more of them than fits into total_ms - never
+	//more than DEFORM_CHUNKS_PER_THREAD per thread and one - and a piece ends either a mesh or a chunk. With the room
+	//made for the most there can be, the lists don't grow along with the number of chunks changing from frame to frame.
+	int max_chunks = this->numThreads * DEFORM_CHUNKS_PER_THREAD + 1;
+	int max_pieces = max_chunks + (int)this->meshes.size();
+	this->chunks.reserve(max_chunks);
+	this->pieces.reserve(max_pieces);
+	jobSystem->Reserve(max_chunks, max_pieces);
+
+	//The meshes are laid out one after another and cut every chunk_ms - a big mesh ends up in many chunks,
+	//many small ones in one.
+	DeformChunk chunk = { 0, 0, std::chrono::steady_clock::time_point(), std::chrono::steady_clock::time_point() };
+	double chunk_filled_ms = 0.0;
+	for (int mi = 0; mi < this->meshes.size(); mi++)
+	{
+		const DeformMesh& mesh = this->meshes[mi];
+		int begin = 0;
+		while (begin < mesh.numEntries)
+		{
+			double left_ms = (InfluencesBefore(mesh.objPtr, mesh.numEntries) - InfluencesBefore(mesh.objPtr, begin)) * mesh.nsPerInfluence * 1e-6;
+			double room_ms = chunk_ms - chunk_filled_ms;
+
+			//the rest of the mesh fits - or what would be left of it is too little for a chunk of its own
+			int end = mesh.numEntries;
+			if (left_ms > room_ms * 1.25)
+				end = std::max(FindEntry(mesh.objPtr, begin, mesh.numEntries, room_ms * 1e6 / mesh.nsPerInfluence), begin + 1);
+
+			DeformPiece piece = { mi, begin, end, 0.0 };
+			this->pieces.push_back(piece);
+			chunk.numPieces++;
+			chunk_filled_ms += end == mesh.numEntries ? left_ms : room_ms;
+			begin = end;
+
+			if (chunk_filled_ms >= chunk_ms)
+			{
+				this->chunks.push_back(chunk);
+				chunk.firstPiece = (int)this->pieces.size();
+				chunk.numPieces = 0;
+				chunk_filled_ms = 0.0;
+			}
+		}
+	}
+	if (chunk.numPieces > 0)
+		this->chunks.push_back(chunk);
+
+	for (int ci = 0; ci < this->chunks.size(); ci++)
+	{
+		const DeformChunk& curr_chunk = this->chunks[ci];
+		int chunk_job = jobSystem->AddJob([this, armature, ci] { this->RunChunk(armature, ci); });
+
+		//every mesh of the chunk waits for it, once
+		int last_mesh = -1;
+		for (int pi = curr_chunk.firstPiece; pi < curr_chunk.firstPiece + curr_chunk.numPieces; pi++)
+		{
+			int mesh = this->pieces[pi].mesh;
+			if (mesh != last_mesh)
+				jobSystem->AddDependency(this->meshes[mesh].finishJob, chunk_job);
+			last_mesh = mesh;
+		}
+	}
+}
+
+void DeformScheduler::RunChunk(const Armature* armature, int chunk)
+{
+	DeformChunk& curr_chunk = this->chunks[chunk];
+	curr_chunk.startTime = std::chrono::steady_clock::now();
+
+	std::chrono::steady_clock::time_point piece_start = curr_chunk.startTime;
+	for (int pi = curr_chunk.firstPiece; pi < curr_chunk.firstPiece + curr_chunk.numPieces; pi++)
+	{
+		DeformPiece& piece = this->pieces[pi];
+		armature->MeshDeformRange(this->meshes[piece.mesh].objPtr, piece.begin, piece.end);
+
+		std::chrono::steady_clock::time_point piece_end = std::chrono::steady_clock::now();
+		piece.ms = std::chrono::duration<double, std::milli>(piece_end - piece_start).count();
+		piece_start = piece_end;
+	}
+
+	curr_chunk.endTime = piece_start;
+}
+
+void DeformScheduler::Finish()
+{
+	this->stats = DeformStats();
+	this->stats.numMeshes = (int)this->meshes.size();
+	this->stats.numChunks = (int)this->chunks.size();
+	this->stats.numThreads = this->numThreads;
+	this->stats.predictedMs = this->predictedMs;
+
+	//the time of an influence of every mesh, from all of its pieces together
+	for (int mi = 0; mi < this->meshes.size(); mi++)
+	{
+		const DeformMesh& mesh = this->meshes[mi];
+		double mesh_ms = 0.0;
+		for (int pi = 0; pi < this->pieces.size(); pi++)
+		{
+			if (this->pieces[pi].mesh == mi)
+				mesh_ms += this->pieces[pi].ms;
+		}
+
+		double influences = InfluencesBefore(mesh.objPtr, mesh.numEntries);
+		if (influences > 0.0)
+		{
+			MeshCost& cost = this->FindCost(mesh.objPtr);
+			cost.nsPerInfluence += (mesh_ms * 1e6 / influences - cost.nsPerInfluence) * DEFORM_COST_SMOOTHING;
+		}
+	}
+
+	if (!this->chunks.empty())
+	{
+		std::chrono::steady_clock::time_point first_start = this->chunks[0].startTime;
+		std::chrono::steady_clock::time_point last_end = this->chunks[0].endTime;
+		for (int ci = 0; ci < this->chunks.size(); ci++)
+		{
+			const DeformChunk& chunk = this->chunks[ci];
+			double chunk_ms = std::chrono::duration<double, std::milli>(chunk.endTime - chunk.startTime).count();
+			this->stats.workMs += chunk_ms;
+			this->stats.longestChunkMs = std::max(this->stats.longestChunkMs, chunk_ms);
+			first_start = std::min(first_start, chunk.startTime);
+			last_end = std::max(last_end, chunk.endTime);
+		}
+		this->stats.wallMs = std::chrono::duration<double, std::milli>(last_end - first_start).count();
+		if (this->stats.wallMs > 0.0)
+			this->stats.efficiency = this->stats.workMs / (this->stats.wallMs * this->numThreads);
+	}
+
+	this->meshes.clear();
+	this->pieces.clear();
+	this->chunks.clear();
+}
+
+DeformScheduler::MeshCost& DeformScheduler::FindCost(const Object3D* objPtr)
+{
+	for (int ci = 0; ci < this->costs.size(); ci++)
+	{
+		if (this->costs[ci].objPtr == objPtr)
+			return this->costs[ci];
+	}
+
+	MeshCost cost = { objPtr, DEFORM_DEFAULT_NS_PER_INFLUENCE };
+	this->costs.push_back(cost);
+	return this->costs.back();
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+//Spreads the skinning of the meshes of a frame evenly over the threads of a JobSystem. The meshes differ in size
+//by more than an order of magnitude, so one job per mesh leaves most of the threads waiting for the biggest one -
+//instead the skinning is cut into chunks of about the same cost, the big meshes split into ranges of vertices
+//(see Armature::MeshDeformRange) and the small ones merged into a single chunk.
+//
+//The cost of a mesh is its bone influences (the vertices times the bones of each) times the time an influence takes
+//to skin, learned for every mesh from the timings of its chunks - so the memory layout and the cache behaviour
+//of every mesh are accounted for once it has been skinned a few times.
+
+#include <vector>
+#include <chrono>
+
+#include "job_system.h"
+
+class Object3D;
+class Armature;
+
+//how many chunks per thread the skinning is cut into - more of them even out the mistakes of the cost model,
+//fewer of them cost less scheduling
+#define DEFORM_CHUNKS_PER_THREAD 4
+//no chunk is made cheaper than this (in milliseconds), however many threads there are
+#define DEFORM_MIN_CHUNK_MS 0.05
+//the time of an influence (in nanoseconds) assumed for a mesh not timed yet
+#define DEFORM_DEFAULT_NS_PER_INFLUENCE 4.0
+//the weight of the latest frame in the moving average of the time of an influence
+#define DEFORM_COST_SMOOTHING 0.1
+
+//how the skinning of the last frame went
+struct DeformStats
+{
+	int numMeshes = 0;
+	int numChunks = 0;
+	int numThreads = 1;
+	//what the cost model expected and what the chunks took, on all the threads together
+	double predictedMs = 0.0;
+	double workMs = 0.0;
+	//from the first chunk starting to the last one finishing
+	double wallMs = 0.0;
+	double longestChunkMs = 0.0;
+	//workMs / (wallMs * numThreads) - 1 if all the threads were skinning all the time from the first chunk to the last one
+	double efficiency = 0.0;
+};
+
+class DeformScheduler
+{
+public:
+	//Adds a mesh Armature::BeginMeshDeform returned numEntries > 0 for - finishJob (EndMeshDeform and whatever follows)
+	//is made to wait for all of its chunks.
+	void AddMesh(Object3D* objPtr, int numEntries, int finishJob);
+
+	//cuts the skinning of the meshes added into chunks and adds a job for every chunk to the graph of jobSystem
+	void AddJobs(JobSystem* jobSystem, const Armature* armature);
+
+	//Called after the jobs have run - learns the costs from their timings, sets the stats and forgets the meshes.
+	void Finish();
+
+	const DeformStats& GetStats() const { return this->stats; }
+
+private:
+	struct DeformMesh
+	{
+		Object3D* objPtr;
+		int numEntries;
+		int finishJob;
+		double nsPerInfluence;
+	};
+
+	//a range of the vertices of a mesh skinned by a chunk, and the time it took
+	struct DeformPiece
+	{
+		int mesh;
+		int begin;
+		int end;
+		double ms;
+	};
+
+	struct DeformChunk
+	{
+		int firstPiece;
+		int numPieces;
+		std::chrono::steady_clock::time_point startTime;
+		std::chrono::steady_clock::time_point endTime;
+	};
+
+	//the learned time of an influence of every mesh ever added
+	struct MeshCost
+	{
+		const Object3D* objPtr;
+		double nsPerInfluence;
+	};
+
+	void RunChunk(const Armature* armature, int chunk);
+	MeshCost& FindCost(const Object3D* objPtr);
+
+	std::vector<DeformMesh> meshes;
+	std::vector<DeformPiece> pieces;
+	std::vector<DeformChunk> chunks;
+	std::vector<MeshCost> costs;
+	int numThreads = 1;
+	double predictedMs = 0.0;
+
+	DeformStats stats;
+};
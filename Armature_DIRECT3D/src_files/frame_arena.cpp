@@ -0,0 +1,87 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The allocator of the data living for a frame - see frame_arena.h.
+
+
+
+#include "frame_arena.h"
+
+
+
+FrameArena::FrameArena(size_t blockSize)
+{
+	this->blockSize = blockSize;
+}
+
+FrameArena::~FrameArena()
+{
+	for (int bi = 0; bi < this->fullBlocks.size(); bi++)
+	{
+		delete[] this->fullBlocks[bi].data;
+	}
+	delete[] this->current.data;
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment)
+{
+	size_t start = (this->offset + alignment - 1) & ~(alignment - 1);
+	if (this->current.data == NULL || start + size > this->current.size)
+	{
+		//the block is full - the rest of it stays unused until the next Reset
+		if (this->current.data != NULL)
+		{
+			this->fullBlocks.push_back(this->current);
+			this->fullUsed += this->offset;
+		}
+
+		size_t block_size = this->blockSize > size ? this->blockSize : size;
+		this->current.data = this->NewBlock(block_size);
+		this->current.size = block_size;
+		start = 0;
+	}
+
+	this->offset = start + size;
+	return this->current.data + start;
+}
+
+void FrameArena::Reset()
+{
+	//one block as big as all of them together, so the next frame fits in it
+	if (!this->fullBlocks.empty())
+	{
+		size_t capacity = this->GetCapacity();
+		for (int bi = 0; bi < this->fullBlocks.size(); bi++)
+		{
+			delete[] this->fullBlocks[bi].data;
+		}
+		this->fullBlocks.clear();
+		delete[] this->current.data;
+
+		this->current.data = this->NewBlock(capacity);
+		this->current.size = capacity;
+	}
+
+	this->offset = 0;
+	this->fullUsed = 0;
+}
+
+size_t FrameArena::GetUsed() const
+{
+	return this->fullUsed + this->offset;
+}
+
+size_t FrameArena::GetCapacity() const
+{
+	size_t capacity = this->current.size;
+	for (int bi = 0; bi < this->fullBlocks.size(); bi++)
+	{
+		capacity += this->fullBlocks[bi].size;
+	}
+	return capacity;
+}
+
+char* FrameArena::NewBlock(size_t size)
+{
+	//operator new aligns the memory for any type, the offsets into it are aligned by Allocate
+	return new char[size];
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+//A linear allocator for the data that only lives until the end of a frame (or whatever else ends with Reset) -
+//an allocation is a bump of an offset into a block, and Reset frees all of it at once.
+//
+//A frame needing more than the block holds gets more blocks from the heap. Reset puts all of them together into
+//a single block as big as the frame needed, so after the first frames the arena fits everything and stops touching
+//the heap at all.
+//
+//Nothing is destroyed by Reset, so whatever lives in the arena has to be trivially destructible or destroyed by
+//its owner beforehand.
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+class FrameArena
+{
+public:
+	FrameArena(size_t blockSize = 16 * 1024);
+	~FrameArena();
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	//alignment has to be a power of two, and no more than alignof(std::max_align_t)
+	void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	//constructs a T in the arena
+	template <class T, class... Args>
+	T* New(Args&&... args)
+	{
+		return new (this->Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	//frees everything allocated since the last Reset
+	void Reset();
+
+	//the bytes allocated since the last Reset, and the bytes the arena holds
+	size_t GetUsed() const;
+	size_t GetCapacity() const;
+
+private:
+	struct Block
+	{
+		char* data;
+		size_t size;
+	};
+
+	char* NewBlock(size_t size);
+
+	size_t blockSize;
+	//the block allocated from last, and the full ones before it (only until the next Reset)
+	Block current = { NULL, 0 };
+	size_t offset = 0;
+	std::vector<Block> fullBlocks;
+	size_t fullUsed = 0;
+};
@@ -0,0 +1,122 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The update thread running a frame ahead of the render thread - see frame_pipeline.h.
+
+
+
+#include "frame_pipeline.h"
+
+#include <chrono>
+
+
+
+FramePipeline::~FramePipeline()
+{
+	this->Stop();
+}
+
+void FramePipeline::Start(std::function<void(int)> update)
+{
+	this->Stop();
+
+	this->update = update;
+	this->framesStaged = 0;
+	this->framesDrawn = 0;
+	this->frameDrawing = 0;
+	this->stopping = false;
+	this->updateWaitUs = 0;
+	this->renderWaitUs = 0;
+	this->updateThread = std::thread(&FramePipeline::UpdateLoop, this);
+}
+
+void FramePipeline::Stop()
+{
+	if (!this->updateThread.joinable())
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+	this->cond.notify_all();
+	this->updateThread.join();
+}
+
+int FramePipeline::BeginDraw()
+{
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	this->WaitFor(this->framesStaged, this->frameDrawing + 1);
+	this->renderWaitUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+
+	return this->frameDrawing % FRAME_SLOTS;
+}
+
+void FramePipeline::EndDraw()
+{
+	this->frameDrawing++;
+	this->Signal(this->framesDrawn, this->frameDrawing);
+}
+
+double FramePipeline::GetUpdateWaitMs() const
+{
+	return this->updateWaitUs.load() / 1000.0;
+}
+
+double FramePipeline::GetRenderWaitMs() const
+{
+	return this->renderWaitUs.load() / 1000.0;
+}
+
+void FramePipeline::UpdateLoop()
+{
+	for (int frame = 0; ; frame++)
+	{
+		//the slot was last staged with frame - FRAME_SLOTS, which has to be drawn by now
+		std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+		bool go_on = this->WaitFor(this->framesDrawn, frame - FRAME_SLOTS + 1);
+		this->updateWaitUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+		if (!go_on || this->stopping)
+			return;
+
+		this->update(frame % FRAME_SLOTS);
+		this->Signal(this->framesStaged, frame + 1);
+	}
+}
+
+bool FramePipeline::WaitFor(const std::atomic<int>& counter, int value)
+{
+	for (int si = 0; si < FRAME_PIPELINE_SPIN_COUNT; si++)
+	{
+		if (counter.load(std::memory_order_acquire) >= value)
+			return true;
+		if (this->stopping)
+			return false;
+		std::this_thread::yield();
+	}
+
+	//the other thread checks for sleepers after it has moved its counter on, so either it sees this one or this one
+	//sees the counter moved on before going to sleep
+	this->numSleeping++;
+	bool reached;
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->cond.wait(lock, [&] { return counter.load() >= value || this->stopping; });
+		reached = counter.load() >= value;
+	}
+	this->numSleeping--;
+	return reached;
+}
+
+void FramePipeline::Signal(std::atomic<int>& counter, int value)
+{
+	counter.store(value);
+
+	//the lock is taken only when the other thread sleeps, so it can't miss the wake up
+	if (this->numSleeping.load() > 0)
+	{
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+		}
+		this->cond.notify_all();
+	}
+}
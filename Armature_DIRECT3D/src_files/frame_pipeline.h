@@ -0,0 +1,73 @@
+#pragma once
+
+//Runs the update of the scene (animating and deforming the meshes) on a thread of its own, one frame ahead of the
+//thread drawing it. Every frame is staged in one of FRAME_SLOTS slots - the update thread fills the slot of frame N + 1
+//while the render thread draws frame N from the other one, so a frame takes about as long as the slower of the two
+//instead of both of them together.
+//
+//The slots are handed over by two counters alone - the frames staged and the frames drawn - so neither thread ever
+//takes a lock to pass a frame on. A thread only blocks when the other one is a whole frame behind it: the update
+//thread never gets more than one frame ahead of the drawing, which bounds the latency it adds to a frame.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+#define FRAME_SLOTS 2
+
+//how many times a thread waiting for the other one yields before it goes to sleep - the handover is usually
+//a matter of microseconds once the other thread is close to done
+#define FRAME_PIPELINE_SPIN_COUNT 64
+
+class FramePipeline
+{
+public:
+	~FramePipeline();
+
+	//Starts the update thread, which calls update(slot) for frame after frame, each time with the slot to stage
+	//the frame in. The frames are drawn in the same order, starting at slot 0.
+	void Start(std::function<void(int)> update);
+
+	//Waits for the update thread to finish the frame it is staging and stops it. The frames staged but not drawn
+	//yet are thrown away.
+	void Stop();
+
+	//Called by the render thread - waits for the next frame to be staged and returns its slot.
+	int BeginDraw();
+
+	//Called by the render thread once it is done with the slot of BeginDraw, which the update thread may stage
+	//a new frame in from then on.
+	void EndDraw();
+
+	//the total time (in milliseconds) each of the threads spent waiting for the other one since Start - may be read
+	//from any thread
+	double GetUpdateWaitMs() const;
+	double GetRenderWaitMs() const;
+
+private:
+	void UpdateLoop();
+	//waits until counter reaches value, returns false if the pipeline is being stopped meanwhile
+	bool WaitFor(const std::atomic<int>& counter, int value);
+	void Signal(std::atomic<int>& counter, int value);
+
+	std::function<void(int)> update;
+	std::thread updateThread;
+
+	std::atomic<int> framesStaged{ 0 };
+	std::atomic<int> framesDrawn{ 0 };
+	std::atomic<bool> stopping{ false };
+	//the threads waiting on cond
+	std::atomic<int> numSleeping{ 0 };
+	//the frame the render thread draws next
+	int frameDrawing = 0;
+
+	//only for going to sleep and waking up when a thread has to wait long - the frames themselves are passed by the counters
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	//each written by one of the threads only, in microseconds
+	std::atomic<long long> updateWaitUs{ 0 };
+	std::atomic<long long> renderWaitUs{ 0 };
+};
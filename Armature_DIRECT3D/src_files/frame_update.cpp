@@ -0,0 +1,90 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The jobs of the update of a frame - see frame_update.h.
+
+
+
+#include "frame_update.h"
+#include "3D_lib.h"
+#include "job_system.h"
+#include "deform_scheduler.h"
+#include <algorithm>
+
+
+
+//the first round for a mesh - see CullMesh in main.cpp for the culling of the application
+static void PrepareMeshJob(const FrameUpdate& update, MeshJob* meshJob)
+{
+	Object3D* objPtr = meshJob->objPtr;
+	meshJob->visible = update.cullMesh == NULL || update.cullMesh(objPtr, update.cullContext);
+	meshJob->deformed = false;
+	meshJob->numEntries = 0;
+
+	//a mesh out of sight is never deformed, its normals never recalculated and nothing is uploaded
+	if (!meshJob->visible)
+		return;
+
+	//a mesh deformed at a lower rate keeps its vertices until it is due again - or until it changes its level of detail
+	int deform_steps = 0;
+	if (update.lodDeformSteps != NULL && !update.lodDeformSteps->empty())
+	{
+		const std::vector<int>& lod_deform_steps = *update.lodDeformSteps;
+		deform_steps = lod_deform_steps[std::min(objPtr->currentLOD, (int)lod_deform_steps.size() - 1)];
+	}
+	if (deform_steps > 0 && objPtr->preparedStep >= 0 && update.step - objPtr->preparedStep < deform_steps &&
+		objPtr->currentLOD == objPtr->skinnedLOD)
+		return;
+	objPtr->preparedStep = update.step;
+
+	//deforms/transforms the mesh by the armature (or plays it back from its point cache), only as far as the mesh
+	//has changed since it was last drawn - a detailed description in the method implementation
+	meshJob->numEntries = update.armature->BeginMeshDeform(objPtr);
+	meshJob->deformed = true;
+}
+
+void UpdateFrame(const FrameUpdate& update, MeshJob* meshJobs, int numMeshes, bool stageArmature, int slot)
+{
+	Armature* armature = update.armature;
+	JobSystem* job_system = update.jobSystem;
+	DeformScheduler* deform_scheduler = update.deformScheduler;
+
+	//the first round - every mesh on its own
+	for (int mi = 0; mi < numMeshes; mi++)
+	{
+		MeshJob* mesh_job = &meshJobs[mi];
+		job_system->AddJob([&update, mesh_job]
+		{
+			PrepareMeshJob(update, mesh_job);
+		});
+	}
+	job_system->Run();
+
+	//the second round - the chunks of the skinning, then the rest of every mesh
+	for (int mi = 0; mi < numMeshes; mi++)
+	{
+		MeshJob* mesh_job = &meshJobs[mi];
+		int finish_job = job_system->AddJob([armature, mesh_job, slot]
+		{
+			if (mesh_job->numEntries > 0)
+				armature->EndMeshDeform(mesh_job->objPtr);
+			if (mesh_job->deformed)
+				armature->PrepareNormals(mesh_job->objPtr);
+			mesh_job->objPtr->StageVertices(slot, mesh_job->visible);
+		});
+
+		if (mesh_job->numEntries > 0)
+			deform_scheduler->AddMesh(mesh_job->objPtr, mesh_job->numEntries, finish_job);
+	}
+	deform_scheduler->AddJobs(job_system, armature);
+
+	if (stageArmature)
+	{
+		job_system->AddJob([armature, slot]
+		{
+			armature->StageFinal(slot);
+		});
+	}
+
+	job_system->Run();
+	deform_scheduler->Finish();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+//The update of a frame as a graph of jobs run by a JobSystem - everything between the pose of the frame and drawing
+//it, shared by UpdateScene in main.cpp and the -check_allocations tool (see tools.h), so the tool runs the very frames
+//of the application.
+//
+//The graph runs in two rounds. In the first one every mesh is a job of its own - its culling and BeginMeshDeform,
+//which plays the mesh back from its point cache or re-skins the vertices of the few bones that moved. The second one
+//is the skinning left over, cut into chunks of the same cost by a DeformScheduler (which needs the vertices every
+//mesh left to it, so it can't start any sooner), then the normals and the staging of every mesh once all of its
+//chunks are done, and the staging of the bones alongside.
+
+#include <cstddef>
+#include <vector>
+
+class Object3D;
+class Armature;
+class JobSystem;
+class DeformScheduler;
+
+//a mesh of the frame - UpdateFrame fills in all but objPtr
+struct MeshJob
+{
+	Object3D* objPtr;
+	//seen by the camera of the frame
+	bool visible;
+	//deformed for the frame, so its normals have to be recalculated
+	bool deformed;
+	//the vertices left to skin by the jobs of the DeformScheduler (see Armature::BeginMeshDeform)
+	int numEntries;
+};
+
+//Decides whether the mesh is seen in the frame and picks its level of detail (objPtr->currentLOD). It is called from
+//the jobs of the first round, for all the meshes at once, so it may change nothing but the mesh.
+typedef bool (*CullMeshFunction)(Object3D* objPtr, const void* context);
+
+struct FrameUpdate
+{
+	Armature* armature = NULL;
+	JobSystem* jobSystem = NULL;
+	DeformScheduler* deformScheduler = NULL;
+
+	//called with cullContext, NULL keeps every mesh visible at the level of detail it is at
+	CullMeshFunction cullMesh = NULL;
+	const void* cullContext = NULL;
+
+	//How many steps of the animation (see AnimationClock) a mesh keeps its deformation for at every level of detail,
+	//the last one for all the levels past the list - 0 deforms it every frame, and so does an empty list or NULL.
+	//step is the step the frame is at.
+	const std::vector<int>* lodDeformSteps = NULL;
+	long long step = 0;
+};
+
+//Deforms the numMeshes meshes of meshJobs (the ones seen) and stages them in slot, and the bones as well if
+//stageArmature is set. The pose of the frame has to be prepared (Armature::PreparePose) beforehand, unless there is
+//nothing to update at all.
+void UpdateFrame(const FrameUpdate& update, MeshJob* meshJobs, int numMeshes, bool stageArmature, int slot);
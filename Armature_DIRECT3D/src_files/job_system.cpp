@@ -0,0 +1,345 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The work stealing job system - see job_system.h.
+
+
+
+#include "job_system.h"
+
+#include <algorithm>
+
+
+
+//at least doubled, so a list growing by a little now and then reallocates only once in a while
+template <class T>
+static void GrowCapacity(std::vector<T>& list, size_t size)
+{
+	if (list.capacity() < size)
+		list.reserve(std::max(size, list.capacity() * 2));
+}
+
+void JobSystem::WorkQueue::Push(int job)
+{
+	long long b = this->bottom.load(std::memory_order_relaxed);
+	this->items[b].store(job, std::memory_order_relaxed);
+	//publishes the job to the thieves
+	this->bottom.store(b + 1);
+}
+
+int JobSystem::WorkQueue::Pop()
+{
+	long long b = this->bottom.load(std::memory_order_relaxed) - 1;
+	this->bottom.store(b);
+	long long t = this->top.load();
+
+	if (t > b)
+	{
+		//empty
+		this->bottom.store(b + 1, std::memory_order_relaxed);
+		return -1;
+	}
+
+	int job = this->items[b].load(std::memory_order_relaxed);
+	if (t < b)
+		return job;
+
+	//the last job - a thief may be taking it at the same time
+	if (!this->top.compare_exchange_strong(t, t + 1))
+		job = -1;
+	this->bottom.store(b + 1, std::memory_order_relaxed);
+	return job;
+}
+
+int JobSystem::WorkQueue::Steal()
+{
+	long long t = this->top.load();
+	long long b = this->bottom.load();
+	if (t >= b)
+		return -1;
+
+	int job = this->items[t].load(std::memory_order_relaxed);
+	if (!this->top.compare_exchange_strong(t, t + 1))
+		return -1;
+	return job;
+}
+
+JobSystem::~JobSystem()
+{
+	this->Stop();
+}
+
+void JobSystem::Start(int numThreads)
+{
+	this->Stop();
+
+	if (numThreads <= 0)
+		numThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+	this->numThreads = numThreads;
+	this->queues.reset(new WorkQueue[numThreads]);
+	this->queueCapacity = 0;
+
+	this->stopWorkers = false;
+	for (int ti = 1; ti < numThreads; ti++)
+	{
+		this->workers.push_back(std::thread(&JobSystem::WorkerLoop, this, ti));
+	}
+}
+
+void JobSystem::Stop()
+{
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->stopWorkers = true;
+	}
+	this->cond.notify_all();
+
+	for (int ti = 0; ti < this->workers.size(); ti++)
+	{
+		this->workers[ti].join();
+	}
+	this->workers.clear();
+	this->numThreads = 1;
+}
+
+int JobSystem::GetNumThreads() const
+{
+	return this->numThreads;
+}
+
+int JobSystem::AddJobCall(void (*run)(void*), void* closure, std::initializer_list<int> dependencies)
+{
+	int job_index = (int)this->jobs.size();
+
+	Job job;
+	job.run = run;
+	job.closure = closure;
+	job.firstDependent = 0;
+	job.numDependents = 0;
+	job.numDependencies = 0;
+	for (int dependency : dependencies)
+	{
+		this->edges.push_back(std::make_pair(dependency, job_index));
+		job.numDependencies++;
+	}
+	this->jobs.push_back(job);
+
+	return job_index;
+}
+
+void JobSystem::AddDependency(int job, int dependency)
+{
+	this->edges.push_back(std::make_pair(dependency, job));
+	this->jobs[job].numDependencies++;
+}
+
+void JobSystem::Reserve(int numJobs, int numDependencies)
+{
+	GrowCapacity(this->jobs, this->jobs.size() + numJobs);
+	GrowCapacity(this->edges, this->edges.size() + numDependencies);
+	GrowCapacity(this->dependents, this->edges.size() + numDependencies);
+	this->ReserveRun((int)this->jobs.size() + numJobs);
+}
+
+int JobSystem::GetNumSteals() const
+{
+	return this->numSteals.load();
+}
+
+void JobSystem::Run()
+{
+	int num_jobs = (int)this->jobs.size();
+	this->numSteals = 0;
+	if (num_jobs == 0)
+		return;
+
+	//the dependents of every job next to one another - counted first, then placed
+	this->dependents.resize(this->edges.size());
+	for (int ei = 0; ei < this->edges.size(); ei++)
+	{
+		this->jobs[this->edges[ei].first].numDependents++;
+	}
+	int first_dependent = 0;
+	for (int ji = 0; ji < num_jobs; ji++)
+	{
+		this->jobs[ji].firstDependent = first_dependent;
+		first_dependent += this->jobs[ji].numDependents;
+		this->jobs[ji].numDependents = 0;
+	}
+	for (int ei = 0; ei < this->edges.size(); ei++)
+	{
+		Job& dependency = this->jobs[this->edges[ei].first];
+		this->dependents[dependency.firstDependent + dependency.numDependents++] = this->edges[ei].second;
+	}
+
+	this->ReserveRun(num_jobs);
+	for (int ti = 0; ti < this->numThreads; ti++)
+	{
+		this->queues[ti].top = 0;
+		this->queues[ti].bottom = 0;
+	}
+
+	this->jobsLeft = num_jobs;
+	this->jobsQueued = 0;
+	for (int ji = 0; ji < num_jobs; ji++)
+	{
+		this->pendingDependencies[ji] = this->jobs[ji].numDependencies;
+	}
+	//the jobs depending on nothing start on this thread, the others steal them from here
+	for (int ji = num_jobs - 1; ji >= 0; ji--)
+	{
+		if (this->jobs[ji].numDependencies == 0)
+		{
+			this->queues[0].Push(ji);
+			this->jobsQueued++;
+		}
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->runIndex++;
+		this->numWorkersDone = 0;
+	}
+	this->cond.notify_all();
+
+	this->WorkOnJobs(0);
+
+	//the workers may still be looking at the deques - they have to be out before the next graph is built
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->doneCond.wait(lock, [&] { return this->numWorkersDone == (int)this->workers.size(); });
+	}
+
+	this->jobs.clear();
+	this->edges.clear();
+	this->closures.Reset();
+}
+
+void JobSystem::ReserveRun(int numJobs)
+{
+	if (this->queues == NULL)
+		this->queues.reset(new WorkQueue[this->numThreads]);
+
+	//at least doubled, like the lists of the jobs
+	if (this->pendingCapacity < numJobs)
+	{
+		this->pendingCapacity = std::max(numJobs, this->pendingCapacity * 2);
+		this->pendingDependencies.reset(new std::atomic<int>[this->pendingCapacity]);
+	}
+	if (this->queueCapacity < numJobs)
+	{
+		this->queueCapacity = std::max(numJobs, this->queueCapacity * 2);
+		for (int ti = 0; ti < this->numThreads; ti++)
+		{
+			this->queues[ti].items.reset(new std::atomic<int>[this->queueCapacity]);
+		}
+	}
+}
+
+void JobSystem::WorkerLoop(int threadIndex)
+{
+	int last_run = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->cond.wait(lock, [&] { return this->stopWorkers || this->runIndex != last_run; });
+			if (this->stopWorkers)
+				return;
+			last_run = this->runIndex;
+		}
+
+		this->WorkOnJobs(threadIndex);
+
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->numWorkersDone++;
+		}
+		this->doneCond.notify_all();
+	}
+}
+
+void JobSystem::WorkOnJobs(int threadIndex)
+{
+	int num_misses = 0;
+	while (this->jobsLeft.load() > 0)
+	{
+		int job = this->FindJob(threadIndex);
+		if (job >= 0)
+		{
+			num_misses = 0;
+			this->Execute(job, threadIndex);
+			continue;
+		}
+
+		if (++num_misses < JOB_SYSTEM_SPIN_COUNT)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		//nothing to steal for a while - sleeps until a job is pushed or all of them are done. PushJob checks for
+		//sleepers after it has counted the job, so either it sees this thread or this thread sees the job.
+		this->numSleeping++;
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->cond.wait(lock, [&] { return this->jobsQueued.load() > 0 || this->jobsLeft.load() == 0; });
+		}
+		this->numSleeping--;
+		num_misses = 0;
+	}
+}
+
+int JobSystem::FindJob(int threadIndex)
+{
+	int job = this->queues[threadIndex].Pop();
+	if (job < 0)
+	{
+		//the next threads first, so the thieves spread over the deques
+		for (int ti = 1; ti < this->numThreads && job < 0; ti++)
+		{
+			job = this->queues[(threadIndex + ti) % this->numThreads].Steal();
+			if (job >= 0)
+				this->numSteals++;
+		}
+	}
+
+	if (job >= 0)
+		this->jobsQueued--;
+	return job;
+}
+
+void JobSystem::Execute(int job, int threadIndex)
+{
+	const Job& curr_job = this->jobs[job];
+	curr_job.run(curr_job.closure);
+
+	for (int di = 0; di < curr_job.numDependents; di++)
+	{
+		int dependent = this->dependents[curr_job.firstDependent + di];
+		if (this->pendingDependencies[dependent].fetch_sub(1) == 1)
+			this->PushJob(dependent, threadIndex);
+	}
+
+	//the last job wakes everybody up to leave
+	if (this->jobsLeft.fetch_sub(1) == 1)
+	{
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+		}
+		this->cond.notify_all();
+	}
+}
+
+void JobSystem::PushJob(int job, int threadIndex)
+{
+	this->queues[threadIndex].Push(job);
+	this->jobsQueued++;
+
+	if (this->numSleeping.load() > 0)
+	{
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+		}
+		this->cond.notify_all();
+	}
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+//Runs a graph of jobs on all the cores. A job runs once all of the jobs it depends on are done, the jobs it unlocks go
+//to the thread that finished the last of their dependencies - so a chain of jobs mostly stays on one core, its data
+//in that core's cache.
+//
+//Every thread has a deque of its own (see WorkQueue) - it pushes and pops the jobs at the bottom, without any lock,
+//and the threads out of work steal from the top of the others. The threads only take a lock to go to sleep, once
+//there is nothing left to steal.
+//
+//The jobs are added and run frame after frame:
+//	int pose_job = jobSystem.AddJob([&] { ... });
+//	int mesh_job = jobSystem.AddJob([&] { ... }, { pose_job });
+//	jobSystem.Run();
+//The lambdas are copied into a FrameArena freed by every Run, so once the graphs stop growing, adding the jobs
+//allocates nothing.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "frame_arena.h"
+
+//how many times a thread out of work looks for a job to steal before it goes to sleep
+#define JOB_SYSTEM_SPIN_COUNT 64
+
+class JobSystem
+{
+public:
+	~JobSystem();
+
+	//Starts numThreads - 1 worker threads, the thread calling Run being the last one. numThreads 0 uses every core.
+	void Start(int numThreads = 0);
+	void Stop();
+
+	//the worker threads and the one calling Run
+	int GetNumThreads() const;
+
+	//Adds a job to the graph run by the next Run and returns its index. The dependencies are the indices of jobs added
+	//before it, since the last Run.
+	template <class Work>
+	int AddJob(Work work, std::initializer_list<int> dependencies = {})
+	{
+		Work* closure = this->closures.New<Work>(std::move(work));
+		return this->AddJobCall(&JobSystem::RunClosure<Work>, closure, dependencies);
+	}
+
+	//makes the job wait for one more job - any two jobs added since the last Run, as long as there are no cycles
+	void AddDependency(int job, int dependency);
+
+	//Makes room for numJobs more jobs and numDependencies more dependencies to be added and run - for a graph growing
+	//now and then (more threads, more meshes), so it doesn't allocate bit by bit over many frames.
+	void Reserve(int numJobs, int numDependencies);
+
+	//Runs all the jobs added since the last Run, working on them on the calling thread as well, and returns once
+	//all of them are done. Not to be called from within a job.
+	void Run();
+
+	//the jobs taken from the deque of another thread by the last Run
+	int GetNumSteals() const;
+
+private:
+	//The deque of a thread (Chase and Lev) - the owner pushes and pops at the bottom, the others steal from the top.
+	//Only the last job left is contended, for which the owner and the thieves race by a compare and swap of top.
+	//A job is pushed once per Run, so a deque as long as the graph never fills up and never wraps around.
+	struct WorkQueue
+	{
+		std::unique_ptr<std::atomic<int>[]> items;
+		std::atomic<long long> top{ 0 };
+		std::atomic<long long> bottom{ 0 };
+
+		void Push(int job);
+		//-1 if the deque is empty or a thief took the last job
+		int Pop();
+		int Steal();
+	};
+
+	struct Job
+	{
+		//run(closure) does the work
+		void (*run)(void*);
+		void* closure;
+		//the dependents of the job, dependents[firstDependent] onwards
+		int firstDependent;
+		int numDependents;
+		int numDependencies;
+	};
+
+	template <class Work>
+	static void RunClosure(void* closure)
+	{
+		Work* work = (Work*)closure;
+		(*work)();
+		work->~Work();
+	}
+
+	int AddJobCall(void (*run)(void*), void* closure, std::initializer_list<int> dependencies);
+
+	//the deques and the dependency counts big enough for numJobs
+	void ReserveRun(int numJobs);
+
+	void WorkerLoop(int threadIndex);
+	//works on the jobs until all of them are done
+	void WorkOnJobs(int threadIndex);
+	int FindJob(int threadIndex);
+	void Execute(int job, int threadIndex);
+	void PushJob(int job, int threadIndex);
+
+	int numThreads = 1;
+	std::vector<std::thread> workers;
+	std::unique_ptr<WorkQueue[]> queues;
+	int queueCapacity = 0;
+
+	std::vector<Job> jobs;
+	//the lambdas of the jobs
+	FrameArena closures;
+	//(dependency, dependent) pairs as added, turned into the dependents of every job by Run
+	std::vector<std::pair<int, int>> edges;
+	std::vector<int> dependents;
+	//the dependencies of every job not done yet
+	std::unique_ptr<std::atomic<int>[]> pendingDependencies;
+	int pendingCapacity = 0;
+
+	std::atomic<int> jobsLeft{ 0 };
+	//the jobs pushed but not taken yet - what the sleeping threads wait for
+	std::atomic<int> jobsQueued{ 0 };
+	std::atomic<int> numSleeping{ 0 };
+	std::atomic<int> numSteals{ 0 };
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::condition_variable doneCond;
+	//incremented by every Run, which wakes the workers up
+	int runIndex = 0;
+	int numWorkersDone = 0;
+	bool stopWorkers = false;
+};
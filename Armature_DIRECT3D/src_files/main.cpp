@@ -54,6 +54,7 @@
 #include <d3dcompiler.h>
 #include <DirectXPackedVector.h>
 #include <DirectXMath.h>
+#include <DirectXCollision.h>
 #include <dxgidebug.h>
 
 using namespace DirectX;
@@ -62,6 +63,13 @@ using namespace DirectX;
 #include "../DirectXTK/DDSTextureLoader.h"
 #include "d3d_wrappers.h"
 #include "3D_lib.h"
+#include "render_backend_d3d11.h"
+#include "tools.h"
+#include "animation_clock.h"
+#include "job_system.h"
+#include "deform_scheduler.h"
+#include "frame_update.h"
+#include "allocation_tracker.h"
 
 
 #include <chrono>
@@ -166,6 +174,7 @@ bool WIREFRAME = true;
 bool TEXTURED = false;
 bool HIDE_MESH = false;
 bool HIDE_ARMATURE = false;
+bool PAUSED = false;
 
 ID3D11RasterizerState* rasterStateBasic;
 ID3D11RasterizerState* rasterStateNoCulling;
@@ -203,6 +212,111 @@ Object3D hair;
 
 Armature armature;
 
+//the meshes are loaded and drawn through renderBackend (see render_backend.h) - the rest of Direct3D is set up here
+D3D11RenderBackend* renderBackend = NULL;
+
+//the dynamic vertex buffer the deformed meshes are copied to before they are drawn (see DynamicVertexRing),
+//VERTEX_RING_SIZE bytes - a few frames of all of them, it grows if a single mesh doesn't fit
+DynamicVertexRing vertexRing;
+int VERTEX_RING_SIZE = 4 * 1024 * 1024;
+
+//the format the meshes are drawn in - VERTEX_FORMAT_PACKED halves the vertex data copied to the ring every frame
+//(see VertexFormat), the bones are always drawn in floats
+VertexFormat VERTEX_FORMAT = VERTEX_FORMAT_PACKED;
+
+//tolerances of the keyframe reduction run on the armature right after loading it (see Armature::ReduceKeyframes)
+//the angular one is in radians, the positional one in scene units - set both to 0 to keep all the keyframes
+float KEY_REDUCTION_ANGULAR_TOLERANCE = 0.002f;
+float KEY_REDUCTION_POSITIONAL_TOLERANCE = 0.001f;
+
+//samples per frame the animation gets resampled at after loading (see Armature::ResampleClip) - 0 keeps the (reduced)
+//keyframes, which is the default; resampling trades the memory the keyframe reduction saved for the direct indexing
+float CLIP_SAMPLE_RATE = 0.0f;
+
+//samples per frame of the pose cache (see Armature::BuildPoseCache) - meant for background characters, 0 disables the cache
+float POSE_CACHE_RATE = 0.0f;
+
+//the meshes that have a point cache baked by the -bake_cache tool next to their *.obj file (e.g. models/megan/body.pcache)
+//are played back from it instead of being skinned every frame - false always skins them
+bool PLAY_POINT_CACHES = true;
+
+//how far a bone has to move before its vertices get re-skinned (see Armature::SetChangeTolerance) - radians and scene units,
+//0 re-skins on any change
+float BONE_CHANGE_ANGULAR_TOLERANCE = 0.0f;
+float BONE_CHANGE_POSITIONAL_TOLERANCE = 0.0f;
+
+//the meshes whose bounds (see Armature::ComputeMeshBounds) lie outside of the view frustum are neither deformed nor drawn
+bool FRUSTUM_CULLING = true;
+float CULLING_MARGIN = 0.02f;
+
+//The simplified versions of the skinned meshes (see Object3D::BuildLODs) - the ratios of the triangles they keep and
+//how many bones their vertices are skinned with. A mesh switches to level li + 1 once its bounding sphere covers less
+//than LOD_SCREEN_SIZES[li] of the height of the screen. An empty list draws the full meshes only.
+std::vector<float> LOD_TRIANGLE_RATIOS = { 0.5f, 0.2f };
+std::vector<int> LOD_MAX_INFLUENCES = { 2, 1 };
+std::vector<float> LOD_SCREEN_SIZES = { 0.35f, 0.15f };
+//how much the simplification avoids merging vertices bound to different bones, in squared scene units
+float LOD_WEIGHT_PENALTY = 0.0001f;
+
+//The animation runs in fixed steps of ANIMATION_STEP seconds, ANIMATION_SPEED frames of the clip per second, whatever
+//the frame rate - the frames drawn in between two steps get the pose interpolated between them. A frame runs at most
+//MAX_ANIMATION_STEPS steps, a longer hitch slows the animation down instead of piling up the steps on the next frames.
+double ANIMATION_STEP = 1.0 / 60.0;
+float ANIMATION_SPEED = 39.0f;
+int MAX_ANIMATION_STEPS = 4;
+
+//How many steps of the animation a mesh keeps its deformation for, at every level of detail (the last one for all
+//the levels past the list) - 0 deforms it for every frame drawn, n once every n steps, so the distant meshes are
+//deformed at a fraction of the rate of the ones close by.
+std::vector<int> LOD_DEFORM_STEPS = { 0, 2, 4 };
+
+//Animates and deforms the next frame on a thread of its own while this one is drawn (see FramePipeline) - a frame takes
+//about as long as the slower of the two instead of both together, at the cost of one more frame of input latency.
+//false takes turns on the main thread.
+bool PIPELINED_FRAMES = true;
+FramePipeline framePipeline;
+
+//what the update of a frame takes from the input, copied to the slot of the frame by StoreFrameInput - the update thread
+//never reads what the input changes meanwhile, and the frame is drawn from the camera it was culled with
+struct FrameInput
+{
+	XMMATRIX camProjection;
+	XMFLOAT3 camPos;
+	XMFLOAT2 camAngles;
+	//the real time since the input of the previous frame
+	double elapsedSeconds;
+	bool paused;
+	bool hideMesh;
+	bool hideArmature;
+	SkinningMode skinningMode;
+};
+
+FrameInput frameInputs[FRAME_SLOTS];
+std::chrono::steady_clock::time_point lastInputTime;
+bool inputTimeStarted = false;
+
+//turns the time of the frames into the steps of the animation, used by UpdateScene only
+AnimationClock animationClock;
+//the time the clock had dropped when UpdateScene last reported it
+double droppedSecondsReported = 0.0;
+
+//The update of a frame is a graph of jobs (see UpdateScene) run by all of these threads, the one calling UpdateScene
+//included - 0 for every core.
+int JOB_THREADS = 0;
+JobSystem jobSystem;
+//cuts the skinning of the meshes into jobs of about the same cost
+DeformScheduler deformScheduler;
+
+//what CullMesh needs of the frame
+struct CullContext
+{
+	const FrameInput* input;
+	BoundingFrustum viewFrustum;
+};
+
+//switched by the input, passed on to the armature by UpdateScene
+SkinningMode skinningMode = SKINNING_LINEAR;
+
 
 int SCR_WIDTH_WINDOWED = 1000;
 int SCR_HEIGHT_WINDOWED = 1000;
@@ -223,8 +337,10 @@ bool InitDirectInput(HINSTANCE hInstance);
 void DetectInput();
 void ReleaseAll();
 bool InitScene();
-void UpdateScene();
-void DrawScene();
+void StoreFrameInput(int slot);
+void UpdateScene(int slot);
+void DrawScene(int slot);
+bool CullMesh(Object3D* objPtr, const void* context);
 
 bool InitializeWindow(HINSTANCE hInstance,
 	int ShowWnd,
@@ -263,14 +379,26 @@ struct Transformations
 
 D3D11_INPUT_ELEMENT_DESC layout3D[] =
 {
+	//the deformed positions and normals are uploaded every frame (slot 0), the UVs never change (slot 1)
 	{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0 ,D3D11_INPUT_PER_VERTEX_DATA,0},
-	{"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 12 ,D3D11_INPUT_PER_VERTEX_DATA,0},
-	{"NORMALS", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 20 ,D3D11_INPUT_PER_VERTEX_DATA,0},
+	{"NORMALS", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12 ,D3D11_INPUT_PER_VERTEX_DATA,0},
+	{"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 1, 0 ,D3D11_INPUT_PER_VERTEX_DATA,0},
 };
 
 UINT numElements3D = ARRAYSIZE(layout3D);
 ID3D11InputLayout* vertLayout3D;
 
+//the same for VERTEX_FORMAT_PACKED - decoded by the shaders (see cb_VertexDecode)
+D3D11_INPUT_ELEMENT_DESC layout3DPacked[] =
+{
+	{"POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0 ,D3D11_INPUT_PER_VERTEX_DATA,0},
+	{"NORMALS", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8 ,D3D11_INPUT_PER_VERTEX_DATA,0},
+	{"TEXCOORD", 0, DXGI_FORMAT_R16G16_UNORM, 1, 0 ,D3D11_INPUT_PER_VERTEX_DATA,0},
+};
+
+UINT numElements3DPacked = ARRAYSIZE(layout3DPacked);
+ID3D11InputLayout* vertLayout3DPacked;
+
 
 //shader wrappers
 class D3DShader
@@ -429,6 +557,7 @@ void ReleaseShaders()
 void ReleaseLayouts()
 {
 	vertLayout3D->Release();
+	vertLayout3DPacked->Release();
 }
 
 void ReleaseObjects3D()
@@ -440,6 +569,9 @@ void ReleaseObjects3D()
 	 eyeslashes.ReleaseD3D();
 	 hair.ReleaseD3D();
 	 armature.ReleaseD3D();
+	 vertexRing.Release();
+	 delete renderBackend;
+	 renderBackend = NULL;
 }
 
 void ReleaseDirect3DCOMObjects()
@@ -472,6 +604,11 @@ int WINAPI WinMain(HINSTANCE hInstance,
 	LPSTR lpCmdLine,
 	int nShowCmd)
 {
+	//the offline tools (see tools.h) run without any window
+	int tool_exit_code;
+	if (RunCommandLineTool(__argc, __argv, &tool_exit_code))
+		return tool_exit_code;
+
 	//We must inform The Compositing Window Manager, that we shall be the ones to decide on the resolution of our window
 	//and not him!
 	bool dpiAware = SetProcessDPIAware();
@@ -497,6 +634,9 @@ int WINAPI WinMain(HINSTANCE hInstance,
 	srand(time(NULL));
 
 	clock_t start_time = clock();
+	//what every stage of the loading allocated, printed along with its time
+	AllocationCounts start_allocations = GetAllocationCounts();
+	AllocationCounts stage_allocations;
 
 	if (!InitializeWindow(hInstance, nShowCmd, SCR_WIDTH, SCR_HEIGHT, false))
 	{
@@ -506,9 +646,11 @@ int WINAPI WinMain(HINSTANCE hInstance,
 	clock_t end_time = clock();
 
 #ifdef EDIT_STUFF
-	printf("InitializeWindow time %d\n", end_time - start_time);
+	stage_allocations = GetAllocationCounts() - start_allocations;
+	printf("InitializeWindow time %d, %lld allocations, %lld bytes\n", end_time - start_time, stage_allocations.numAllocations, stage_allocations.numBytes);
 #endif
 	start_time = clock();
+	start_allocations = GetAllocationCounts();
 	if (!InitializeDirect3D(hInstance))
 	{
 		MessageBox(0, "Direct3D Initialization has failed", "Error", MB_OK);
@@ -516,9 +658,11 @@ int WINAPI WinMain(HINSTANCE hInstance,
 	}
 	end_time = clock();
 #ifdef EDIT_STUFF
-	printf("InitializeDirect3D time %d\n", end_time - start_time);
+	stage_allocations = GetAllocationCounts() - start_allocations;
+	printf("InitializeDirect3D time %d, %lld allocations, %lld bytes\n", end_time - start_time, stage_allocations.numAllocations, stage_allocations.numBytes);
 #endif
 	start_time = clock();
+	start_allocations = GetAllocationCounts();
 	
 
 	end_time = clock();
@@ -526,6 +670,7 @@ int WINAPI WinMain(HINSTANCE hInstance,
 	printf("InitializeXaudio2 time %d\n", end_time - start_time);
 #endif
 	start_time = clock();
+	start_allocations = GetAllocationCounts();
 	if (!InitScene())
 	{
 		MessageBox(0, "Scene Initialization has failed", "Error", MB_OK);
@@ -533,10 +678,12 @@ int WINAPI WinMain(HINSTANCE hInstance,
 	}
 	end_time = clock();
 #ifdef EDIT_STUFF
-	printf("InitScene time %d\n", end_time - start_time);
+	stage_allocations = GetAllocationCounts() - start_allocations;
+	printf("InitScene time %d, %lld allocations, %lld bytes\n", end_time - start_time, stage_allocations.numAllocations, stage_allocations.numBytes);
 #endif
 
 	start_time = clock();
+	start_allocations = GetAllocationCounts();
 	if (!InitDirectInput(hInstance))
 	{
 		MessageBox(0, "Direct3D Initialization has failed", "Error", MB_OK);
@@ -544,7 +691,8 @@ int WINAPI WinMain(HINSTANCE hInstance,
 	}
 	end_time = clock();
 #ifdef EDIT_STUFF
-	printf("InitDirectInput time %d\n", end_time - start_time);
+	stage_allocations = GetAllocationCounts() - start_allocations;
+	printf("InitDirectInput time %d, %lld allocations, %lld bytes\n", end_time - start_time, stage_allocations.numAllocations, stage_allocations.numBytes);
 #endif
 	messageloop();
 
@@ -765,11 +913,14 @@ bool InitializeDirect3D(HINSTANCE hInstance)
 	shader3DTextured.CreateShaderFile(L"shaders/shader_3d_textured.fx");
 
 	hr = Device->CreateInputLayout(layout3D, numElements3D, shader3D.GetBufferPointerVS(), shader3D.GetBufferSizeVS(), &vertLayout3D);
+	hr = Device->CreateInputLayout(layout3DPacked, numElements3DPacked, shader3D.GetBufferPointerVS(), shader3D.GetBufferSizeVS(), &vertLayout3DPacked);
 	DevCon->IASetInputLayout(vertLayout3D);
 	DevCon->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	cbufferTransformations = CreateConstantBuffer(Device, NULL, sizeof(Transformations));
 	cbufferLight = CreateConstantBuffer(Device, NULL, sizeof(Light)*2);
+	renderBackend = new D3D11RenderBackend(Device, DevCon);
+	vertexRing.Create(renderBackend, VERTEX_RING_SIZE);
 
 
 	camProjection = XMMatrixPerspectiveFovLH(0.25f * 3.1415, (float)SCR_WIDTH / SCR_HEIGHT, 0.03f, 10000.0f);
@@ -899,6 +1050,15 @@ void DetectInput()
 	
 	if ((keyboardState[DIK_F4] & 0x80) && !(keyboardStatePrev[DIK_F4] & 0x80))
 		HIDE_ARMATURE = !HIDE_ARMATURE;
+
+	//switches between the linear blend and the dual quaternion skinning (the meshes played back from point caches keep
+	//the skinning they were baked with)
+	if ((keyboardState[DIK_F5] & 0x80) && !(keyboardStatePrev[DIK_F5] & 0x80))
+		skinningMode = skinningMode == SKINNING_LINEAR ? SKINNING_DUAL_QUATERNION : SKINNING_LINEAR;
+
+	//a paused animation leaves every bone where it was, so nothing gets re-skinned or uploaded
+	if ((keyboardState[DIK_F6] & 0x80) && !(keyboardStatePrev[DIK_F6] & 0x80))
+		PAUSED = !PAUSED;
 	
 	memcpy(keyboardStatePrev, keyboardState, sizeof(keyboardStatePrev));
 
@@ -936,90 +1096,223 @@ bool InitScene()
 
 	//load the armature here. The bone model is just plane *.obj, however the armature file format
 	//was just made up by me but should be quite self explanatory nevertheless
-	armature.Load(Device,"models/megan/armature.txt", "models/bone.obj");
+	armature.Load(renderBackend,"models/megan/armature.txt", "models/bone.obj");
+	armature.ReduceKeyframes(KEY_REDUCTION_ANGULAR_TOLERANCE, KEY_REDUCTION_POSITIONAL_TOLERANCE);
+	size_t clip_bytes = armature.ResampleClip(CLIP_SAMPLE_RATE);
+	size_t pose_cache_bytes = armature.BuildPoseCache(POSE_CACHE_RATE);
+	armature.SetChangeTolerance(BONE_CHANGE_ANGULAR_TOLERANCE, BONE_CHANGE_POSITIONAL_TOLERANCE);
+	skinningMode = armature.GetSkinningMode();
+	animationClock.SetStep(ANIMATION_STEP, MAX_ANIMATION_STEPS);
+	jobSystem.Start(JOB_THREADS);
+#ifdef EDIT_STUFF
+	printf("resampled clip: %d bytes\n", (int)clip_bytes);
+	printf("pose cache: %d bytes\n", (int)pose_cache_bytes);
+#endif
 
 	
 	//load the mesh and its vertex groups. Here again, the vertex_groups are a self explanatory format of mine
-	body.Load(Device, "models/megan/body.obj", true, "models/megan/vertex_groups_body.txt");
+	body.vertexFormat = VERTEX_FORMAT;
+	body.Load(renderBackend, "models/megan/body.obj", true, "models/megan/vertex_groups_body.txt");
 
 	//Yeah, We end up reading the same texture a couple of times. However for didactical reasons, let's
 	//leave it as it is. More efficient != always more readable.
-	body.LoadTexture(Device, DevCon, L"models/megan/body_texture.jpg");
+	body.LoadTexture(renderBackend, L"models/megan/body_texture.jpg");
 
 	//an auxilary method for linking vertex groups with their respective bones
 	armature.AssignBoneIndicesToVertexGroups(&body);
 
 	//the rest of models loaded in a similar fashion
-	shirt.Load(Device, "models/megan/shirt.obj", true, "models/megan/vertex_groups_shirt.txt");
-	shirt.LoadTexture(Device, DevCon, L"models/megan/body_texture.jpg");
+	shirt.vertexFormat = VERTEX_FORMAT;
+	shirt.Load(renderBackend, "models/megan/shirt.obj", true, "models/megan/vertex_groups_shirt.txt");
+	shirt.LoadTexture(renderBackend, L"models/megan/body_texture.jpg");
 	armature.AssignBoneIndicesToVertexGroups(&shirt);
 
 
-	pants.Load(Device, "models/megan/pants.obj", true, "models/megan/vertex_groups_pants.txt");
-	pants.LoadTexture(Device, DevCon, L"models/megan/body_texture.jpg");
+	pants.vertexFormat = VERTEX_FORMAT;
+	pants.Load(renderBackend, "models/megan/pants.obj", true, "models/megan/vertex_groups_pants.txt");
+	pants.LoadTexture(renderBackend, L"models/megan/body_texture.jpg");
 	armature.AssignBoneIndicesToVertexGroups(&pants);
 
 
-	sneakers.Load(Device, "models/megan/sneakers.obj", true, "models/megan/vertex_groups_sneakers.txt");
-	sneakers.LoadTexture(Device, DevCon, L"models/megan/body_texture.jpg");
+	sneakers.vertexFormat = VERTEX_FORMAT;
+	sneakers.Load(renderBackend, "models/megan/sneakers.obj", true, "models/megan/vertex_groups_sneakers.txt");
+	sneakers.LoadTexture(renderBackend, L"models/megan/body_texture.jpg");
 	armature.AssignBoneIndicesToVertexGroups(&sneakers);
 
-	eyeslashes.Load(Device, "models/megan/eyelashes.obj", true, "models/megan/vertex_groups_eyelashes.txt");
-	eyeslashes.LoadTexture(Device, DevCon, L"models/megan/hair_texture.png");
+	eyeslashes.vertexFormat = VERTEX_FORMAT;
+	eyeslashes.Load(renderBackend, "models/megan/eyelashes.obj", true, "models/megan/vertex_groups_eyelashes.txt");
+	eyeslashes.LoadTexture(renderBackend, L"models/megan/hair_texture.png");
 	armature.AssignBoneIndicesToVertexGroups(&eyeslashes);
 
-	hair.Load(Device, "models/megan/hair.obj", true, "models/megan/vertex_groups_hair.txt");
-	hair.LoadTexture(Device, DevCon, L"models/megan/hair_texture.png");
+	hair.vertexFormat = VERTEX_FORMAT;
+	hair.Load(renderBackend, "models/megan/hair.obj", true, "models/megan/vertex_groups_hair.txt");
+	hair.LoadTexture(renderBackend, L"models/megan/hair_texture.png");
 	armature.AssignBoneIndicesToVertexGroups(&hair);
 
+	if (!LOD_TRIANGLE_RATIOS.empty())
+	{
+		body.BuildLODs(renderBackend, LOD_TRIANGLE_RATIOS, LOD_MAX_INFLUENCES, LOD_WEIGHT_PENALTY);
+		shirt.BuildLODs(renderBackend, LOD_TRIANGLE_RATIOS, LOD_MAX_INFLUENCES, LOD_WEIGHT_PENALTY);
+		pants.BuildLODs(renderBackend, LOD_TRIANGLE_RATIOS, LOD_MAX_INFLUENCES, LOD_WEIGHT_PENALTY);
+		sneakers.BuildLODs(renderBackend, LOD_TRIANGLE_RATIOS, LOD_MAX_INFLUENCES, LOD_WEIGHT_PENALTY);
+		eyeslashes.BuildLODs(renderBackend, LOD_TRIANGLE_RATIOS, LOD_MAX_INFLUENCES, LOD_WEIGHT_PENALTY);
+		hair.BuildLODs(renderBackend, LOD_TRIANGLE_RATIOS, LOD_MAX_INFLUENCES, LOD_WEIGHT_PENALTY);
+	}
+
+	if (PLAY_POINT_CACHES)
+	{
+		bool body_cached = body.LoadPointCache("models/megan/body.pcache");
+		shirt.LoadPointCache("models/megan/shirt.pcache");
+		pants.LoadPointCache("models/megan/pants.pcache");
+		sneakers.LoadPointCache("models/megan/sneakers.pcache");
+		eyeslashes.LoadPointCache("models/megan/eyelashes.pcache");
+		hair.LoadPointCache("models/megan/hair.pcache");
+#ifdef EDIT_STUFF
+		printf("body point cache: %s\n", body_cached ? "loaded" : "not found, skinning");
+#endif
+	}
+
 	return true;
 }
 
-void UpdateScene()
+//the input of the frame about to be staged in the slot
+void StoreFrameInput(int slot)
 {
-	//not to get lost in the scene. If you do - uncomment these ;)
-	//printf("cam pos : %f %f %f\n", camPos.x, camPos.y, camPos.z);
-	//printf("cam angles : %f %f\n", camAngles.x, camAngles.y);
-	
+	FrameInput& input = frameInputs[slot];
+	input.camProjection = camProjection;
+	input.camPos = camPos;
+	input.camAngles = camAngles;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	input.elapsedSeconds = inputTimeStarted ? std::chrono::duration<double>(now - lastInputTime).count() : 0.0;
+	lastInputTime = now;
+	inputTimeStarted = true;
+
+	input.paused = PAUSED;
+	input.hideMesh = HIDE_MESH;
+	input.hideArmature = HIDE_ARMATURE;
+	input.skinningMode = skinningMode;
+}
 
-	//updates the current frame indicator, which is of a floating type
-	//you can influence the pace of the animation by changing the progress argument
-	armature.Animate(0.65);
+//the camera of the frame - row vectors times the matrix, like the shaders have it
+XMMATRIX FrameView(const FrameInput& input)
+{
+	XMVECTOR vec_x = XMVectorSet(1, 0, 0, 0);
+	XMVECTOR vec_y = XMVectorSet(0, 1, 0, 0);
 
-	//computes the current basis - a detailed description in the method implementation
-	armature.ComputeCurrBasis();
+	XMMATRIX rot_x = XMMatrixRotationAxis(vec_x, -input.camAngles.x);
+	XMMATRIX rot_y = XMMatrixRotationAxis(vec_y, -input.camAngles.y);
 
-	//computes the final transforms of all bones - a detailed description in the implementation of the method of the same name for the bone class
-	armature.ComputeFinalOrientationPos();
-	
-	//deforms/transforms the mesh by the armature - a detailed description in the method implementation
-	armature.MeshDeform(&body);
+	return XMMatrixTranslation(-input.camPos.x, -input.camPos.y, -input.camPos.z) * rot_y * rot_x;
+}
 
-	//We must recalculate vector normals, since the mesh has changed shape - a detailed description in the method implementation
-	body.RecalculateNormals();
+//Culls the mesh against the view frustum (in the world space) and picks its level of detail - the CullMeshFunction
+//of UpdateFrame, context is the CullContext of the frame
+bool CullMesh(Object3D* objPtr, const void* context)
+{
+	const FrameInput& input = *((const CullContext*)context)->input;
+	const BoundingFrustum& viewFrustum = ((const CullContext*)context)->viewFrustum;
 
-	//other meshes transformed in an analogous way
-	armature.MeshDeform(&shirt);
-	shirt.RecalculateNormals();
+	//the bounds come from the bones alone, so a mesh can be culled before it is deformed
+	if (FRUSTUM_CULLING || !objPtr->lodList.empty())
+	{
+		float bounds_min[3], bounds_max[3];
+		armature.ComputeMeshBounds(objPtr, CULLING_MARGIN, bounds_min, bounds_max);
+
+		BoundingBox bounds(XMFLOAT3((bounds_min[0] + bounds_max[0]) * 0.5f, (bounds_min[1] + bounds_max[1]) * 0.5f, (bounds_min[2] + bounds_max[2]) * 0.5f),
+			XMFLOAT3((bounds_max[0] - bounds_min[0]) * 0.5f, (bounds_max[1] - bounds_min[1]) * 0.5f, (bounds_max[2] - bounds_min[2]) * 0.5f));
+		if (FRUSTUM_CULLING && !viewFrustum.Intersects(bounds))
+			return false;
+
+		//the share of the screen height the bounding sphere takes - its radius against half the height of the view
+		//at its distance (the vertical field of view is a quarter of pi)
+		float radius = sqrt(bounds.Extents.x * bounds.Extents.x + bounds.Extents.y * bounds.Extents.y + bounds.Extents.z * bounds.Extents.z);
+		float to_center[] = { bounds.Center.x - input.camPos.x, bounds.Center.y - input.camPos.y, bounds.Center.z - input.camPos.z };
+		float distance = sqrt(DotVectors(to_center, to_center, 3));
+		float screen_size = distance > radius ? radius / (distance * tan(0.125f * 3.1415f)) : 1.0f;
+
+		objPtr->currentLOD = 0;
+		for (int li = 0; li < objPtr->lodList.size() && li < LOD_SCREEN_SIZES.size(); li++)
+		{
+			if (screen_size < LOD_SCREEN_SIZES[li])
+				objPtr->currentLOD = li + 1;
+		}
+	}
 
-	armature.MeshDeform(&pants);
-	pants.RecalculateNormals();
+	return true;
+}
 
-	armature.MeshDeform(&sneakers);
-	sneakers.RecalculateNormals();
+//Everything a frame needs before it can be drawn - the animation moved on and the meshes seen by its camera deformed
+//and staged in the slot. Called by the update thread of framePipeline, or right before DrawScene without it.
+//
+//The pose comes first, on this thread - everything after it only reads the armature. The rest is the graph of jobs of
+//UpdateFrame (see frame_update.h) run by jobSystem: the culling and the point cache or the bones that moved of every
+//mesh, then the skinning of all the meshes cut into chunks of the same cost by deformScheduler, the normals of every
+//mesh (and its staging) once all of its chunks are done, and the bones of the armature alongside.
+void UpdateScene(int slot)
+{
+	const FrameInput& input = frameInputs[slot];
 
-	armature.MeshDeform(&eyeslashes);
-	eyeslashes.RecalculateNormals();
+	//not to get lost in the scene. If you do - uncomment these ;)
+	//printf("cam pos : %f %f %f\n", input.camPos.x, input.camPos.y, input.camPos.z);
+	//printf("cam angles : %f %f\n", input.camAngles.x, input.camAngles.y);
+
+	if (armature.GetSkinningMode() != input.skinningMode)
+		armature.SetSkinningMode(input.skinningMode);
+
+	//updates the current frame indicator, which is of a floating type - by the steps that fit in the time since
+	//the last frame, interpolated between the last two of them
+	//you can influence the pace of the animation by changing ANIMATION_SPEED
+	int num_steps = animationClock.Advance(input.elapsedSeconds);
+	//a hitch longer than MAX_ANIMATION_STEPS steps slows the animation down rather than being caught up with
+	if (animationClock.GetDroppedSeconds() > droppedSecondsReported)
+	{
+		printf("animation fell behind, %.3f s dropped (%.3f s in total)\n", animationClock.GetDroppedSeconds() - droppedSecondsReported,
+			animationClock.GetDroppedSeconds());
+		droppedSecondsReported = animationClock.GetDroppedSeconds();
+	}
+	if (!input.paused)
+		armature.AnimateSteps(num_steps, ANIMATION_SPEED * (float)ANIMATION_STEP, animationClock.GetAlpha());
+
+	//whatever the jobs of the meshes and the bones share - they only read the armature from here on
+	if (!input.hideMesh || !input.hideArmature)
+		armature.PreparePose();
+
+	CullContext cull_context;
+	cull_context.input = &input;
+	BoundingFrustum::CreateFromMatrix(cull_context.viewFrustum, input.camProjection);
+	cull_context.viewFrustum.Transform(cull_context.viewFrustum, XMMatrixInverse(NULL, FrameView(input)));
+
+	FrameUpdate update;
+	update.armature = &armature;
+	update.jobSystem = &jobSystem;
+	update.deformScheduler = &deformScheduler;
+	update.cullMesh = CullMesh;
+	update.cullContext = &cull_context;
+	update.lodDeformSteps = &LOD_DEFORM_STEPS;
+	update.step = animationClock.GetStepCount();
+
+	//a hidden mesh costs nothing - the deformed meshes and their normals are pulled only for what is drawn
+	MeshJob mesh_jobs[] = { { &body }, { &shirt }, { &pants }, { &sneakers }, { &eyeslashes }, { &hair } };
+	int num_meshes = input.hideMesh ? 0 : sizeof(mesh_jobs) / sizeof(mesh_jobs[0]);
+	UpdateFrame(update, mesh_jobs, num_meshes, !input.hideArmature, slot);
 
-	armature.MeshDeform(&hair);
-	hair.RecalculateNormals();
+#ifdef EDIT_STUFF
+	const DeformStats& deform_stats = deformScheduler.GetStats();
+	printf("skinning: %d meshes in %d chunks, %.3f ms predicted, %.3f ms taken, %.3f ms on %d threads (longest chunk %.3f ms), efficiency %.2f\n",
+		deform_stats.numMeshes, deform_stats.numChunks, deform_stats.predictedMs, deform_stats.workMs, deform_stats.wallMs,
+		deform_stats.numThreads, deform_stats.longestChunkMs, deform_stats.efficiency);
+#endif
 }
 
 
 //the rendering is just the usual Direct3D stuff 
 //- nothing really to add here - should be self explanatory
-void DrawScene()
+//Draws the frame staged in the slot by UpdateScene.
+void DrawScene(int slot)
 {
+	const FrameInput& input = frameInputs[slot];
+
 
 
 	float color_white[] = { 1.0f, 1.0f, 1.0f };
@@ -1037,17 +1330,9 @@ void DrawScene()
 
 	
 
-	XMVECTOR vec_x = XMVectorSet(1,0,0,0);
-	XMVECTOR vec_y = XMVectorSet(0, 1, 0, 0);
-
-
-	XMMATRIX rot_x = XMMatrixRotationAxis(vec_x, -camAngles.x);
-	XMMATRIX rot_y = XMMatrixRotationAxis(vec_y, -camAngles.y);
-
-
 	Transformations trans;
 	trans.World = XMMatrixIdentity();
-	trans.WVP = XMMatrixTranslation(-camPos.x,-camPos.y,-camPos.z) * rot_y* rot_x * camProjection;
+	trans.WVP = FrameView(input) * input.camProjection;
 	trans.WVP = XMMatrixTranspose(trans.WVP);
 
 
@@ -1075,28 +1360,30 @@ void DrawScene()
 	else
 		shader3D.Use();
 	
-	if (!HIDE_MESH)
+	if (!input.hideMesh)
 	{
-		DevCon->PSSetShaderResources(0, 1, &body.objTexture);
-		body.DrawObject(DevCon);
-		shirt.DrawObject(DevCon);
-		pants.DrawObject(DevCon);
-		sneakers.DrawObject(DevCon);
+		DevCon->IASetInputLayout(VERTEX_FORMAT == VERTEX_FORMAT_PACKED ? vertLayout3DPacked : vertLayout3D);
+		renderBackend->SetPixelTexture(0, body.objTexture);
+		body.DrawStaged(renderBackend, &vertexRing, slot);
+		shirt.DrawStaged(renderBackend, &vertexRing, slot);
+		pants.DrawStaged(renderBackend, &vertexRing, slot);
+		sneakers.DrawStaged(renderBackend, &vertexRing, slot);
 
 		DevCon->OMSetBlendState(blendState,NULL, 0xffffffff);
 		DevCon->RSSetState(rasterStateNoCulling);
-		DevCon->PSSetShaderResources(0, 1, &eyeslashes.objTexture);
-		eyeslashes.DrawObject(DevCon);
-		hair.DrawObject(DevCon);
+		renderBackend->SetPixelTexture(0, eyeslashes.objTexture);
+		eyeslashes.DrawStaged(renderBackend, &vertexRing, slot);
+		hair.DrawStaged(renderBackend, &vertexRing, slot);
 		DevCon->OMSetBlendState(0, 0, 0xffffffff);
 	}
 
 
-	if (!HIDE_ARMATURE)
+	if (!input.hideArmature)
 	{
 		shader3D.Use();
+		DevCon->IASetInputLayout(vertLayout3D);
 		DevCon->RSSetState(rasterStateBasic);
-		armature.DrawFinal(DevCon);
+		armature.DrawStaged(renderBackend, &vertexRing, slot);
 	}
 
 	SwapChain->Present(1, 0);
@@ -1107,11 +1394,20 @@ void DrawScene()
 
 clock_t frame_time = 0;
 clock_t start_time = 0;
+//the frames drawn so far - the ones past ALLOCATION_WARMUP_FRAMES are not to allocate at all
+int frameCount = 0;
 int messageloop()
 {
 	MSG msg;
 	ZeroMemory(&msg, sizeof(MSG));
 
+	//the first frames are staged from the input of the scene as it was set up
+	if (PIPELINED_FRAMES)
+	{
+		for (int si = 0; si < FRAME_SLOTS; si++)
+			StoreFrameInput(si);
+		framePipeline.Start(UpdateScene);
+	}
 
 	while (true)
 	{
@@ -1129,21 +1425,55 @@ int messageloop()
 		else
 		{
 				clock_t start_time_total = clock();
+				//of all the threads - with the pipeline, what the update thread allocates meanwhile as well
+				AllocationCounts frame_start_allocations = GetAllocationCounts();
 				
-				DetectInput();
-				UpdateScene();
-				DrawScene();
+				if (PIPELINED_FRAMES)
+				{
+					//the update thread stages the next frame meanwhile
+					int slot = framePipeline.BeginDraw();
+					DrawScene(slot);
+
+					//the slot just drawn is the next one to be staged, with the input as it is now
+					DetectInput();
+					StoreFrameInput(slot);
+					framePipeline.EndDraw();
+				}
+				else
+				{
+					DetectInput();
+					StoreFrameInput(0);
+					UpdateScene(0);
+					DrawScene(0);
+				}
 			
 				clock_t end_time_total = clock();
+				AllocationCounts frame_allocations = GetAllocationCounts() - frame_start_allocations;
 
 				
 				printf("total time: %d\n", end_time_total - start_time_total);
 
+#ifdef EDIT_STUFF
+				printf("frame allocations: %lld, %lld bytes\n", frame_allocations.numAllocations, frame_allocations.numBytes);
+				//with both threads busy neither waits long - the one waiting the most is the faster one
+				if (PIPELINED_FRAMES)
+					printf("waiting in total - update thread: %.1f ms, render thread: %.1f ms\n", framePipeline.GetUpdateWaitMs(),
+						framePipeline.GetRenderWaitMs());
+#endif
+				//the steady state allocates nothing (see -check_allocations in tools.h) - anything here is a regression
+				if (frameCount >= ALLOCATION_WARMUP_FRAMES && frame_allocations.numAllocations > 0)
+					printf("frame %d allocated %lld times (%lld bytes) past the warm up\n", frameCount,
+						frame_allocations.numAllocations, frame_allocations.numBytes);
+				frameCount++;
+
 
 		}
 
 	}
 
+	framePipeline.Stop();
+	jobSystem.Stop();
+
 	return (int)msg.wParam;
 }
 
@@ -0,0 +1,371 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//Mesh simplification for the levels of detail - see mesh_simplify.h.
+
+
+
+#include "3D_lib.h"
+#include "mesh_simplify.h"
+
+#include <queue>
+#include <algorithm>
+
+
+
+//a symmetric 4x4 matrix - the sum of the squared distances to a set of planes (a, b, c, d) as a function of the point
+struct Quadric
+{
+	double q[10] = {};
+
+	void AddPlane(const double* plane, double weight)
+	{
+		double a = plane[0], b = plane[1], c = plane[2], d = plane[3];
+		q[0] += weight * a * a; q[1] += weight * a * b; q[2] += weight * a * c; q[3] += weight * a * d;
+		q[4] += weight * b * b; q[5] += weight * b * c; q[6] += weight * b * d;
+		q[7] += weight * c * c; q[8] += weight * c * d;
+		q[9] += weight * d * d;
+	}
+
+	void Add(const Quadric& other)
+	{
+		for (int i = 0; i < 10; i++)
+		{
+			q[i] += other.q[i];
+		}
+	}
+
+	double Error(const float* v) const
+	{
+		double x = v[0], y = v[1], z = v[2];
+		return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+			+ q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+			+ q[7] * z * z + 2 * q[8] * z
+			+ q[9];
+	}
+};
+
+//a candidate collapse of vertex from into vertex to, valid as long as neither of them has changed since it was computed
+struct Collapse
+{
+	double cost;
+	int from;
+	int to;
+	unsigned int fromStamp;
+	unsigned int toStamp;
+
+	bool operator<(const Collapse& other) const
+	{
+		return this->cost > other.cost;
+	}
+};
+
+//the border edges get a plane perpendicular to the triangle, weighted heavily so the outline of the mesh stays
+#define BORDER_WEIGHT 10.0
+
+static bool TriangleNormal(const float* v0, const float* v1, const float* v2, float* normal)
+{
+	float u[3], v[3];
+	SubVectors(v1, v0, u, 3);
+	SubVectors(v2, v0, v, 3);
+	CrossVectors(u, v, normal);
+	float length = sqrt(DotVectors(normal, normal, 3));
+	if (length == 0.0f)
+		return false;
+	ScaleVector(normal, 1.0f / length, 3);
+	return true;
+}
+
+static float WeightDifference(const std::vector<VertexGroup>& a, const std::vector<VertexGroup>& b)
+{
+	float diff = 0.0f;
+	for (int ai = 0; ai < a.size(); ai++)
+	{
+		float other = 0.0f;
+		for (int bi = 0; bi < b.size(); bi++)
+		{
+			if (b[bi].boneIndex == a[ai].boneIndex)
+				other = b[bi].weight;
+		}
+		diff += fabs(a[ai].weight - other);
+	}
+	for (int bi = 0; bi < b.size(); bi++)
+	{
+		bool found = false;
+		for (int ai = 0; ai < a.size(); ai++)
+		{
+			if (a[ai].boneIndex == b[bi].boneIndex)
+				found = true;
+		}
+		if (!found)
+			diff += b[bi].weight;
+	}
+	return diff;
+}
+
+void SimplifyMesh(const Object3D* objPtr, const std::vector<float>& triangleRatios, float weightPenalty,
+	std::vector<std::vector<int>>& levelCorners)
+{
+	int num_positions = objPtr->vList.size() / 3;
+	int num_triangles = objPtr->numCorners / 3;
+	const float* positions = objPtr->vList.data();
+	bool skinned = objPtr->vSkinnedList.size() == num_positions;
+
+	//every triangle keeps its corners - the position and the corner it takes the UV and the normal from
+	std::vector<int> tri_positions(num_triangles * 3);
+	std::vector<int> tri_corners(num_triangles * 3);
+	std::vector<char> tri_alive(num_triangles, 1);
+	std::vector<std::vector<int>> position_triangles(num_positions);
+	for (int ci = 0; ci < num_triangles * 3; ci++)
+	{
+		tri_positions[ci] = objPtr->indexList[ci * 3];
+		tri_corners[ci] = ci;
+		position_triangles[tri_positions[ci]].push_back(ci / 3);
+	}
+
+	std::vector<Quadric> quadrics(num_positions);
+	for (int ti = 0; ti < num_triangles; ti++)
+	{
+		const float* v[3];
+		for (int k = 0; k < 3; k++)
+		{
+			v[k] = &positions[tri_positions[ti * 3 + k] * 3];
+		}
+
+		float normal[3];
+		if (!TriangleNormal(v[0], v[1], v[2], normal))
+			continue;
+
+		double plane[4] = { normal[0], normal[1], normal[2], -DotVectors(normal, v[0], 3) };
+		for (int k = 0; k < 3; k++)
+		{
+			quadrics[tri_positions[ti * 3 + k]].AddPlane(plane, 1.0);
+		}
+
+		//an edge no other triangle shares is a border
+		for (int k = 0; k < 3; k++)
+		{
+			int a = tri_positions[ti * 3 + k];
+			int b = tri_positions[ti * 3 + (k + 1) % 3];
+			int num_shared = 0;
+			for (int ati = 0; ati < position_triangles[a].size(); ati++)
+			{
+				int other = position_triangles[a][ati];
+				for (int ok = 0; ok < 3; ok++)
+				{
+					if (tri_positions[other * 3 + ok] == b)
+						num_shared++;
+				}
+			}
+			if (num_shared > 1)
+				continue;
+
+			float edge[3], border_normal[3];
+			SubVectors(&positions[b * 3], &positions[a * 3], edge, 3);
+			CrossVectors(edge, normal, border_normal);
+			if (DotVectors(border_normal, border_normal, 3) == 0.0f)
+				continue;
+			NormalizeVector(border_normal, border_normal, 3);
+
+			double border_plane[4] = { border_normal[0], border_normal[1], border_normal[2], -DotVectors(border_normal, &positions[a * 3], 3) };
+			quadrics[a].AddPlane(border_plane, BORDER_WEIGHT);
+			quadrics[b].AddPlane(border_plane, BORDER_WEIGHT);
+		}
+	}
+
+	std::vector<unsigned int> stamps(num_positions, 0);
+	std::vector<char> position_alive(num_positions, 1);
+	std::priority_queue<Collapse> heap;
+
+	auto push_collapse = [&](int from, int to)
+	{
+		Quadric q = quadrics[from];
+		q.Add(quadrics[to]);
+
+		Collapse collapse;
+		collapse.cost = q.Error(&positions[to * 3]);
+		if (skinned)
+			collapse.cost += weightPenalty * WeightDifference(objPtr->vSkinnedList[from].vGroups, objPtr->vSkinnedList[to].vGroups);
+		collapse.from = from;
+		collapse.to = to;
+		collapse.fromStamp = stamps[from];
+		collapse.toStamp = stamps[to];
+		heap.push(collapse);
+	};
+
+	auto push_around = [&](int pi)
+	{
+		for (int pti = 0; pti < position_triangles[pi].size(); pti++)
+		{
+			int ti = position_triangles[pi][pti];
+			for (int k = 0; k < 3; k++)
+			{
+				int other = tri_positions[ti * 3 + k];
+				if (other == pi)
+					continue;
+				push_collapse(pi, other);
+				push_collapse(other, pi);
+			}
+		}
+	};
+
+	for (int ti = 0; ti < num_triangles; ti++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			push_collapse(tri_positions[ti * 3 + k], tri_positions[ti * 3 + (k + 1) % 3]);
+			push_collapse(tri_positions[ti * 3 + (k + 1) % 3], tri_positions[ti * 3 + k]);
+		}
+	}
+
+	levelCorners.assign(triangleRatios.size(), std::vector<int>());
+	int num_alive = num_triangles;
+	std::vector<int> removed;
+	std::vector<int> neighbours_from, neighbours_to;
+
+	for (int li = 0; li < triangleRatios.size(); li++)
+	{
+		int target = (int)(num_triangles * triangleRatios[li]);
+
+		while (num_alive > target && !heap.empty())
+		{
+			Collapse collapse = heap.top();
+			heap.pop();
+
+			int from = collapse.from;
+			int to = collapse.to;
+			if (!position_alive[from] || !position_alive[to] || stamps[from] != collapse.fromStamp || stamps[to] != collapse.toStamp)
+				continue;
+
+			//the triangles sharing the edge disappear, the rest of the triangles of from must not flip
+			removed.clear();
+			bool valid = true;
+			for (int fti = 0; fti < position_triangles[from].size() && valid; fti++)
+			{
+				int ti = position_triangles[from][fti];
+				bool has_to = false;
+				for (int k = 0; k < 3; k++)
+				{
+					if (tri_positions[ti * 3 + k] == to)
+						has_to = true;
+				}
+				if (has_to)
+				{
+					removed.push_back(ti);
+					continue;
+				}
+
+				const float* v[3];
+				const float* v_new[3];
+				for (int k = 0; k < 3; k++)
+				{
+					int pi = tri_positions[ti * 3 + k];
+					v[k] = &positions[pi * 3];
+					v_new[k] = &positions[(pi == from ? to : pi) * 3];
+				}
+				float normal[3], normal_new[3];
+				if (TriangleNormal(v[0], v[1], v[2], normal))
+				{
+					valid = TriangleNormal(v_new[0], v_new[1], v_new[2], normal_new) && DotVectors(normal, normal_new, 3) > 0.2f;
+				}
+			}
+
+			//a collapse of an edge that is not an edge any more, or one that would glue two sheets together
+			//(more common neighbours than the triangles of the edge have)
+			if (removed.empty() || removed.size() > 2)
+				valid = false;
+			if (valid)
+			{
+				neighbours_from.clear();
+				neighbours_to.clear();
+				for (int fti = 0; fti < position_triangles[from].size(); fti++)
+				{
+					for (int k = 0; k < 3; k++)
+						neighbours_from.push_back(tri_positions[position_triangles[from][fti] * 3 + k]);
+				}
+				for (int tti = 0; tti < position_triangles[to].size(); tti++)
+				{
+					for (int k = 0; k < 3; k++)
+						neighbours_to.push_back(tri_positions[position_triangles[to][tti] * 3 + k]);
+				}
+				std::sort(neighbours_from.begin(), neighbours_from.end());
+				neighbours_from.erase(std::unique(neighbours_from.begin(), neighbours_from.end()), neighbours_from.end());
+				std::sort(neighbours_to.begin(), neighbours_to.end());
+				neighbours_to.erase(std::unique(neighbours_to.begin(), neighbours_to.end()), neighbours_to.end());
+
+				int num_common = 0;
+				for (int ni = 0; ni < neighbours_from.size(); ni++)
+				{
+					int pi = neighbours_from[ni];
+					if (pi != from && pi != to && std::binary_search(neighbours_to.begin(), neighbours_to.end(), pi))
+						num_common++;
+				}
+				valid = num_common <= removed.size();
+			}
+			if (!valid)
+				continue;
+
+			//The remaining triangles of from take the corner of to from one of the removed triangles - the one on the same
+			//side of a UV seam (the corner at from has the same UV there), so the texture does not get smeared over it.
+			for (int fti = 0; fti < position_triangles[from].size(); fti++)
+			{
+				int ti = position_triangles[from][fti];
+				if (std::find(removed.begin(), removed.end(), ti) != removed.end())
+					continue;
+
+				for (int k = 0; k < 3; k++)
+				{
+					if (tri_positions[ti * 3 + k] != from)
+						continue;
+
+					int uv_index = objPtr->indexList[tri_corners[ti * 3 + k] * 3 + 1];
+					int new_corner = -1;
+					for (int ri = 0; ri < removed.size(); ri++)
+					{
+						int from_corner = -1, to_corner = -1;
+						for (int rk = 0; rk < 3; rk++)
+						{
+							if (tri_positions[removed[ri] * 3 + rk] == from)
+								from_corner = tri_corners[removed[ri] * 3 + rk];
+							if (tri_positions[removed[ri] * 3 + rk] == to)
+								to_corner = tri_corners[removed[ri] * 3 + rk];
+						}
+						if (new_corner == -1 || objPtr->indexList[from_corner * 3 + 1] == uv_index)
+							new_corner = to_corner;
+					}
+
+					tri_positions[ti * 3 + k] = to;
+					tri_corners[ti * 3 + k] = new_corner;
+				}
+				position_triangles[to].push_back(ti);
+			}
+
+			for (int ri = 0; ri < removed.size(); ri++)
+			{
+				int ti = removed[ri];
+				tri_alive[ti] = 0;
+				num_alive--;
+				for (int k = 0; k < 3; k++)
+				{
+					std::vector<int>& triangles = position_triangles[tri_positions[ti * 3 + k]];
+					triangles.erase(std::remove(triangles.begin(), triangles.end(), ti), triangles.end());
+				}
+			}
+
+			position_alive[from] = 0;
+			position_triangles[from].clear();
+			quadrics[to].Add(quadrics[from]);
+			stamps[to]++;
+			push_around(to);
+		}
+
+		for (int ti = 0; ti < num_triangles; ti++)
+		{
+			if (!tri_alive[ti])
+				continue;
+			for (int k = 0; k < 3; k++)
+			{
+				levelCorners[li].push_back(tri_corners[ti * 3 + k]);
+			}
+		}
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+
+class Object3D;
+
+//Simplifies the mesh by the quadric error metric of Garland and Heckbert with half edge collapses - a vertex is
+//always collapsed into one of its neighbours, so no new vertices (and no new vertex groups) are ever made and
+//the simplified mesh can be skinned with the data of the original one.
+//Collapsing two vertices bound to different bones would tear the mesh once it moves, so weightPenalty (in squared
+//scene units) times the difference of their weights (the sum of the absolute differences over all the bones)
+//is added to the cost of every collapse.
+//
+//For every level the triangles are returned as triples of the corners of objPtr (see Object3D::indexList) once
+//the number of triangles has gone down to triangleRatios[li] times the original number. The ratios are expected
+//to be decreasing.
+void SimplifyMesh(const Object3D* objPtr, const std::vector<float>& triangleRatios, float weightPenalty,
+	std::vector<std::vector<int>>& levelCorners);
@@ -0,0 +1,437 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//Reading PNG images - see png_reader.h.
+
+
+
+#include "png_reader.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+
+
+//Inflating the zlib stream of the image (RFC 1950 and 1951) - the codes are decoded bit by bit from the counts of the
+//codes of every length, the same as Mark Adler's puff does it. That's far from the fastest, but a texture is read once.
+
+#define INFLATE_MAX_BITS 15
+
+struct InflateStream
+{
+	const unsigned char* data;
+	size_t size;
+	size_t pos;
+	unsigned int bitBuffer;
+	int bitCount;
+	bool overrun;
+};
+
+//the number of the codes of every length and the symbols ordered by their codes
+struct HuffmanTable
+{
+	short counts[INFLATE_MAX_BITS + 1];
+	short symbols[288];
+};
+
+static int ReadBits(InflateStream* stream, int numBits)
+{
+	unsigned int value = stream->bitBuffer;
+	while (stream->bitCount < numBits)
+	{
+		if (stream->pos >= stream->size)
+		{
+			stream->overrun = true;
+			return 0;
+		}
+		value |= (unsigned int)stream->data[stream->pos++] << stream->bitCount;
+		stream->bitCount += 8;
+	}
+
+	stream->bitBuffer = value >> numBits;
+	stream->bitCount -= numBits;
+	return (int)(value & ((1u << numBits) - 1));
+}
+
+//-1 if the lengths don't make a valid set of codes (an incomplete one is allowed, as zlib allows it)
+static int BuildHuffmanTable(HuffmanTable* table, const short* lengths, int numSymbols)
+{
+	memset(table->counts, 0, sizeof(table->counts));
+	for (int si = 0; si < numSymbols; si++)
+	{
+		table->counts[lengths[si]]++;
+	}
+	if (table->counts[0] == numSymbols)
+		return 0;
+
+	int left = 1;
+	for (int li = 1; li <= INFLATE_MAX_BITS; li++)
+	{
+		left = (left << 1) - table->counts[li];
+		if (left < 0)
+			return -1;
+	}
+
+	short offsets[INFLATE_MAX_BITS + 1];
+	offsets[1] = 0;
+	for (int li = 1; li < INFLATE_MAX_BITS; li++)
+	{
+		offsets[li + 1] = offsets[li] + table->counts[li];
+	}
+	for (int si = 0; si < numSymbols; si++)
+	{
+		if (lengths[si] != 0)
+			table->symbols[offsets[lengths[si]]++] = (short)si;
+	}
+	return left;
+}
+
+//-1 for a code not in the table
+static int DecodeSymbol(InflateStream* stream, const HuffmanTable* table)
+{
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for (int li = 1; li <= INFLATE_MAX_BITS; li++)
+	{
+		code |= ReadBits(stream, 1);
+		int count = table->counts[li];
+		if (code - count < first)
+			return table->symbols[index + (code - first)];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+static const short LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115,
+	131, 163, 195, 227, 258 };
+static const short LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const short DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537,
+	2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const short DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12,
+	13, 13 };
+
+//the literals and the copies of a compressed block, up to its end code
+static bool InflateCodes(InflateStream* stream, const HuffmanTable* lengthCodes, const HuffmanTable* distanceCodes,
+	std::vector<unsigned char>* output)
+{
+	while (true)
+	{
+		int symbol = DecodeSymbol(stream, lengthCodes);
+		if (symbol < 0 || stream->overrun)
+			return false;
+
+		if (symbol < 256)
+		{
+			output->push_back((unsigned char)symbol);
+			continue;
+		}
+		if (symbol == 256)
+			return true;
+
+		symbol -= 257;
+		if (symbol >= 29)
+			return false;
+		int length = LENGTH_BASE[symbol] + ReadBits(stream, LENGTH_EXTRA[symbol]);
+
+		symbol = DecodeSymbol(stream, distanceCodes);
+		if (symbol < 0 || symbol >= 30)
+			return false;
+		size_t distance = DISTANCE_BASE[symbol] + ReadBits(stream, DISTANCE_EXTRA[symbol]);
+		if (distance > output->size() || stream->overrun)
+			return false;
+
+		//the copy may overlap what it writes, so it goes byte by byte
+		size_t from = output->size() - distance;
+		for (int bi = 0; bi < length; bi++)
+		{
+			output->push_back((*output)[from + bi]);
+		}
+	}
+}
+
+static bool InflateFixedBlock(InflateStream* stream, std::vector<unsigned char>* output)
+{
+	short lengths[288];
+	int si = 0;
+	for (; si < 144; si++)
+		lengths[si] = 8;
+	for (; si < 256; si++)
+		lengths[si] = 9;
+	for (; si < 280; si++)
+		lengths[si] = 7;
+	for (; si < 288; si++)
+		lengths[si] = 8;
+	HuffmanTable length_codes;
+	BuildHuffmanTable(&length_codes, lengths, 288);
+
+	for (si = 0; si < 30; si++)
+		lengths[si] = 5;
+	HuffmanTable distance_codes;
+	BuildHuffmanTable(&distance_codes, lengths, 30);
+
+	return InflateCodes(stream, &length_codes, &distance_codes, output);
+}
+
+static bool InflateDynamicBlock(InflateStream* stream, std::vector<unsigned char>* output)
+{
+	int num_lengths = ReadBits(stream, 5) + 257;
+	int num_distances = ReadBits(stream, 5) + 1;
+	int num_code_lengths = ReadBits(stream, 4) + 4;
+	if (num_lengths > 286 || num_distances > 30)
+		return false;
+
+	//the lengths of the codes the lengths of the other two tables are coded with, in this order
+	static const short CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+	short lengths[288 + 32];
+	memset(lengths, 0, sizeof(short) * 19);
+	for (int ci = 0; ci < num_code_lengths; ci++)
+	{
+		lengths[CODE_LENGTH_ORDER[ci]] = (short)ReadBits(stream, 3);
+	}
+	HuffmanTable length_length_codes;
+	if (BuildHuffmanTable(&length_length_codes, lengths, 19) != 0)
+		return false;
+
+	//both tables in one go - a repeat may run from one into the other
+	int li = 0;
+	while (li < num_lengths + num_distances)
+	{
+		int symbol = DecodeSymbol(stream, &length_length_codes);
+		if (symbol < 0 || stream->overrun)
+			return false;
+
+		if (symbol < 16)
+		{
+			lengths[li++] = (short)symbol;
+			continue;
+		}
+
+		short repeated = 0;
+		int count;
+		if (symbol == 16)
+		{
+			if (li == 0)
+				return false;
+			repeated = lengths[li - 1];
+			count = 3 + ReadBits(stream, 2);
+		}
+		else if (symbol == 17)
+		{
+			count = 3 + ReadBits(stream, 3);
+		}
+		else
+		{
+			count = 11 + ReadBits(stream, 7);
+		}
+		if (li + count > num_lengths + num_distances)
+			return false;
+		for (int ri = 0; ri < count; ri++)
+			lengths[li++] = repeated;
+	}
+
+	//the end of the block has to have a code
+	if (lengths[256] == 0)
+		return false;
+
+	HuffmanTable length_codes;
+	HuffmanTable distance_codes;
+	int left = BuildHuffmanTable(&length_codes, lengths, num_lengths);
+	if (left < 0 || (left > 0 && num_lengths - length_codes.counts[0] != 1))
+		return false;
+	left = BuildHuffmanTable(&distance_codes, lengths + num_lengths, num_distances);
+	if (left < 0 || (left > 0 && num_distances - distance_codes.counts[0] != 1))
+		return false;
+
+	return InflateCodes(stream, &length_codes, &distance_codes, output);
+}
+
+//appends the inflated zlib stream to output
+static bool Inflate(const std::vector<unsigned char>& input, std::vector<unsigned char>* output)
+{
+	//the zlib header - deflate, and no preset dictionary
+	if (input.size() < 2 || (input[0] & 0x0f) != 8 || ((input[0] << 8) | input[1]) % 31 != 0 || (input[1] & 0x20) != 0)
+		return false;
+
+	InflateStream stream = { input.data(), input.size(), 2, 0, 0, false };
+	bool last_block = false;
+	while (!last_block)
+	{
+		last_block = ReadBits(&stream, 1) != 0;
+		int block_type = ReadBits(&stream, 2);
+		bool ok = false;
+		if (block_type == 0)
+		{
+			//stored - from the next whole byte, its length and the length's complement first
+			stream.bitBuffer = 0;
+			stream.bitCount = 0;
+			if (stream.pos + 4 > stream.size)
+				return false;
+			const unsigned char* header = stream.data + stream.pos;
+			int length = header[0] | (header[1] << 8);
+			int complement = header[2] | (header[3] << 8);
+			stream.pos += 4;
+			if (length != (~complement & 0xffff) || stream.pos + length > stream.size)
+				return false;
+			output->insert(output->end(), stream.data + stream.pos, stream.data + stream.pos + length);
+			stream.pos += length;
+			ok = true;
+		}
+		else if (block_type == 1)
+		{
+			ok = InflateFixedBlock(&stream, output);
+		}
+		else if (block_type == 2)
+		{
+			ok = InflateDynamicBlock(&stream, output);
+		}
+
+		if (!ok || stream.overrun)
+			return false;
+	}
+	return true;
+}
+
+static unsigned int ReadBigEndian(const unsigned char* bytes)
+{
+	return ((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16) | ((unsigned int)bytes[2] << 8) | bytes[3];
+}
+
+static int PaethPredictor(int left, int up, int upLeft)
+{
+	int estimate = left + up - upLeft;
+	int to_left = abs(estimate - left);
+	int to_up = abs(estimate - up);
+	int to_up_left = abs(estimate - upLeft);
+	if (to_left <= to_up && to_left <= to_up_left)
+		return left;
+	return to_up <= to_up_left ? up : upLeft;
+}
+
+bool ReadPNG(FILE* f, int* width, int* height, std::vector<unsigned char>* pixels)
+{
+	static const unsigned char SIGNATURE[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+	unsigned char signature[8];
+	if (fread(signature, 1, 8, f) != 8 || memcmp(signature, SIGNATURE, 8) != 0)
+		return false;
+
+	//the chunks up to IEND - the header, the palette and its alpha, and the compressed image, which may be split
+	//into many IDAT chunks (the checksums are not checked)
+	int color_type = -1;
+	std::vector<unsigned char> palette;
+	std::vector<unsigned char> palette_alpha;
+	std::vector<unsigned char> compressed;
+	std::vector<unsigned char> chunk;
+	while (true)
+	{
+		unsigned char chunk_header[8];
+		if (fread(chunk_header, 1, 8, f) != 8)
+			return false;
+		unsigned int length = ReadBigEndian(chunk_header);
+		if (length > 0x7fffffff)
+			return false;
+		chunk.resize(length);
+		if (fread(chunk.data(), 1, length, f) != length || fseek(f, 4, SEEK_CUR) != 0)
+			return false;
+
+		if (memcmp(chunk_header + 4, "IHDR", 4) == 0)
+		{
+			if (length != 13)
+				return false;
+			*width = (int)ReadBigEndian(&chunk[0]);
+			*height = (int)ReadBigEndian(&chunk[4]);
+			color_type = chunk[9];
+			//8 bits per channel, deflate, the adaptive filters, not interlaced
+			if (chunk[8] != 8 || chunk[10] != 0 || chunk[11] != 0 || chunk[12] != 0 || *width <= 0 || *height <= 0 ||
+				*width > 16384 || *height > 16384)
+				return false;
+		}
+		else if (memcmp(chunk_header + 4, "PLTE", 4) == 0)
+		{
+			palette = chunk;
+		}
+		else if (memcmp(chunk_header + 4, "tRNS", 4) == 0)
+		{
+			palette_alpha = chunk;
+		}
+		else if (memcmp(chunk_header + 4, "IDAT", 4) == 0)
+		{
+			compressed.insert(compressed.end(), chunk.begin(), chunk.end());
+		}
+		else if (memcmp(chunk_header + 4, "IEND", 4) == 0)
+		{
+			break;
+		}
+	}
+
+	//the channels of every colour type: grey, -, RGB, palette, grey and alpha, -, RGBA
+	static const int CHANNELS[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	if (color_type < 0 || color_type > 6 || CHANNELS[color_type] == 0 || (color_type == 3 && palette.empty()))
+		return false;
+	int channels = CHANNELS[color_type];
+
+	//every row starts with the byte of its filter
+	size_t row_size = (size_t)*width * channels;
+	std::vector<unsigned char> filtered;
+	filtered.reserve((row_size + 1) * *height);
+	if (!Inflate(compressed, &filtered) || filtered.size() < (row_size + 1) * *height)
+		return false;
+
+	//the filters predict every byte from the ones to the left (a pixel back) and up, already unfiltered
+	std::vector<unsigned char> image(row_size * *height);
+	for (int y = 0; y < *height; y++)
+	{
+		const unsigned char* src = &filtered[y * (row_size + 1)];
+		unsigned char* row = &image[y * row_size];
+		const unsigned char* prev_row = y > 0 ? row - row_size : NULL;
+		int filter = src[0];
+		src++;
+		for (size_t bi = 0; bi < row_size; bi++)
+		{
+			int left = bi >= channels ? row[bi - channels] : 0;
+			int up = prev_row != NULL ? prev_row[bi] : 0;
+			int up_left = prev_row != NULL && bi >= channels ? prev_row[bi - channels] : 0;
+			int prediction;
+			switch (filter)
+			{
+			case 0: prediction = 0; break;
+			case 1: prediction = left; break;
+			case 2: prediction = up; break;
+			case 3: prediction = (left + up) / 2; break;
+			case 4: prediction = PaethPredictor(left, up, up_left); break;
+			default: return false;
+			}
+			row[bi] = (unsigned char)(src[bi] + prediction);
+		}
+	}
+
+	pixels->resize((size_t)*width * *height * 4);
+	for (size_t pi = 0; pi < (size_t)*width * *height; pi++)
+	{
+		const unsigned char* src = &image[pi * channels];
+		unsigned char* dst = &(*pixels)[pi * 4];
+		switch (color_type)
+		{
+		case 0:
+		case 4:
+			dst[0] = dst[1] = dst[2] = src[0];
+			dst[3] = color_type == 4 ? src[1] : 255;
+			break;
+		case 2:
+		case 6:
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst[3] = color_type == 6 ? src[3] : 255;
+			break;
+		case 3:
+			if (src[0] * 3 + 2 >= palette.size())
+				return false;
+			memcpy(dst, &palette[src[0] * 3], 3);
+			dst[3] = src[0] < palette_alpha.size() ? palette_alpha[src[0]] : 255;
+			break;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+
+//Reads a PNG image from f into pixels - RGBA, 4 bytes a pixel, the top row first. The images of 8 bits per channel
+//are read, in any of the colour types (grey, RGB, palette, with or without alpha), but not interlaced ones - which
+//covers what the usual painting programs write. The compressed data is inflated by a decoder of its own (RFC 1951),
+//so nothing has to be linked in for it.
+//Returns false if the file isn't a PNG, is damaged or uses one of the features not read.
+bool ReadPNG(FILE* f, int* width, int* height, std::vector<unsigned char>* pixels);
@@ -0,0 +1,577 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//Baking and playback of the point caches - see point_cache.h for the file format.
+
+
+
+#include "3D_lib.h"
+#include "point_cache.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+
+static void WriteVarint(std::vector<unsigned char>& out, int value)
+{
+	//zigzag - the small negative numbers become small positive ones
+	unsigned int zigzag = ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+	while (zigzag >= 0x80)
+	{
+		out.push_back((unsigned char)(zigzag | 0x80));
+		zigzag >>= 7;
+	}
+	out.push_back((unsigned char)zigzag);
+}
+
+static const unsigned char* ReadVarint(const unsigned char* ptr, const unsigned char* end, int* value)
+{
+	unsigned int zigzag = 0;
+	int shift = 0;
+	while (ptr < end && shift < 32)
+	{
+		unsigned char byte = *ptr;
+		ptr++;
+		zigzag |= (unsigned int)(byte & 0x7f) << shift;
+		shift += 7;
+		if ((byte & 0x80) == 0)
+			break;
+	}
+	*value = (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+	return ptr;
+}
+
+//A frame computed by one of the workers, waiting to be written.
+//frame is -1 while the slot is free, ready tells whether the worker has finished with it.
+//meshData holds the quantized values of every mesh, see point_cache.h.
+struct BakeSlot
+{
+	int frame = -1;
+	bool ready = false;
+	std::vector<std::vector<int>> meshData;
+};
+
+bool BakePointCache(const Armature& armature, const std::vector<Object3D*>& meshes, const std::vector<const char*>& filenames,
+	float firstFrame, float lastFrame, int numFrames)
+{
+	std::vector<FILE*> files(meshes.size(), NULL);
+	bool files_ok = true;
+	for (int mi = 0; mi < meshes.size(); mi++)
+	{
+		files[mi] = fopen(filenames[mi], "wb");
+		if (files[mi] == NULL)
+			files_ok = false;
+	}
+
+	if (!files_ok || numFrames < 1)
+	{
+		for (int mi = 0; mi < files.size(); mi++)
+		{
+			if (files[mi] != NULL)
+				fclose(files[mi]);
+		}
+		return false;
+	}
+
+	float frame_step = numFrames > 1 ? (lastFrame - firstFrame) / (numFrames - 1) : 0.0f;
+
+	//the frame offsets are filled in once all the frames are written
+	std::vector<std::vector<unsigned long long>> frame_offsets(meshes.size());
+	for (int mi = 0; mi < meshes.size(); mi++)
+	{
+		PointCacheHeader header;
+		memcpy(header.magic, POINT_CACHE_MAGIC, 4);
+		header.version = POINT_CACHE_VERSION;
+		header.numFrames = numFrames;
+		header.numPositions = meshes[mi]->vList.size() / 3;
+		header.numNormals = meshes[mi]->normalList.size() / 3;
+		header.firstFrame = firstFrame;
+		header.frameStep = frame_step;
+		header.positionStep = POINT_CACHE_POSITION_STEP;
+		header.keyInterval = POINT_CACHE_KEY_INTERVAL;
+		fwrite(&header, sizeof(header), 1, files[mi]);
+
+		frame_offsets[mi].resize(numFrames + 1, 0);
+		fwrite(frame_offsets[mi].data(), sizeof(unsigned long long), frame_offsets[mi].size(), files[mi]);
+		frame_offsets[mi][0] = sizeof(header) + sizeof(unsigned long long) * frame_offsets[mi].size();
+	}
+
+	int num_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+
+	//the workers never get further ahead of the frame being written than the number of slots
+	int num_slots = num_threads * 2;
+	std::vector<BakeSlot> slots(num_slots);
+	for (int si = 0; si < num_slots; si++)
+	{
+		slots[si].meshData.resize(meshes.size());
+		for (int mi = 0; mi < meshes.size(); mi++)
+		{
+			slots[si].meshData[mi].resize(meshes[mi]->vList.size() + meshes[mi]->normalList.size() / 3 * 2);
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	int next_frame = 0;
+
+	auto worker = [&]()
+	{
+		std::vector<TransformPair> pose(armature.GetNumBones());
+		PoseSkinTransforms skin_transforms;
+		std::vector<float> positions;
+		std::vector<float> normals;
+
+		while (true)
+		{
+			int fi;
+			BakeSlot* slot;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cond.wait(lock, [&] { return next_frame >= numFrames || slots[next_frame % num_slots].frame == -1; });
+				if (next_frame >= numFrames)
+					return;
+
+				fi = next_frame;
+				next_frame++;
+				slot = &slots[fi % num_slots];
+				slot->frame = fi;
+			}
+
+			armature.EvaluatePose(firstFrame + fi * frame_step, pose.data());
+			armature.ComputePoseSkinTransforms(pose.data(), &skin_transforms);
+
+			for (int mi = 0; mi < meshes.size(); mi++)
+			{
+				positions.resize(meshes[mi]->vList.size());
+				normals.resize(meshes[mi]->normalList.size());
+				armature.SkinVertices(meshes[mi], skin_transforms, positions.data());
+				meshes[mi]->ComputeNormals(positions.data(), normals.data());
+
+				int* values = slot->meshData[mi].data();
+				for (int ci = 0; ci < positions.size(); ci++)
+				{
+					values[ci] = (int)lroundf(positions[ci] / POINT_CACHE_POSITION_STEP);
+				}
+
+				values += positions.size();
+				for (int ni = 0; ni < normals.size() / 3; ni++)
+				{
+					short encoded[2];
+					OctahedralEncode(&normals[ni * 3], encoded);
+					values[ni * 2] = encoded[0];
+					values[ni * 2 + 1] = encoded[1];
+				}
+			}
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				slot->ready = true;
+			}
+			cond.notify_all();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (int ti = 0; ti < num_threads; ti++)
+	{
+		workers.push_back(std::thread(worker));
+	}
+
+	//the calling thread encodes the differences to the previous frame and writes the frames in order as soon as they are done
+	std::vector<std::vector<int>> prev_values(meshes.size());
+	std::vector<unsigned char> encoded;
+	for (int fi = 0; fi < numFrames; fi++)
+	{
+		BakeSlot& slot = slots[fi % num_slots];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [&] { return slot.frame == fi && slot.ready; });
+		}
+
+		bool key_frame = fi % POINT_CACHE_KEY_INTERVAL == 0;
+		for (int mi = 0; mi < meshes.size(); mi++)
+		{
+			std::vector<int>& values = slot.meshData[mi];
+			prev_values[mi].resize(values.size(), 0);
+
+			encoded.clear();
+			for (int ci = 0; ci < values.size(); ci++)
+			{
+				WriteVarint(encoded, key_frame ? values[ci] : values[ci] - prev_values[mi][ci]);
+			}
+			prev_values[mi].swap(values);
+
+			fwrite(encoded.data(), 1, encoded.size(), files[mi]);
+			frame_offsets[mi][fi + 1] = frame_offsets[mi][fi] + encoded.size();
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			slot.frame = -1;
+			slot.ready = false;
+		}
+		cond.notify_all();
+	}
+
+	for (int ti = 0; ti < workers.size(); ti++)
+	{
+		workers[ti].join();
+	}
+
+	for (int mi = 0; mi < files.size(); mi++)
+	{
+		fseek(files[mi], sizeof(PointCacheHeader), SEEK_SET);
+		fwrite(frame_offsets[mi].data(), sizeof(unsigned long long), frame_offsets[mi].size(), files[mi]);
+		fclose(files[mi]);
+	}
+
+	return true;
+}
+
+
+
+PointCachePlayer::PointCachePlayer()
+{
+	memset(&this->header, 0, sizeof(this->header));
+}
+
+PointCachePlayer::~PointCachePlayer()
+{
+	this->Close();
+}
+
+bool PointCachePlayer::Open(const char* filename)
+{
+	this->Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart >= sizeof(PointCacheHeader))
+	{
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	if (mapping == NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	this->fileHandle = file;
+	this->mappingHandle = mapping;
+	this->fileData = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	this->fileSize = file_size.QuadPart;
+#else
+	int file = open(filename, O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat file_stat;
+	void* data = MAP_FAILED;
+	if (fstat(file, &file_stat) == 0 && file_stat.st_size >= sizeof(PointCacheHeader))
+	{
+		data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	}
+	//the mapping stays valid after the file is closed
+	close(file);
+	if (data == MAP_FAILED)
+		return false;
+
+	this->fileData = (const unsigned char*)data;
+	this->fileSize = file_stat.st_size;
+#endif
+	if (this->fileData == NULL)
+	{
+		this->Close();
+		return false;
+	}
+
+	memcpy(&this->header, this->fileData, sizeof(PointCacheHeader));
+	this->frameOffsets = (const unsigned long long*)(this->fileData + sizeof(PointCacheHeader));
+
+	bool valid = memcmp(this->header.magic, POINT_CACHE_MAGIC, 4) == 0 && this->header.version == POINT_CACHE_VERSION &&
+		this->header.numFrames > 0 && this->header.keyInterval > 0 &&
+		sizeof(PointCacheHeader) + sizeof(unsigned long long) * (this->header.numFrames + 1) <= this->fileSize;
+	for (int fi = 0; valid && fi < this->header.numFrames; fi++)
+	{
+		valid = this->frameOffsets[fi] <= this->frameOffsets[fi + 1] && this->frameOffsets[fi + 1] <= this->fileSize;
+	}
+	if (!valid)
+	{
+		this->Close();
+		return false;
+	}
+
+	int num_values = this->header.numPositions * 3 + this->header.numNormals * 2;
+	int num_floats = (this->header.numPositions + this->header.numNormals) * 3;
+
+	this->decodedFrames.resize(POINT_CACHE_PREFETCH_FRAMES);
+	for (int di = 0; di < this->decodedFrames.size(); di++)
+	{
+		this->decodedFrames[di].frame = -1;
+		this->decodedFrames[di].data.resize(num_floats);
+	}
+	this->prefetchState.resize(num_values);
+	this->prefetchStateFrame = -1;
+	this->sampleState.resize(num_values);
+	this->sampleStateFrame = -1;
+	this->positions.resize(this->header.numPositions * 3);
+	this->normals.resize(this->header.numNormals * 3);
+
+	this->playhead = 0;
+	this->numMisses = 0;
+	this->stopPrefetching = false;
+	this->prefetchThread = std::thread(&PointCachePlayer::PrefetchLoop, this);
+
+	return true;
+}
+
+void PointCachePlayer::Close()
+{
+	if (this->prefetchThread.joinable())
+	{
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->stopPrefetching = true;
+		}
+		this->cond.notify_all();
+		this->prefetchThread.join();
+	}
+
+#ifdef _WIN32
+	if (this->fileData != NULL)
+	{
+		UnmapViewOfFile(this->fileData);
+		this->fileData = NULL;
+	}
+	if (this->mappingHandle != NULL)
+	{
+		CloseHandle(this->mappingHandle);
+		this->mappingHandle = NULL;
+	}
+	if (this->fileHandle != NULL)
+	{
+		CloseHandle(this->fileHandle);
+		this->fileHandle = NULL;
+	}
+#else
+	if (this->fileData != NULL)
+	{
+		munmap((void*)this->fileData, this->fileSize);
+		this->fileData = NULL;
+	}
+#endif
+
+	this->frameOffsets = NULL;
+	this->fileSize = 0;
+	this->decodedFrames.clear();
+}
+
+const PointCacheHeader& PointCachePlayer::GetHeader() const
+{
+	return this->header;
+}
+
+int PointCachePlayer::GetNumMisses() const
+{
+	return this->numMisses;
+}
+
+void PointCachePlayer::DecodeFrame(int fi, std::vector<int>& state, int* stateFrame, float* result) const
+{
+	int key_frame = fi - fi % this->header.keyInterval;
+	int start_frame = key_frame;
+	if (*stateFrame >= key_frame && *stateFrame <= fi)
+		start_frame = *stateFrame + 1;
+
+	for (int f = start_frame; f <= fi; f++)
+	{
+		const unsigned char* ptr = this->fileData + this->frameOffsets[f];
+		const unsigned char* end = this->fileData + this->frameOffsets[f + 1];
+		int value;
+
+		if (f == key_frame)
+		{
+			for (int ci = 0; ci < state.size(); ci++)
+			{
+				ptr = ReadVarint(ptr, end, &value);
+				state[ci] = value;
+			}
+		}
+		else
+		{
+			for (int ci = 0; ci < state.size(); ci++)
+			{
+				ptr = ReadVarint(ptr, end, &value);
+				state[ci] += value;
+			}
+		}
+	}
+	*stateFrame = fi;
+
+	int num_position_values = this->header.numPositions * 3;
+	for (int ci = 0; ci < num_position_values; ci++)
+	{
+		result[ci] = state[ci] * this->header.positionStep;
+	}
+
+	float* normals = result + num_position_values;
+	const int* encoded_normals = state.data() + num_position_values;
+	for (int ni = 0; ni < this->header.numNormals; ni++)
+	{
+		short encoded[2] = { (short)encoded_normals[ni * 2], (short)encoded_normals[ni * 2 + 1] };
+		OctahedralDecode(encoded, &normals[ni * 3]);
+	}
+}
+
+bool PointCachePlayer::IsInWindow(int fi) const
+{
+	int num_frames = this->header.numFrames;
+	int window = std::min((int)this->decodedFrames.size(), num_frames);
+	return (fi - this->playhead + num_frames) % num_frames < window;
+}
+
+PointCachePlayer::DecodedFrame* PointCachePlayer::FindFrame(int fi)
+{
+	for (int di = 0; di < this->decodedFrames.size(); di++)
+	{
+		if (this->decodedFrames[di].frame == fi)
+			return &this->decodedFrames[di];
+	}
+	return NULL;
+}
+
+PointCachePlayer::DecodedFrame* PointCachePlayer::FindFreeFrame()
+{
+	//there are at least as many decoded frames as there are frames in the window, so if a frame of the window
+	//is missing one of the decoded frames has to be outside of it
+	for (int di = 0; di < this->decodedFrames.size(); di++)
+	{
+		if (this->decodedFrames[di].frame == -1 || !this->IsInWindow(this->decodedFrames[di].frame))
+			return &this->decodedFrames[di];
+	}
+	return NULL;
+}
+
+void PointCachePlayer::PrefetchLoop()
+{
+	std::vector<float> decoded(this->decodedFrames[0].data.size());
+
+	while (true)
+	{
+		int fi = -1;
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			cond.wait(lock, [&]
+			{
+				if (this->stopPrefetching)
+					return true;
+
+				//the first frame of the window, in playback order, that has not been decoded yet
+				int window = std::min((int)this->decodedFrames.size(), this->header.numFrames);
+				for (int wi = 0; wi < window; wi++)
+				{
+					int f = (this->playhead + wi) % this->header.numFrames;
+					if (this->FindFrame(f) == NULL)
+					{
+						fi = f;
+						return true;
+					}
+				}
+				return false;
+			});
+
+			if (this->stopPrefetching)
+				return;
+		}
+
+		this->DecodeFrame(fi, this->prefetchState, &this->prefetchStateFrame, decoded.data());
+
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			//meanwhile the playhead could have moved on or Sample could have decoded the frame itself
+			if (this->IsInWindow(fi) && this->FindFrame(fi) == NULL)
+			{
+				DecodedFrame* free_frame = this->FindFreeFrame();
+				free_frame->frame = fi;
+				free_frame->data.swap(decoded);
+			}
+		}
+	}
+}
+
+void PointCachePlayer::Sample(float frame, const float** positions, const float** normals)
+{
+	int num_frames = this->header.numFrames;
+	float cache_frame = 0.0f;
+	if (this->header.frameStep > 0.0f)
+		cache_frame = std::min(std::max((frame - this->header.firstFrame) / this->header.frameStep, 0.0f), (float)(num_frames - 1));
+
+	int f0 = (int)floor(cache_frame);
+	int f1 = std::min(f0 + 1, num_frames - 1);
+	float t = cache_frame - f0;
+
+	//The lock is only held to move the playhead and find (or claim) the two frames. Both of them are in the window
+	//from then on, which the prefetching thread never takes a frame from, and only Sample moves the playhead - so
+	//they are decoded and interpolated outside of the lock while the prefetching goes on.
+	DecodedFrame* frames[2];
+	bool missing[2] = { false, false };
+	int frame_indices[2] = { f0, f1 };
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->playhead = f0;
+
+		for (int i = 0; i < 2; i++)
+		{
+			frames[i] = this->FindFrame(frame_indices[i]);
+			if (frames[i] == NULL)
+			{
+				//claimed already, so the prefetching thread leaves the frame alone
+				frames[i] = this->FindFreeFrame();
+				frames[i]->frame = frame_indices[i];
+				missing[i] = true;
+				this->numMisses++;
+			}
+		}
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (missing[i])
+			this->DecodeFrame(frame_indices[i], this->sampleState, &this->sampleStateFrame, frames[i]->data.data());
+	}
+
+	const float* data0 = frames[0]->data.data();
+	const float* data1 = frames[1]->data.data();
+	for (int ci = 0; ci < this->positions.size(); ci++)
+	{
+		this->positions[ci] = data0[ci] + (data1[ci] - data0[ci]) * t;
+	}
+
+	data0 += this->positions.size();
+	data1 += this->positions.size();
+	for (int ni = 0; ni < this->normals.size() / 3; ni++)
+	{
+		float* normal = &this->normals[ni * 3];
+		for (int ci = 0; ci < 3; ci++)
+		{
+			normal[ci] = data0[ni * 3 + ci] + (data1[ni * 3 + ci] - data0[ni * 3 + ci]) * t;
+		}
+		NormalizeVector(normal, normal, 3);
+	}
+
+	this->cond.notify_one();
+
+	*positions = this->positions.data();
+	*normals = this->normals.data();
+}
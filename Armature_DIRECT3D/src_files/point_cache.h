@@ -0,0 +1,119 @@
+#pragma once
+
+//A point cache is a file with the deformed positions and normals of a single mesh at a sequence of frames
+//of the animation. It is written by the -bake_cache tool (see tools.h), so the meshes can be played back
+//without evaluating the armature or skinning them.
+//
+//The file starts with a PointCacheHeader, followed by numFrames + 1 file offsets (unsigned long long) - the offset
+//of every frame and the end of the last one - followed by the frames themselves. Frame fi shows the animation at
+//frame firstFrame + fi * frameStep.
+//
+//A frame stores the positions (3 values for every unique vertex, i.e. every vertex of Object3D::vList) followed by
+//the normals (2 values for every normal of Object3D::normalList). The positions are quantized to whole multiples
+//of positionStep and the normals are octahedral encoded (see OctahedralEncode). Every keyInterval-th frame is a key
+//frame that stores the values themselves, the frames in between store the differences to the previous frame.
+//Every value is written as a zigzag varint, so the small differences between neighbouring frames mostly take
+//a byte or two instead of the four of a float.
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct PointCacheHeader
+{
+	char magic[4];
+	int version;
+	int numFrames;
+	int numPositions;
+	int numNormals;
+	float firstFrame;
+	float frameStep;
+	float positionStep;
+	int keyInterval;
+};
+
+#define POINT_CACHE_MAGIC "PCCH"
+//3 - the positions in the order of Armature::AssignBoneIndicesToVertexGroups instead of the *.obj file
+#define POINT_CACHE_VERSION 3
+
+//quantization step of the positions - a hundredth of a millimetre for a model in metres
+#define POINT_CACHE_POSITION_STEP 0.00001f
+#define POINT_CACHE_KEY_INTERVAL 32
+
+//how many decoded frames the player keeps around - the frame being played and the ones right after it
+#define POINT_CACHE_PREFETCH_FRAMES 8
+
+class Armature;
+class Object3D;
+
+//Evaluates the armature at numFrames evenly spaced frames from firstFrame to lastFrame and writes the deformed
+//meshes[mi] to the point cache file filenames[mi]. The frames are computed by all the cores in parallel and
+//streamed to the files in order, with only a few frames in memory at a time.
+//Returns false if any of the files could not be created.
+bool BakePointCache(const Armature& armature, const std::vector<Object3D*>& meshes, const std::vector<const char*>& filenames,
+	float firstFrame, float lastFrame, int numFrames);
+
+
+//Plays back a point cache file. The file is memory mapped and a background thread decodes the frames
+//following the one being played, so by the time Sample needs a frame it is usually decoded already.
+class PointCachePlayer
+{
+public:
+	PointCachePlayer();
+	~PointCachePlayer();
+
+	//returns false if the file can't be opened or is not a point cache
+	bool Open(const char* filename);
+	void Close();
+
+	const PointCacheHeader& GetHeader() const;
+
+	//Interpolates the two cached frames around the given animation frame. The results are 3 floats for every
+	//position and every normal and stay valid until the next call. Frames outside of the cache are clamped to it.
+	void Sample(float frame, const float** positions, const float** normals);
+
+	//how many times Sample had to decode a frame itself because the prefetching thread did not make it in time
+	int GetNumMisses() const;
+
+private:
+	struct DecodedFrame
+	{
+		int frame = -1;
+		std::vector<float> data;
+	};
+
+	//decodes frame fi to floats, continuing from the quantized values of frame *stateFrame if it lies
+	//between the preceding key frame and fi
+	void DecodeFrame(int fi, std::vector<int>& state, int* stateFrame, float* result) const;
+	bool IsInWindow(int fi) const;
+	DecodedFrame* FindFrame(int fi);
+	DecodedFrame* FindFreeFrame();
+	void PrefetchLoop();
+
+	void* fileHandle = NULL;
+	void* mappingHandle = NULL;
+	const unsigned char* fileData = NULL;
+	size_t fileSize = 0;
+
+	PointCacheHeader header;
+	const unsigned long long* frameOffsets = NULL;
+
+	//the frames from playhead on (wrapping around to the first one) are the ones to have decoded
+	std::vector<DecodedFrame> decodedFrames;
+	int playhead = 0;
+	int numMisses = 0;
+	bool stopPrefetching = false;
+
+	std::thread prefetchThread;
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	std::vector<int> prefetchState;
+	int prefetchStateFrame = -1;
+	std::vector<int> sampleState;
+	int sampleStateFrame = -1;
+
+	std::vector<float> positions;
+	std::vector<float> normals;
+};
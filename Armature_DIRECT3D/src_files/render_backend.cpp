@@ -0,0 +1,191 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The parts of the rendering backend that don't depend on the graphics API - see render_backend.h.
+
+
+
+#include "render_backend.h"
+
+#include <string.h>
+
+
+
+void DynamicVertexRing::Create(RenderBackend* backendPtr, size_t sz)
+{
+	this->buffer = backendPtr->CreateBuffer(RENDER_BUFFER_VERTEX_DYNAMIC, NULL, sz);
+	this->size = sz;
+	this->position = sz;
+	this->generation++;
+}
+
+void DynamicVertexRing::Release()
+{
+	if (this->buffer != NULL)
+	{
+		this->buffer->Release();
+		this->buffer = NULL;
+	}
+}
+
+void* DynamicVertexRing::Allocate(RenderBackend* backendPtr, size_t sz, unsigned int* offset)
+{
+	if (sz > this->size)
+	{
+		size_t new_size = this->size * 2;
+		if (new_size < sz)
+			new_size = sz;
+
+		this->Release();
+		this->Create(backendPtr, new_size);
+	}
+
+	RenderMapType map_type = RENDER_MAP_WRITE_NO_OVERWRITE;
+	if (this->position + sz > this->size)
+	{
+		map_type = RENDER_MAP_WRITE_DISCARD;
+		this->position = 0;
+		this->generation++;
+	}
+
+	void* mapped = backendPtr->MapBuffer(this->buffer, map_type, this->position, sz);
+	if (mapped == NULL)
+		return NULL;
+
+	*offset = this->position;
+	this->position += sz;
+	return mapped;
+}
+
+void DynamicVertexRing::Unmap(RenderBackend* backendPtr)
+{
+	backendPtr->UnmapBuffer(this->buffer);
+}
+
+
+
+class NullRenderBuffer : public RenderBuffer
+{
+public:
+	std::vector<unsigned char> data;
+	size_t mappedOffset = 0;
+	size_t mappedSize = 0;
+
+	void Release()
+	{
+		delete this;
+	}
+};
+
+class NullRenderTexture : public RenderTexture
+{
+public:
+	void Release()
+	{
+		delete this;
+	}
+};
+
+void NullRenderBackend::ResetCommands()
+{
+	this->commands.clear();
+	this->bytesUploaded = 0;
+	this->uploadHash = 14695981039346656037ULL;
+}
+
+int NullRenderBackend::CountCommands(RenderCommandType type) const
+{
+	int count = 0;
+	for (int ci = 0; ci < this->commands.size(); ci++)
+	{
+		if (this->commands[ci].type == type)
+			count++;
+	}
+	return count;
+}
+
+void NullRenderBackend::Record(RenderCommandType type, size_t sz)
+{
+	RenderCommand command;
+	command.type = type;
+	command.size = sz;
+	this->commands.push_back(command);
+}
+
+void NullRenderBackend::HashUpload(const void* data, size_t sz)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t bi = 0; bi < sz; bi++)
+	{
+		this->uploadHash ^= bytes[bi];
+		this->uploadHash *= 1099511628211ULL;
+	}
+	this->bytesUploaded += sz;
+}
+
+RenderBuffer* NullRenderBackend::CreateBuffer(RenderBufferType type, const void* data, size_t sz)
+{
+	NullRenderBuffer* buffer = new NullRenderBuffer();
+	buffer->data.resize(sz, 0);
+	this->Record(RENDER_COMMAND_CREATE_BUFFER, sz);
+	if (data != NULL)
+	{
+		memcpy(buffer->data.data(), data, sz);
+		this->HashUpload(data, sz);
+	}
+	return buffer;
+}
+
+void NullRenderBackend::UpdateBuffer(RenderBuffer* buffer, const void* data, size_t sz)
+{
+	NullRenderBuffer* null_buffer = (NullRenderBuffer*)buffer;
+	memcpy(null_buffer->data.data(), data, sz);
+	this->Record(RENDER_COMMAND_UPDATE_BUFFER, sz);
+	this->HashUpload(data, sz);
+}
+
+void* NullRenderBackend::MapBuffer(RenderBuffer* buffer, RenderMapType type, size_t offset, size_t sz)
+{
+	NullRenderBuffer* null_buffer = (NullRenderBuffer*)buffer;
+	null_buffer->mappedOffset = offset;
+	null_buffer->mappedSize = sz;
+	this->Record(type == RENDER_MAP_WRITE_DISCARD ? RENDER_COMMAND_MAP_DISCARD : RENDER_COMMAND_MAP_NO_OVERWRITE, sz);
+	return null_buffer->data.data() + offset;
+}
+
+void NullRenderBackend::UnmapBuffer(RenderBuffer* buffer)
+{
+	//what has been written is known only now
+	NullRenderBuffer* null_buffer = (NullRenderBuffer*)buffer;
+	this->HashUpload(null_buffer->data.data() + null_buffer->mappedOffset, null_buffer->mappedSize);
+}
+
+RenderTexture* NullRenderBackend::LoadTexture(const wchar_t* fname)
+{
+	this->Record(RENDER_COMMAND_LOAD_TEXTURE, 0);
+	return new NullRenderTexture();
+}
+
+void NullRenderBackend::SetVertexBuffers(int numBuffers, RenderBuffer* const* buffers, const unsigned int* strides, const unsigned int* offsets)
+{
+	this->Record(RENDER_COMMAND_SET_VERTEX_BUFFERS, 0);
+}
+
+void NullRenderBackend::SetIndexBuffer(RenderBuffer* buffer)
+{
+	this->Record(RENDER_COMMAND_SET_INDEX_BUFFER, 0);
+}
+
+void NullRenderBackend::SetVertexConstantBuffer(int slot, RenderBuffer* buffer)
+{
+	this->Record(RENDER_COMMAND_SET_CONSTANT_BUFFER, 0);
+}
+
+void NullRenderBackend::SetPixelTexture(int slot, RenderTexture* texture)
+{
+	this->Record(RENDER_COMMAND_SET_TEXTURE, 0);
+}
+
+void NullRenderBackend::DrawIndexed(int numIndices)
+{
+	this->Record(RENDER_COMMAND_DRAW_INDEXED, numIndices);
+}
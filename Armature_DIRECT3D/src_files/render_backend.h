@@ -0,0 +1,158 @@
+#pragma once
+
+//The graphics API the meshes are drawn with, kept behind a thin interface so that the scene can be loaded, animated
+//and drawn without Direct3D - D3D11RenderBackend (render_backend_d3d11.h) draws it, NullRenderBackend only records
+//what would have been drawn. The pipeline state (shaders, input layouts, blending and rasterizer states) is set by
+//the application itself.
+
+#include <stddef.h>
+#include <vector>
+
+//The buffers and textures are released like COM objects, by themselves.
+class RenderBuffer
+{
+public:
+	virtual void Release() = 0;
+
+protected:
+	virtual ~RenderBuffer() {}
+};
+
+class RenderTexture
+{
+public:
+	virtual void Release() = 0;
+
+protected:
+	virtual ~RenderTexture() {}
+};
+
+enum RenderBufferType
+{
+	//vertex buffers written once at creation
+	RENDER_BUFFER_VERTEX,
+	//vertex buffers the CPU writes to by mapping them (see DynamicVertexRing)
+	RENDER_BUFFER_VERTEX_DYNAMIC,
+	//32 bit indices
+	RENDER_BUFFER_INDEX,
+	//constants of the vertex shader, rewritten whole by UpdateBuffer
+	RENDER_BUFFER_CONSTANT
+};
+
+enum RenderMapType
+{
+	//the previous contents are thrown away - the GPU may still be reading them from the old memory
+	RENDER_MAP_WRITE_DISCARD,
+	//the range written doesn't overlap anything the GPU may still be reading
+	RENDER_MAP_WRITE_NO_OVERWRITE
+};
+
+class RenderBackend
+{
+public:
+	virtual ~RenderBackend() {}
+
+	//data may be NULL for the dynamic and the constant buffers
+	virtual RenderBuffer* CreateBuffer(RenderBufferType type, const void* data, size_t sz) = 0;
+
+	virtual void UpdateBuffer(RenderBuffer* buffer, const void* data, size_t sz) = 0;
+
+	//Maps a dynamic buffer and returns its range [offset, offset + sz) for writing.
+	virtual void* MapBuffer(RenderBuffer* buffer, RenderMapType type, size_t offset, size_t sz) = 0;
+
+	virtual void UnmapBuffer(RenderBuffer* buffer) = 0;
+
+	//NULL if the texture can't be loaded
+	virtual RenderTexture* LoadTexture(const wchar_t* fname) = 0;
+
+	virtual void SetVertexBuffers(int numBuffers, RenderBuffer* const* buffers, const unsigned int* strides, const unsigned int* offsets) = 0;
+
+	virtual void SetIndexBuffer(RenderBuffer* buffer) = 0;
+
+	virtual void SetVertexConstantBuffer(int slot, RenderBuffer* buffer) = 0;
+
+	virtual void SetPixelTexture(int slot, RenderTexture* texture) = 0;
+
+	virtual void DrawIndexed(int numIndices) = 0;
+};
+
+
+//A dynamic vertex buffer the changed meshes are copied into before they are drawn. The space is handed out front to back,
+//mapped with RENDER_MAP_WRITE_NO_OVERWRITE - the GPU may still be reading what was written before it, so the driver
+//neither copies nor waits. Once the buffer is full it starts over with RENDER_MAP_WRITE_DISCARD, which gets it fresh
+//memory and makes everything written so far invalid.
+class DynamicVertexRing
+{
+public:
+	RenderBuffer* buffer = NULL;
+	//incremented every time the buffer starts over - space allocated in an earlier generation can't be drawn from anymore
+	int generation = 0;
+
+	void Create(RenderBackend* backendPtr, size_t sz);
+
+	void Release();
+
+	//Maps sz bytes of the buffer and returns them for writing, their offset in the buffer goes to offset.
+	//The space has to be unmapped before it is drawn from. A buffer smaller than sz is made bigger.
+	void* Allocate(RenderBackend* backendPtr, size_t sz, unsigned int* offset);
+
+	void Unmap(RenderBackend* backendPtr);
+
+private:
+	size_t size = 0;
+	size_t position = 0;
+};
+
+
+enum RenderCommandType
+{
+	RENDER_COMMAND_CREATE_BUFFER,
+	RENDER_COMMAND_UPDATE_BUFFER,
+	RENDER_COMMAND_MAP_DISCARD,
+	RENDER_COMMAND_MAP_NO_OVERWRITE,
+	RENDER_COMMAND_LOAD_TEXTURE,
+	RENDER_COMMAND_SET_VERTEX_BUFFERS,
+	RENDER_COMMAND_SET_INDEX_BUFFER,
+	RENDER_COMMAND_SET_CONSTANT_BUFFER,
+	RENDER_COMMAND_SET_TEXTURE,
+	RENDER_COMMAND_DRAW_INDEXED
+};
+
+//size is the number of bytes written for the buffer commands and the number of indices for the draws
+struct RenderCommand
+{
+	RenderCommandType type;
+	size_t size;
+};
+
+//Draws nothing - every command is recorded in commands, with the bytes sent to the buffers summed up in
+//bytesUploaded and hashed (FNV-1a) in uploadHash, so whole frames can be measured and compared without a GPU.
+//The buffers keep their contents in memory, so mapping them works as usual.
+class NullRenderBackend : public RenderBackend
+{
+public:
+	std::vector<RenderCommand> commands;
+	size_t bytesUploaded = 0;
+	unsigned long long uploadHash = 14695981039346656037ULL;
+
+	//clears the commands and the counters, e.g. at the start of every frame
+	void ResetCommands();
+
+	//the number of the recorded commands of the given type
+	int CountCommands(RenderCommandType type) const;
+
+	RenderBuffer* CreateBuffer(RenderBufferType type, const void* data, size_t sz);
+	void UpdateBuffer(RenderBuffer* buffer, const void* data, size_t sz);
+	void* MapBuffer(RenderBuffer* buffer, RenderMapType type, size_t offset, size_t sz);
+	void UnmapBuffer(RenderBuffer* buffer);
+	RenderTexture* LoadTexture(const wchar_t* fname);
+	void SetVertexBuffers(int numBuffers, RenderBuffer* const* buffers, const unsigned int* strides, const unsigned int* offsets);
+	void SetIndexBuffer(RenderBuffer* buffer);
+	void SetVertexConstantBuffer(int slot, RenderBuffer* buffer);
+	void SetPixelTexture(int slot, RenderTexture* texture);
+	void DrawIndexed(int numIndices);
+
+private:
+	void Record(RenderCommandType type, size_t sz);
+	void HashUpload(const void* data, size_t sz);
+};
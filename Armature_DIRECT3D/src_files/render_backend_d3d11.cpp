@@ -0,0 +1,128 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The Direct3D 11 rendering backend - see render_backend.h.
+
+
+
+#include "d3d_wrappers.h"
+#include "render_backend_d3d11.h"
+
+
+
+class D3D11RenderBuffer : public RenderBuffer
+{
+public:
+	ID3D11Buffer* buffer = NULL;
+
+	void Release()
+	{
+		if (this->buffer != NULL)
+			this->buffer->Release();
+		delete this;
+	}
+};
+
+class D3D11RenderTexture : public RenderTexture
+{
+public:
+	ID3D11ShaderResourceView* view = NULL;
+
+	void Release()
+	{
+		if (this->view != NULL)
+			this->view->Release();
+		delete this;
+	}
+};
+
+D3D11RenderBackend::D3D11RenderBackend(ID3D11Device* devicePtr, ID3D11DeviceContext* devConPtr)
+{
+	this->device = devicePtr;
+	this->devCon = devConPtr;
+}
+
+RenderBuffer* D3D11RenderBackend::CreateBuffer(RenderBufferType type, const void* data, size_t sz)
+{
+	D3D11RenderBuffer* buffer = new D3D11RenderBuffer();
+	switch (type)
+	{
+	case RENDER_BUFFER_VERTEX:
+		buffer->buffer = CreateImmutableVertexBuffer(this->device, (unsigned char*)data, sz);
+		break;
+	case RENDER_BUFFER_VERTEX_DYNAMIC:
+		buffer->buffer = CreateDynamicVertexBuffer(this->device, sz);
+		break;
+	case RENDER_BUFFER_INDEX:
+		buffer->buffer = CreateIndexBuffer(this->device, (unsigned char*)data, sz);
+		break;
+	case RENDER_BUFFER_CONSTANT:
+		buffer->buffer = CreateConstantBuffer(this->device, (unsigned char*)data, sz);
+		break;
+	}
+	return buffer;
+}
+
+void D3D11RenderBackend::UpdateBuffer(RenderBuffer* buffer, const void* data, size_t sz)
+{
+	this->devCon->UpdateSubresource(((D3D11RenderBuffer*)buffer)->buffer, 0, NULL, data, 0, 0);
+}
+
+void* D3D11RenderBackend::MapBuffer(RenderBuffer* buffer, RenderMapType type, size_t offset, size_t sz)
+{
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	D3D11_MAP map_type = type == RENDER_MAP_WRITE_DISCARD ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+	HRESULT hr = this->devCon->Map(((D3D11RenderBuffer*)buffer)->buffer, 0, map_type, 0, &mapped);
+	if (FAILED(hr))
+		return NULL;
+
+	return (unsigned char*)mapped.pData + offset;
+}
+
+void D3D11RenderBackend::UnmapBuffer(RenderBuffer* buffer)
+{
+	this->devCon->Unmap(((D3D11RenderBuffer*)buffer)->buffer, 0);
+}
+
+RenderTexture* D3D11RenderBackend::LoadTexture(const wchar_t* fname)
+{
+	D3D11RenderTexture* texture = new D3D11RenderTexture();
+	HRESULT hr = DirectX::CreateWICTextureFromFileEx(this->device, this->devCon, fname, 0, D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0, DirectX::WIC_LOADER_IGNORE_SRGB,
+		(ID3D11Resource**)NULL, &texture->view);
+	if (FAILED(hr))
+	{
+		texture->Release();
+		return NULL;
+	}
+	return texture;
+}
+
+void D3D11RenderBackend::SetVertexBuffers(int numBuffers, RenderBuffer* const* buffers, const unsigned int* strides, const unsigned int* offsets)
+{
+	ID3D11Buffer* d3d_buffers[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	for (int bi = 0; bi < numBuffers; bi++)
+	{
+		d3d_buffers[bi] = ((D3D11RenderBuffer*)buffers[bi])->buffer;
+	}
+	this->devCon->IASetVertexBuffers(0, numBuffers, d3d_buffers, strides, offsets);
+}
+
+void D3D11RenderBackend::SetIndexBuffer(RenderBuffer* buffer)
+{
+	this->devCon->IASetIndexBuffer(((D3D11RenderBuffer*)buffer)->buffer, DXGI_FORMAT_R32_UINT, 0);
+}
+
+void D3D11RenderBackend::SetVertexConstantBuffer(int slot, RenderBuffer* buffer)
+{
+	this->devCon->VSSetConstantBuffers(slot, 1, &((D3D11RenderBuffer*)buffer)->buffer);
+}
+
+void D3D11RenderBackend::SetPixelTexture(int slot, RenderTexture* texture)
+{
+	ID3D11ShaderResourceView* view = texture != NULL ? ((D3D11RenderTexture*)texture)->view : NULL;
+	this->devCon->PSSetShaderResources(slot, 1, &view);
+}
+
+void D3D11RenderBackend::DrawIndexed(int numIndices)
+{
+	this->devCon->DrawIndexed(numIndices, 0, 0);
+}
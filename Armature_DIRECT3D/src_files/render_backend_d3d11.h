@@ -0,0 +1,27 @@
+#pragma once
+
+#include <d3d11.h>
+
+#include "render_backend.h"
+
+//The backend drawing with Direct3D 11 on the given device and its immediate context (see render_backend.h).
+class D3D11RenderBackend : public RenderBackend
+{
+public:
+	D3D11RenderBackend(ID3D11Device* devicePtr, ID3D11DeviceContext* devConPtr);
+
+	RenderBuffer* CreateBuffer(RenderBufferType type, const void* data, size_t sz);
+	void UpdateBuffer(RenderBuffer* buffer, const void* data, size_t sz);
+	void* MapBuffer(RenderBuffer* buffer, RenderMapType type, size_t offset, size_t sz);
+	void UnmapBuffer(RenderBuffer* buffer);
+	RenderTexture* LoadTexture(const wchar_t* fname);
+	void SetVertexBuffers(int numBuffers, RenderBuffer* const* buffers, const unsigned int* strides, const unsigned int* offsets);
+	void SetIndexBuffer(RenderBuffer* buffer);
+	void SetVertexConstantBuffer(int slot, RenderBuffer* buffer);
+	void SetPixelTexture(int slot, RenderTexture* texture);
+	void DrawIndexed(int numIndices);
+
+private:
+	ID3D11Device* device;
+	ID3D11DeviceContext* devCon;
+};
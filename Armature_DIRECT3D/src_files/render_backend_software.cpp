@@ -0,0 +1,803 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The rendering backend drawing on the CPU - see render_backend_software.h.
+
+
+
+#include "render_backend_software.h"
+#include "3D_lib.h"
+#include "png_reader.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <ctype.h>
+
+
+
+class SoftwareRenderBuffer : public RenderBuffer
+{
+public:
+	std::vector<unsigned char> data;
+
+	void Release()
+	{
+		delete this;
+	}
+};
+
+class SoftwareRenderTexture : public RenderTexture
+{
+public:
+	int width = 0;
+	int height = 0;
+	//RGBA, the top row first
+	std::vector<unsigned char> pixels;
+
+	void Release()
+	{
+		delete this;
+	}
+};
+
+static float Saturate(float x)
+{
+	//NaN goes to 0 too
+	return x > 0.0f ? (x < 1.0f ? x : 1.0f) : 0.0f;
+}
+
+//ObjSamplerState of main.cpp - bilinear, clamped to the edges
+static void SampleTexture(const SoftwareRenderTexture* texture, float u, float v, float* result)
+{
+	float x = u * texture->width - 0.5f;
+	float y = v * texture->height - 0.5f;
+	float x_floor = floorf(x);
+	float y_floor = floorf(y);
+	float fx = x - x_floor;
+	float fy = y - y_floor;
+
+	int x0 = std::min(std::max((int)x_floor, 0), texture->width - 1);
+	int x1 = std::min(std::max((int)x_floor + 1, 0), texture->width - 1);
+	int y0 = std::min(std::max((int)y_floor, 0), texture->height - 1);
+	int y1 = std::min(std::max((int)y_floor + 1, 0), texture->height - 1);
+
+	const unsigned char* p00 = &texture->pixels[(y0 * texture->width + x0) * 4];
+	const unsigned char* p10 = &texture->pixels[(y0 * texture->width + x1) * 4];
+	const unsigned char* p01 = &texture->pixels[(y1 * texture->width + x0) * 4];
+	const unsigned char* p11 = &texture->pixels[(y1 * texture->width + x1) * 4];
+	for (int c = 0; c < 4; c++)
+	{
+		float top = p00[c] + (p10[c] - p00[c]) * fx;
+		float bottom = p01[c] + (p11[c] - p01[c]) * fx;
+		result[c] = (top + (bottom - top) * fy) / 255.0f;
+	}
+}
+
+//uncompressed (2) and RLE (10) true colour images of 24 or 32 bits
+static bool LoadTGA(FILE* f, SoftwareRenderTexture* texture)
+{
+	unsigned char header[18];
+	if (fread(header, 1, 18, f) != 18)
+		return false;
+
+	int image_type = header[2];
+	int bits = header[16];
+	if (header[1] != 0 || (image_type != 2 && image_type != 10) || (bits != 24 && bits != 32))
+		return false;
+
+	texture->width = header[12] | (header[13] << 8);
+	texture->height = header[14] | (header[15] << 8);
+	bool top_first = (header[17] & 0x20) != 0;
+	fseek(f, header[0], SEEK_CUR);
+
+	int bytes = bits / 8;
+	int num_pixels = texture->width * texture->height;
+	std::vector<unsigned char> data(num_pixels * bytes);
+	if (image_type == 2)
+	{
+		if (fread(data.data(), 1, data.size(), f) != data.size())
+			return false;
+	}
+	else
+	{
+		int pi = 0;
+		while (pi < num_pixels)
+		{
+			int packet = fgetc(f);
+			if (packet == EOF)
+				return false;
+
+			int count = std::min((packet & 0x7f) + 1, num_pixels - pi);
+			if (packet & 0x80)
+			{
+				unsigned char pixel[4];
+				if (fread(pixel, 1, bytes, f) != bytes)
+					return false;
+				for (int ri = 0; ri < count; ri++)
+					memcpy(&data[(pi + ri) * bytes], pixel, bytes);
+			}
+			else if (fread(&data[pi * bytes], 1, count * bytes, f) != count * bytes)
+			{
+				return false;
+			}
+			pi += count;
+		}
+	}
+
+	texture->pixels.resize(num_pixels * 4);
+	for (int y = 0; y < texture->height; y++)
+	{
+		int src_y = top_first ? y : texture->height - 1 - y;
+		for (int x = 0; x < texture->width; x++)
+		{
+			const unsigned char* src = &data[(src_y * texture->width + x) * bytes];
+			unsigned char* dst = &texture->pixels[(y * texture->width + x) * 4];
+			dst[0] = src[2];
+			dst[1] = src[1];
+			dst[2] = src[0];
+			dst[3] = bytes == 4 ? src[3] : 255;
+		}
+	}
+	return true;
+}
+
+//skips the whitespace and the comments between the values of the header
+static void SkipPPMSpace(FILE* f)
+{
+	int c = fgetc(f);
+	while (c == '#' || isspace(c))
+	{
+		if (c == '#')
+		{
+			while (c != '\n' && c != EOF)
+				c = fgetc(f);
+		}
+		c = fgetc(f);
+	}
+	ungetc(c, f);
+}
+
+//binary (P6) images of 8 bits per channel
+static bool LoadPPM(FILE* f, SoftwareRenderTexture* texture)
+{
+	char magic[2];
+	if (fread(magic, 1, 2, f) != 2 || magic[0] != 'P' || magic[1] != '6')
+		return false;
+
+	int max_value;
+	SkipPPMSpace(f);
+	if (fscanf(f, "%d", &texture->width) != 1)
+		return false;
+	SkipPPMSpace(f);
+	if (fscanf(f, "%d", &texture->height) != 1)
+		return false;
+	SkipPPMSpace(f);
+	if (fscanf(f, "%d", &max_value) != 1 || max_value != 255)
+		return false;
+	fgetc(f);
+
+	int num_pixels = texture->width * texture->height;
+	std::vector<unsigned char> data(num_pixels * 3);
+	if (fread(data.data(), 1, data.size(), f) != data.size())
+		return false;
+
+	texture->pixels.resize(num_pixels * 4);
+	for (int pi = 0; pi < num_pixels; pi++)
+	{
+		memcpy(&texture->pixels[pi * 4], &data[pi * 3], 3);
+		texture->pixels[pi * 4 + 3] = 255;
+	}
+	return true;
+}
+
+//true if the file name ends with ext, whatever the case
+static bool HasExtension(const char* filename, const char* ext)
+{
+	size_t len = strlen(filename);
+	size_t ext_len = strlen(ext);
+	if (len < ext_len)
+		return false;
+
+	for (size_t ci = 0; ci < ext_len; ci++)
+	{
+		if (tolower(filename[len - ext_len + ci]) != ext[ci])
+			return false;
+	}
+	return true;
+}
+
+
+
+SoftwareRenderBackend::SoftwareRenderBackend(int width, int height, int numThreads)
+{
+	this->width = width;
+	this->height = height;
+	this->numTilesX = (width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+	this->numTilesY = (height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+	this->pixels.resize(width * height * 4, 0);
+	this->depth.resize(width * height, 1.0f);
+	this->tileBins.resize(this->numTilesX * this->numTilesY);
+	this->nextTile = 0;
+
+	memset(this->state.wvp, 0, sizeof(this->state.wvp));
+	memset(this->state.world, 0, sizeof(this->state.world));
+	for (int i = 0; i < 4; i++)
+	{
+		this->state.wvp[i * 4 + i] = 1.0f;
+		this->state.world[i * 4 + i] = 1.0f;
+	}
+	memset(this->state.lights, 0, sizeof(this->state.lights));
+
+	if (numThreads <= 0)
+		numThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+
+	//the thread calling Flush rasterizes too
+	for (int ti = 0; ti < numThreads - 1; ti++)
+	{
+		this->workers.push_back(std::thread(&SoftwareRenderBackend::WorkerLoop, this));
+	}
+}
+
+SoftwareRenderBackend::~SoftwareRenderBackend()
+{
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->stopWorkers = true;
+	}
+	this->cond.notify_all();
+	for (int ti = 0; ti < this->workers.size(); ti++)
+	{
+		this->workers[ti].join();
+	}
+}
+
+void SoftwareRenderBackend::Clear(const float* color)
+{
+	unsigned char rgba[4];
+	for (int c = 0; c < 3; c++)
+		rgba[c] = (unsigned char)lroundf(Saturate(color[c]) * 255.0f);
+	rgba[3] = 255;
+
+	for (int pi = 0; pi < this->width * this->height; pi++)
+	{
+		memcpy(&this->pixels[pi * 4], rgba, 4);
+	}
+	std::fill(this->depth.begin(), this->depth.end(), 1.0f);
+
+	this->triangles.clear();
+	this->draws.clear();
+	for (int ti = 0; ti < this->tileBins.size(); ti++)
+	{
+		this->tileBins[ti].clear();
+	}
+}
+
+void SoftwareRenderBackend::Flush()
+{
+	if (this->workers.empty())
+	{
+		this->RasterizeTiles();
+	}
+	else
+	{
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->nextTile = 0;
+			this->numWorkersDone = 0;
+			this->flushIndex++;
+		}
+		this->cond.notify_all();
+
+		this->RasterizeTiles();
+
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->doneCond.wait(lock, [&] { return this->numWorkersDone == this->workers.size(); });
+	}
+
+	this->nextTile = 0;
+	this->triangles.clear();
+	this->draws.clear();
+	for (int ti = 0; ti < this->tileBins.size(); ti++)
+	{
+		this->tileBins[ti].clear();
+	}
+}
+
+const unsigned char* SoftwareRenderBackend::GetPixels() const
+{
+	return this->pixels.data();
+}
+
+int SoftwareRenderBackend::GetWidth() const
+{
+	return this->width;
+}
+
+int SoftwareRenderBackend::GetHeight() const
+{
+	return this->height;
+}
+
+int SoftwareRenderBackend::GetNumTriangles() const
+{
+	return this->triangles.size();
+}
+
+bool SoftwareRenderBackend::WriteImage(const char* filename) const
+{
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+		return false;
+
+	int num_pixels = this->width * this->height;
+	if (HasExtension(filename, ".tga"))
+	{
+		//uncompressed, 32 bits, the top row first
+		unsigned char header[18] = {};
+		header[2] = 2;
+		header[12] = this->width & 0xff;
+		header[13] = this->width >> 8;
+		header[14] = this->height & 0xff;
+		header[15] = this->height >> 8;
+		header[16] = 32;
+		header[17] = 0x28;
+		fwrite(header, 1, 18, f);
+
+		std::vector<unsigned char> data(num_pixels * 4);
+		for (int pi = 0; pi < num_pixels; pi++)
+		{
+			data[pi * 4 + 0] = this->pixels[pi * 4 + 2];
+			data[pi * 4 + 1] = this->pixels[pi * 4 + 1];
+			data[pi * 4 + 2] = this->pixels[pi * 4 + 0];
+			data[pi * 4 + 3] = this->pixels[pi * 4 + 3];
+		}
+		fwrite(data.data(), 1, data.size(), f);
+	}
+	else
+	{
+		fprintf(f, "P6\n%d %d\n255\n", this->width, this->height);
+
+		std::vector<unsigned char> data(num_pixels * 3);
+		for (int pi = 0; pi < num_pixels; pi++)
+		{
+			memcpy(&data[pi * 3], &this->pixels[pi * 4], 3);
+		}
+		fwrite(data.data(), 1, data.size(), f);
+	}
+
+	bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
+RenderBuffer* SoftwareRenderBackend::CreateBuffer(RenderBufferType type, const void* data, size_t sz)
+{
+	SoftwareRenderBuffer* buffer = new SoftwareRenderBuffer();
+	buffer->data.resize(sz, 0);
+	if (data != NULL)
+		memcpy(buffer->data.data(), data, sz);
+	return buffer;
+}
+
+void SoftwareRenderBackend::UpdateBuffer(RenderBuffer* buffer, const void* data, size_t sz)
+{
+	memcpy(((SoftwareRenderBuffer*)buffer)->data.data(), data, sz);
+}
+
+void* SoftwareRenderBackend::MapBuffer(RenderBuffer* buffer, RenderMapType type, size_t offset, size_t sz)
+{
+	//the draws have read their vertices by the time they return, so nothing drawn can be overwritten
+	return ((SoftwareRenderBuffer*)buffer)->data.data() + offset;
+}
+
+void SoftwareRenderBackend::UnmapBuffer(RenderBuffer* buffer)
+{
+}
+
+RenderTexture* SoftwareRenderBackend::LoadTexture(const wchar_t* fname)
+{
+	char filename[1024];
+	if (wcstombs(filename, fname, sizeof(filename)) >= sizeof(filename))
+		return NULL;
+
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+		return NULL;
+
+	SoftwareRenderTexture* texture = new SoftwareRenderTexture();
+	bool loaded = false;
+	if (HasExtension(filename, ".tga"))
+		loaded = LoadTGA(f, texture);
+	else if (HasExtension(filename, ".ppm"))
+		loaded = LoadPPM(f, texture);
+	else if (HasExtension(filename, ".png"))
+		loaded = ReadPNG(f, &texture->width, &texture->height, &texture->pixels);
+	fclose(f);
+
+	if (!loaded || texture->width == 0 || texture->height == 0)
+	{
+		texture->Release();
+		return NULL;
+	}
+	return texture;
+}
+
+void SoftwareRenderBackend::SetVertexBuffers(int numBuffers, RenderBuffer* const* buffers, const unsigned int* strides, const unsigned int* offsets)
+{
+	for (int bi = 0; bi < 2; bi++)
+	{
+		this->vertexBuffers[bi] = bi < numBuffers ? buffers[bi] : NULL;
+		this->vertexStrides[bi] = bi < numBuffers ? strides[bi] : 0;
+		this->vertexOffsets[bi] = bi < numBuffers ? offsets[bi] : 0;
+	}
+}
+
+void SoftwareRenderBackend::SetIndexBuffer(RenderBuffer* buffer)
+{
+	this->indexBuffer = buffer;
+}
+
+void SoftwareRenderBackend::SetVertexConstantBuffer(int slot, RenderBuffer* buffer)
+{
+	//the transforms (b0) come from state
+	if (slot == 1)
+		this->decodeBuffer = buffer;
+}
+
+void SoftwareRenderBackend::SetPixelTexture(int slot, RenderTexture* texture)
+{
+	if (slot == 0)
+		this->texture = texture;
+}
+
+void SoftwareRenderBackend::DrawIndexed(int numIndices)
+{
+	if (this->indexBuffer == NULL || this->vertexBuffers[0] == NULL)
+		return;
+
+	const int* indices = (const int*)((SoftwareRenderBuffer*)this->indexBuffer)->data.data();
+	int num_vertices = 0;
+	for (int ii = 0; ii < numIndices; ii++)
+	{
+		num_vertices = std::max(num_vertices, indices[ii] + 1);
+	}
+
+	VertexDecode decode;
+	memset(&decode, 0, sizeof(VertexDecode));
+	if (this->decodeBuffer != NULL)
+	{
+		memcpy(&decode, ((SoftwareRenderBuffer*)this->decodeBuffer)->data.data(), sizeof(VertexDecode));
+	}
+	else
+	{
+		for (int c = 0; c < 3; c++)
+			decode.posScale[c] = 1.0f;
+		decode.texCoordScale[0] = 1.0f;
+		decode.texCoordScale[1] = 1.0f;
+	}
+
+	//the vertex shader - the strides tell which of the input layouts of main.cpp the vertices are in
+	const unsigned char* vertex_data = ((SoftwareRenderBuffer*)this->vertexBuffers[0])->data.data() + this->vertexOffsets[0];
+	const unsigned char* tex_coord_data = NULL;
+	if (this->vertexBuffers[1] != NULL)
+		tex_coord_data = ((SoftwareRenderBuffer*)this->vertexBuffers[1])->data.data() + this->vertexOffsets[1];
+
+	bool packed = this->vertexStrides[0] == sizeof(PackedVertex);
+	this->shadedVertices.resize(num_vertices);
+	for (int vi = 0; vi < num_vertices; vi++)
+	{
+		float pos[4];
+		float normal[3];
+		float tex_coord[2] = { 0.0f, 0.0f };
+
+		const unsigned char* vertex = vertex_data + vi * this->vertexStrides[0];
+		if (packed)
+		{
+			const PackedVertex* packed_vertex = (const PackedVertex*)vertex;
+			for (int c = 0; c < 3; c++)
+				pos[c] = std::max(packed_vertex->pos[c] / 32767.0f, -1.0f);
+			OctahedralDecode(packed_vertex->normal, normal);
+		}
+		else
+		{
+			const Vertex* float_vertex = (const Vertex*)vertex;
+			memcpy(pos, &float_vertex->pos.x, sizeof(float) * 3);
+			memcpy(normal, &float_vertex->normal.x, sizeof(float) * 3);
+		}
+		for (int c = 0; c < 3; c++)
+			pos[c] = pos[c] * decode.posScale[c] + decode.posOffset[c];
+		pos[3] = 1.0f;
+
+		if (tex_coord_data != NULL)
+		{
+			const unsigned char* tex_coord_src = tex_coord_data + vi * this->vertexStrides[1];
+			if (this->vertexStrides[1] == sizeof(unsigned short) * 2)
+			{
+				const unsigned short* unorm = (const unsigned short*)tex_coord_src;
+				tex_coord[0] = unorm[0] / 65535.0f;
+				tex_coord[1] = unorm[1] / 65535.0f;
+			}
+			else
+			{
+				memcpy(tex_coord, tex_coord_src, sizeof(float) * 2);
+			}
+		}
+
+		ShadedVertex& shaded = this->shadedVertices[vi];
+		for (int j = 0; j < 4; j++)
+		{
+			shaded.pos[j] = 0.0f;
+			for (int i = 0; i < 4; i++)
+				shaded.pos[j] += pos[i] * this->state.wvp[i * 4 + j];
+		}
+		for (int j = 0; j < 3; j++)
+		{
+			shaded.normal[j] = 0.0f;
+			for (int i = 0; i < 3; i++)
+				shaded.normal[j] += normal[i] * this->state.world[i * 4 + j];
+		}
+		for (int c = 0; c < 2; c++)
+			shaded.texCoord[c] = tex_coord[c] * decode.texCoordScale[c] + decode.texCoordOffset[c];
+	}
+
+	DrawState draw;
+	memcpy(draw.lights, this->state.lights, sizeof(draw.lights));
+	draw.textured = this->state.textured;
+	draw.alphaBlending = this->state.alphaBlending;
+	draw.texture = this->texture;
+	this->draws.push_back(draw);
+	int draw_index = this->draws.size() - 1;
+
+	const int num_floats = sizeof(ShadedVertex) / sizeof(float);
+	for (int ii = 0; ii + 2 < numIndices; ii += 3)
+	{
+		const ShadedVertex* v[3] = { &this->shadedVertices[indices[ii]], &this->shadedVertices[indices[ii + 1]],
+			&this->shadedVertices[indices[ii + 2]] };
+
+		//only the near plane (z >= 0) is clipped, the triangles going off the sides are clamped to the screen when binned
+		//and the ones behind the far plane are dropped by the depth test
+		int num_inside = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			if (v[k]->pos[2] >= 0.0f)
+				num_inside++;
+		}
+
+		if (num_inside == 3)
+		{
+			this->SetupTriangle(v[0], v[1], v[2], draw_index);
+		}
+		else if (num_inside > 0)
+		{
+			ShadedVertex clipped[4];
+			int num_clipped = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				const ShadedVertex* a = v[k];
+				const ShadedVertex* b = v[(k + 1) % 3];
+				if (a->pos[2] >= 0.0f)
+					clipped[num_clipped++] = *a;
+
+				if ((a->pos[2] >= 0.0f) != (b->pos[2] >= 0.0f))
+				{
+					float t = a->pos[2] / (a->pos[2] - b->pos[2]);
+					const float* a_floats = (const float*)a;
+					const float* b_floats = (const float*)b;
+					float* result = (float*)&clipped[num_clipped++];
+					for (int fi = 0; fi < num_floats; fi++)
+						result[fi] = a_floats[fi] + (b_floats[fi] - a_floats[fi]) * t;
+				}
+			}
+
+			for (int k = 1; k + 1 < num_clipped; k++)
+			{
+				this->SetupTriangle(&clipped[0], &clipped[k], &clipped[k + 1], draw_index);
+			}
+		}
+	}
+}
+
+void SoftwareRenderBackend::SetupTriangle(const ShadedVertex* v0, const ShadedVertex* v1, const ShadedVertex* v2, int drawIndex)
+{
+	const ShadedVertex* v[3] = { v0, v1, v2 };
+
+	BinnedTriangle tri;
+	for (int k = 0; k < 3; k++)
+	{
+		float inv_w = 1.0f / v[k]->pos[3];
+		tri.x[k] = (v[k]->pos[0] * inv_w * 0.5f + 0.5f) * this->width;
+		tri.y[k] = (0.5f - v[k]->pos[1] * inv_w * 0.5f) * this->height;
+		tri.z[k] = v[k]->pos[2] * inv_w;
+		tri.invW[k] = inv_w;
+		tri.attributes[k][0] = v[k]->texCoord[0] * inv_w;
+		tri.attributes[k][1] = v[k]->texCoord[1] * inv_w;
+		for (int c = 0; c < 3; c++)
+			tri.attributes[k][2 + c] = v[k]->normal[c] * inv_w;
+	}
+
+	//positive for the front faces - clockwise on the screen, whose y axis points down
+	float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+	if (area == 0.0f || (area < 0.0f && this->state.cullBack))
+		return;
+
+	//the back faces that are drawn are turned around, so the rasterizer only ever sees clockwise triangles
+	if (area < 0.0f)
+	{
+		std::swap(tri.x[1], tri.x[2]);
+		std::swap(tri.y[1], tri.y[2]);
+		std::swap(tri.z[1], tri.z[2]);
+		std::swap(tri.invW[1], tri.invW[2]);
+		for (int c = 0; c < 5; c++)
+			std::swap(tri.attributes[1][c], tri.attributes[2][c]);
+	}
+
+	//the pixels whose centres are within the bounds of the triangle
+	float min_x = std::min(std::min(tri.x[0], tri.x[1]), tri.x[2]);
+	float max_x = std::max(std::max(tri.x[0], tri.x[1]), tri.x[2]);
+	float min_y = std::min(std::min(tri.y[0], tri.y[1]), tri.y[2]);
+	float max_y = std::max(std::max(tri.y[0], tri.y[1]), tri.y[2]);
+	tri.minX = (int)std::max(ceilf(min_x - 0.5f), 0.0f);
+	tri.maxX = (int)std::min(floorf(max_x - 0.5f), (float)this->width - 1);
+	tri.minY = (int)std::max(ceilf(min_y - 0.5f), 0.0f);
+	tri.maxY = (int)std::min(floorf(max_y - 0.5f), (float)this->height - 1);
+	if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+		return;
+
+	tri.drawIndex = drawIndex;
+	this->BinTriangle(tri);
+}
+
+void SoftwareRenderBackend::BinTriangle(const BinnedTriangle& tri)
+{
+	int tri_index = this->triangles.size();
+	this->triangles.push_back(tri);
+
+	for (int ty = tri.minY / SOFTWARE_TILE_SIZE; ty <= tri.maxY / SOFTWARE_TILE_SIZE; ty++)
+	{
+		for (int tx = tri.minX / SOFTWARE_TILE_SIZE; tx <= tri.maxX / SOFTWARE_TILE_SIZE; tx++)
+		{
+			this->tileBins[ty * this->numTilesX + tx].push_back(tri_index);
+		}
+	}
+}
+
+void SoftwareRenderBackend::RasterizeTile(int tileIndex)
+{
+	int tile_min_x = (tileIndex % this->numTilesX) * SOFTWARE_TILE_SIZE;
+	int tile_min_y = (tileIndex / this->numTilesX) * SOFTWARE_TILE_SIZE;
+	int tile_max_x = std::min(tile_min_x + SOFTWARE_TILE_SIZE, this->width) - 1;
+	int tile_max_y = std::min(tile_min_y + SOFTWARE_TILE_SIZE, this->height) - 1;
+
+	const std::vector<int>& bin = this->tileBins[tileIndex];
+	for (int bi = 0; bi < bin.size(); bi++)
+	{
+		const BinnedTriangle& tri = this->triangles[bin[bi]];
+		const DrawState& draw = this->draws[tri.drawIndex];
+		const SoftwareRenderTexture* texture = (const SoftwareRenderTexture*)draw.texture;
+
+		int min_x = std::max(tri.minX, tile_min_x);
+		int max_x = std::min(tri.maxX, tile_max_x);
+		int min_y = std::max(tri.minY, tile_min_y);
+		int max_y = std::min(tri.maxY, tile_max_y);
+
+		//edge k is the one opposite of vertex k, its function is k's barycentric coordinate times the area
+		float edge_a[3];
+		float edge_b[3];
+		float edge_c[3];
+		bool top_left[3];
+		for (int k = 0; k < 3; k++)
+		{
+			int k0 = (k + 1) % 3;
+			int k1 = (k + 2) % 3;
+			float dx = tri.x[k1] - tri.x[k0];
+			float dy = tri.y[k1] - tri.y[k0];
+			edge_a[k] = -dy;
+			edge_b[k] = dx;
+			edge_c[k] = dy * tri.x[k0] - dx * tri.y[k0];
+			//the pixels right on an edge belong to the triangle only if it is a top or a left one
+			top_left[k] = dy < 0.0f || (dy == 0.0f && dx > 0.0f);
+		}
+		float inv_area = 1.0f / (edge_a[0] * tri.x[0] + edge_b[0] * tri.y[0] + edge_c[0]);
+
+		for (int y = min_y; y <= max_y; y++)
+		{
+			float py = y + 0.5f;
+			for (int x = min_x; x <= max_x; x++)
+			{
+				float px = x + 0.5f;
+
+				float bary[3];
+				bool inside = true;
+				for (int k = 0; k < 3; k++)
+				{
+					float e = edge_a[k] * px + edge_b[k] * py + edge_c[k];
+					if (e < 0.0f || (e == 0.0f && !top_left[k]))
+					{
+						inside = false;
+						break;
+					}
+					bary[k] = e * inv_area;
+				}
+				if (!inside)
+					continue;
+
+				float z = bary[0] * tri.z[0] + bary[1] * tri.z[1] + bary[2] * tri.z[2];
+				int pi = y * this->width + x;
+				if (z < 0.0f || z > 1.0f || !(z < this->depth[pi]))
+					continue;
+
+				float w = 1.0f / (bary[0] * tri.invW[0] + bary[1] * tri.invW[1] + bary[2] * tri.invW[2]);
+				float attributes[5];
+				for (int c = 0; c < 5; c++)
+					attributes[c] = (bary[0] * tri.attributes[0][c] + bary[1] * tri.attributes[1][c] + bary[2] * tri.attributes[2][c]) * w;
+
+				//the pixel shaders
+				float normal[3] = { attributes[2], attributes[3], attributes[4] };
+				NormalizeVector(normal, normal, 3);
+				const SoftwareLight& light = draw.lights[1];
+				float n_dot_l = light.dir[0] * normal[0] + light.dir[1] * normal[1] + light.dir[2] * normal[2];
+
+				float color[4];
+				if (draw.textured)
+				{
+					float texel[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+					if (texture != NULL)
+						SampleTexture(texture, attributes[0], attributes[1], texel);
+					for (int c = 0; c < 3; c++)
+						color[c] = Saturate(draw.lights[0].brightness * texel[c] + Saturate(n_dot_l * light.brightness * texel[c]));
+					color[3] = texel[3];
+				}
+				else
+				{
+					float brightness = Saturate(draw.lights[0].brightness + Saturate(n_dot_l * light.brightness));
+					for (int c = 0; c < 4; c++)
+						color[c] = brightness;
+				}
+
+				unsigned char* dst = &this->pixels[pi * 4];
+				if (draw.alphaBlending)
+				{
+					for (int c = 0; c < 3; c++)
+						color[c] = color[c] * color[3] + dst[c] / 255.0f * (1.0f - color[3]);
+				}
+				for (int c = 0; c < 4; c++)
+					dst[c] = (unsigned char)lroundf(Saturate(color[c]) * 255.0f);
+				this->depth[pi] = z;
+			}
+		}
+	}
+}
+
+void SoftwareRenderBackend::RasterizeTiles()
+{
+	int num_tiles = this->tileBins.size();
+	while (true)
+	{
+		int ti = this->nextTile++;
+		if (ti >= num_tiles)
+			return;
+		this->RasterizeTile(ti);
+	}
+}
+
+void SoftwareRenderBackend::WorkerLoop()
+{
+	int flush_index = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->cond.wait(lock, [&] { return this->stopWorkers || this->flushIndex != flush_index; });
+			if (this->stopWorkers)
+				return;
+			flush_index = this->flushIndex;
+		}
+
+		this->RasterizeTiles();
+
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->numWorkersDone++;
+		}
+		this->doneCond.notify_all();
+	}
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "render_backend.h"
+
+//the screen is rasterized in squares of this many pixels, each by a single thread
+#define SOFTWARE_TILE_SIZE 64
+
+//the same as Light in main.cpp (cb_Lights of the shaders)
+struct SoftwareLight
+{
+	float dir[3];
+	float brightness;
+};
+
+//The pipeline state main.cpp sets on the Direct3D context itself - the software backend takes it from here.
+struct SoftwarePipelineState
+{
+	//the matrices of cb_Transforms as XMMATRIX has them, i.e. before they are transposed for the shader - a position
+	//as a row vector times the matrix
+	float wvp[16];
+	float world[16];
+	//the ambient light first, the directional one second
+	SoftwareLight lights[2];
+	//shader_3D_textured.fx if true, shader_3D.fx otherwise
+	bool textured = false;
+	//D3D11_CULL_BACK with the front faces clockwise, D3D11_CULL_NONE otherwise
+	bool cullBack = true;
+	//SRC_ALPHA / INV_SRC_ALPHA like blendState of main.cpp
+	bool alphaBlending = false;
+};
+
+//Draws on the CPU, for rendering frames without a graphics card. Every draw runs the vertex shader right away and
+//sorts the triangles into the tiles of the screen they touch, Flush then rasterizes and shades the tiles in parallel -
+//every tile draws its triangles in the order they were drawn in, so the depth test and the blending come out the
+//same as on the GPU. The shading is that of shader_3D.fx and shader_3D_textured.fx.
+//
+//The textures are read from uncompressed or RLE *.tga files, binary *.ppm files and *.png files (see png_reader.h),
+//without mipmaps. Any other format (the *.jpg the application loads through WIC among them) fails to load and the
+//draws using it are shaded as with a white texture - Megan's textures come as *.png as well.
+class SoftwareRenderBackend : public RenderBackend
+{
+public:
+	SoftwarePipelineState state;
+
+	//numThreads 0 uses every core
+	SoftwareRenderBackend(int width, int height, int numThreads = 0);
+	~SoftwareRenderBackend();
+
+	//clears the colour (RGB) and the depth buffer and throws away anything not flushed yet
+	void Clear(const float* color);
+
+	//rasterizes everything drawn since the last Flush or Clear
+	void Flush();
+
+	//RGBA, 8 bits per channel, the top row first
+	const unsigned char* GetPixels() const;
+	int GetWidth() const;
+	int GetHeight() const;
+
+	//the number of triangles binned since the last Flush or Clear, after the clipping and the culling
+	int GetNumTriangles() const;
+
+	//writes the flushed frame to a *.tga or (for any other extension) a binary *.ppm file, returns false on failure
+	bool WriteImage(const char* filename) const;
+
+	RenderBuffer* CreateBuffer(RenderBufferType type, const void* data, size_t sz);
+	void UpdateBuffer(RenderBuffer* buffer, const void* data, size_t sz);
+	void* MapBuffer(RenderBuffer* buffer, RenderMapType type, size_t offset, size_t sz);
+	void UnmapBuffer(RenderBuffer* buffer);
+	RenderTexture* LoadTexture(const wchar_t* fname);
+	void SetVertexBuffers(int numBuffers, RenderBuffer* const* buffers, const unsigned int* strides, const unsigned int* offsets);
+	void SetIndexBuffer(RenderBuffer* buffer);
+	void SetVertexConstantBuffer(int slot, RenderBuffer* buffer);
+	void SetPixelTexture(int slot, RenderTexture* texture);
+	void DrawIndexed(int numIndices);
+
+private:
+	//what the vertex shader outputs - the clip space position, the UVs and the normal
+	struct ShadedVertex
+	{
+		float pos[4];
+		float texCoord[2];
+		float normal[3];
+	};
+
+	//a triangle ready to be rasterized - the position in pixels, the depth, 1/w and the attributes divided by w,
+	//so they can be interpolated linearly over the screen
+	struct BinnedTriangle
+	{
+		float x[3];
+		float y[3];
+		float z[3];
+		float invW[3];
+		float attributes[3][5];
+		int minX, minY, maxX, maxY;
+		int drawIndex;
+	};
+
+	//what the pixel shader and the blending of a draw need
+	struct DrawState
+	{
+		SoftwareLight lights[2];
+		bool textured;
+		bool alphaBlending;
+		RenderTexture* texture;
+	};
+
+	void SetupTriangle(const ShadedVertex* v0, const ShadedVertex* v1, const ShadedVertex* v2, int drawIndex);
+	void BinTriangle(const BinnedTriangle& tri);
+	void RasterizeTile(int tileIndex);
+	void RasterizeTiles();
+	void WorkerLoop();
+
+	int width;
+	int height;
+	int numTilesX;
+	int numTilesY;
+	std::vector<unsigned char> pixels;
+	std::vector<float> depth;
+
+	RenderBuffer* vertexBuffers[2] = { NULL, NULL };
+	unsigned int vertexStrides[2] = { 0, 0 };
+	unsigned int vertexOffsets[2] = { 0, 0 };
+	RenderBuffer* indexBuffer = NULL;
+	RenderBuffer* decodeBuffer = NULL;
+	RenderTexture* texture = NULL;
+
+	std::vector<ShadedVertex> shadedVertices;
+	std::vector<BinnedTriangle> triangles;
+	std::vector<DrawState> draws;
+	//the indices of the triangles touching every tile, in the order they were drawn in
+	std::vector<std::vector<int>> tileBins;
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::condition_variable doneCond;
+	//incremented by every Flush, which wakes the workers up
+	int flushIndex = 0;
+	int numWorkersDone = 0;
+	bool stopWorkers = false;
+	std::atomic<int> nextTile;
+};
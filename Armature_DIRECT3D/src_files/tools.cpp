@@ -0,0 +1,559 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//Offline tools for preparing the model files - see tools.h for the list of the available commands.
+
+
+
+#include "3D_lib.h"
+#include "tools.h"
+#include "point_cache.h"
+#include "render_backend_software.h"
+#include "job_system.h"
+#include "deform_scheduler.h"
+#include "frame_update.h"
+#include "animation_clock.h"
+#include "allocation_tracker.h"
+
+#include <chrono>
+
+#ifdef _WIN32
+#include "d3d_wrappers.h"
+#else
+//the output of a console program goes to its terminal anyway
+static void AttachParentConsole()
+{
+}
+#endif
+
+
+
+static int CountKeyframes(Armature& armature)
+{
+	int num_keys = 0;
+	for (int bi = 0; bi < armature.GetNumBones(); bi++)
+	{
+		num_keys += armature.GetBone(bi).frameList.size();
+	}
+	return num_keys;
+}
+
+static bool ReduceKeysTool(int argc, char** argv)
+{
+	if (argc < 6)
+	{
+		printf("usage: -reduce_keys <armature in> <armature out> <angular tolerance> <positional tolerance>\n");
+		return false;
+	}
+
+	float angular_tolerance = atof(argv[4]);
+	float positional_tolerance = atof(argv[5]);
+
+	Armature armature;
+	armature.Load(NULL, argv[2], NULL);
+
+	int num_keys = CountKeyframes(armature);
+	int num_removed = armature.ReduceKeyframes(angular_tolerance, positional_tolerance);
+
+	printf("%s: %d bones, %d keyframes\n", argv[2], armature.GetNumBones(), num_keys);
+	printf("removed %d keyframes (%.1f%%), %d left\n", num_removed, 100.0f * num_removed / std::max(num_keys, 1), num_keys - num_removed);
+
+	armature.Save(argv[3]);
+	return true;
+}
+
+static bool BakeCacheTool(int argc, char** argv)
+{
+	if (argc < 9 || (argc - 6) % 3 != 0)
+	{
+		printf("usage: -bake_cache <armature> <first frame> <last frame> <num frames> <mesh.obj> <vertex groups> <out.pcache> [<mesh.obj> <vertex groups> <out.pcache> ...]\n");
+		return false;
+	}
+
+	float first_frame = atof(argv[3]);
+	float last_frame = atof(argv[4]);
+	int num_frames = atoi(argv[5]);
+
+	Armature armature;
+	armature.Load(NULL, argv[2], NULL);
+
+	std::vector<Object3D*> meshes;
+	std::vector<const char*> filenames;
+	for (int ai = 6; ai + 2 < argc; ai += 3)
+	{
+		Object3D* mesh = new Object3D();
+		mesh->Load(NULL, argv[ai], true, argv[ai + 1]);
+		armature.AssignBoneIndicesToVertexGroups(mesh);
+		meshes.push_back(mesh);
+		filenames.push_back(argv[ai + 2]);
+	}
+
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	bool ok = BakePointCache(armature, meshes, filenames, first_frame, last_frame, num_frames);
+	std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+
+	if (ok)
+	{
+		double seconds = std::chrono::duration<double>(end_time - start_time).count();
+		printf("baked %d frames of %d meshes in %.2f s (%.1f frames/s)\n", num_frames, (int)meshes.size(), seconds, num_frames / seconds);
+	}
+	else
+	{
+		printf("could not create the point cache files\n");
+	}
+
+	for (int mi = 0; mi < meshes.size(); mi++)
+	{
+		delete meshes[mi];
+	}
+	return ok;
+}
+
+static bool BenchFramesTool(int argc, char** argv)
+{
+	//the hash of an earlier build to compare with, at the end of the command line
+	const char* expected_hash = NULL;
+	if (argc >= 2 && strcmp(argv[argc - 2], "-expect") == 0)
+	{
+		expected_hash = argv[argc - 1];
+		argc -= 2;
+	}
+
+	if (argc < 6 || (argc - 4) % 2 != 0)
+	{
+		printf("usage: -bench_frames <armature> <num frames> <mesh.obj> <vertex groups> [<mesh.obj> <vertex groups> ...] [-expect <upload hash>]\n");
+		return false;
+	}
+
+	int num_frames = atoi(argv[3]);
+
+	NullRenderBackend backend;
+	DynamicVertexRing ring;
+	ring.Create(&backend, 4 * 1024 * 1024);
+
+	Armature armature;
+	armature.Load(&backend, argv[2], NULL);
+
+	std::vector<Object3D*> meshes;
+	for (int ai = 4; ai + 1 < argc; ai += 2)
+	{
+		Object3D* mesh = new Object3D();
+		mesh->vertexFormat = VERTEX_FORMAT_PACKED;
+		mesh->Load(&backend, argv[ai], true, argv[ai + 1]);
+		armature.AssignBoneIndicesToVertexGroups(mesh);
+		meshes.push_back(mesh);
+	}
+
+	//the same as a frame of the application - the animation moved on by UpdateScene and every mesh prepared
+	//and drawn by DrawMesh
+	double total_ms = 0.0;
+	size_t total_bytes = 0;
+	int total_draws = 0;
+	int total_maps = 0;
+	int total_discards = 0;
+	unsigned long long frames_hash = 14695981039346656037ULL;
+	for (int fi = 0; fi < num_frames; fi++)
+	{
+		backend.ResetCommands();
+
+		std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+		armature.Animate(0.65f);
+		for (int mi = 0; mi < meshes.size(); mi++)
+		{
+			armature.PrepareMesh(meshes[mi]);
+			meshes[mi]->DrawObject(&backend, &ring);
+		}
+		std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+
+		total_ms += std::chrono::duration<double, std::milli>(end_time - start_time).count();
+		total_bytes += backend.bytesUploaded;
+		total_draws += backend.CountCommands(RENDER_COMMAND_DRAW_INDEXED);
+		total_maps += backend.CountCommands(RENDER_COMMAND_MAP_DISCARD) + backend.CountCommands(RENDER_COMMAND_MAP_NO_OVERWRITE);
+		total_discards += backend.CountCommands(RENDER_COMMAND_MAP_DISCARD);
+		frames_hash = (frames_hash ^ backend.uploadHash) * 1099511628211ULL;
+	}
+
+	if (num_frames > 0)
+	{
+		printf("%d frames of %d meshes: %.3f ms per frame\n", num_frames, (int)meshes.size(), total_ms / num_frames);
+		printf("per frame: %.1f KB uploaded, %.1f draws, %.1f maps (%.2f discarding)\n", total_bytes / 1024.0 / num_frames,
+			(float)total_draws / num_frames, (float)total_maps / num_frames, (float)total_discards / num_frames);
+		printf("upload hash: %016llx\n", frames_hash);
+	}
+
+	bool hash_matches = true;
+	if (expected_hash != NULL)
+	{
+		hash_matches = strtoull(expected_hash, NULL, 16) == frames_hash;
+		printf("%s: the upload hash %s %s\n", hash_matches ? "OK" : "FAILED", hash_matches ? "matches" : "differs from", expected_hash);
+	}
+
+	for (int mi = 0; mi < meshes.size(); mi++)
+	{
+		meshes[mi]->ReleaseD3D();
+		delete meshes[mi];
+	}
+	ring.Release();
+	return hash_matches;
+}
+
+//result = a * b, both row major 4x4 matrices
+static void MultiplyMatrices(const float* a, const float* b, float* result)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			result[i * 4 + j] = 0.0f;
+			for (int k = 0; k < 4; k++)
+				result[i * 4 + j] += a[i * 4 + k] * b[k * 4 + j];
+		}
+	}
+}
+
+//The camera of InitScene and DrawScene in main.cpp - the translation by -camPos, the rotations by -camAngles around
+//the y and the x axis and XMMatrixPerspectiveFovLH, all in the layout of XMMATRIX.
+static void CameraMatrix(float aspect, float* result)
+{
+	const float cam_pos[3] = { -1.228866f, 0.765643f, 2.368459f };
+	const float cam_angles[2] = { 0.048000f, 2.946001f };
+	const float fov = 0.25f * 3.1415f;
+	const float near_z = 0.03f;
+	const float far_z = 10000.0f;
+
+	float translation[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, -cam_pos[0], -cam_pos[1], -cam_pos[2], 1 };
+
+	float cy = cosf(-cam_angles[1]);
+	float sy = sinf(-cam_angles[1]);
+	float rot_y[16] = { cy, 0, -sy, 0, 0, 1, 0, 0, sy, 0, cy, 0, 0, 0, 0, 1 };
+
+	float cx = cosf(-cam_angles[0]);
+	float sx = sinf(-cam_angles[0]);
+	float rot_x[16] = { 1, 0, 0, 0, 0, cx, sx, 0, 0, -sx, cx, 0, 0, 0, 0, 1 };
+
+	float h = 1.0f / tanf(fov * 0.5f);
+	float range = far_z / (far_z - near_z);
+	float projection[16] = { h / aspect, 0, 0, 0, 0, h, 0, 0, 0, 0, range, 1, 0, 0, -range * near_z, 0 };
+
+	float view[16];
+	float rotated[16];
+	MultiplyMatrices(translation, rot_y, rotated);
+	MultiplyMatrices(rotated, rot_x, view);
+	MultiplyMatrices(view, projection, result);
+}
+
+static bool RenderFramesTool(int argc, char** argv)
+{
+	//every mesh comes with its vertex groups and its texture - a mesh missing them is a typo, not one mesh less to draw
+	int num_meshes = 0;
+	bool complete_meshes = true;
+	for (int ai = 7; ai < argc; ai++)
+	{
+		if (strcmp(argv[ai], "-blend") == 0)
+			continue;
+		if (ai + 2 >= argc || strcmp(argv[ai + 1], "-blend") == 0 || strcmp(argv[ai + 2], "-blend") == 0)
+		{
+			printf("%s needs the vertex groups and the texture (or -)\n", argv[ai]);
+			complete_meshes = false;
+			break;
+		}
+		num_meshes++;
+		ai += 2;
+	}
+
+	if (argc < 10 || num_meshes == 0 || !complete_meshes)
+	{
+		printf("usage: -render_frames <armature> <num frames> <width> <height> <out file pattern> <mesh.obj> <vertex groups> <texture> [...] "
+			"[-blend <mesh.obj> <vertex groups> <texture> ...]\n");
+		return false;
+	}
+
+	int num_frames = atoi(argv[3]);
+	int width = atoi(argv[4]);
+	int height = atoi(argv[5]);
+	const char* out_pattern = argv[6];
+
+	SoftwareRenderBackend backend(width, height);
+	DynamicVertexRing ring;
+	ring.Create(&backend, 4 * 1024 * 1024);
+
+	Armature armature;
+	armature.Load(&backend, argv[2], NULL);
+
+	//the meshes after -blend are drawn like the eyelashes and the hair in DrawScene - blended and from both sides
+	std::vector<Object3D*> meshes;
+	std::vector<bool> textured;
+	std::vector<bool> blended;
+	bool blend = false;
+	//a texture that can't be read or an image that can't be written fails the tool, after all the frames are drawn
+	bool all_files = true;
+	int ai = 7;
+	while (ai < argc)
+	{
+		if (strcmp(argv[ai], "-blend") == 0)
+		{
+			blend = true;
+			ai++;
+			continue;
+		}
+		Object3D* mesh = new Object3D();
+		mesh->vertexFormat = VERTEX_FORMAT_PACKED;
+		mesh->Load(&backend, argv[ai], true, argv[ai + 1]);
+		armature.AssignBoneIndicesToVertexGroups(mesh);
+
+		bool has_texture = strcmp(argv[ai + 2], "-") != 0;
+		if (has_texture)
+		{
+			wchar_t texture_name[1024];
+			mbstowcs(texture_name, argv[ai + 2], 1024);
+			mesh->LoadTexture(&backend, texture_name);
+			if (mesh->objTexture == NULL)
+			{
+				printf("can't load %s (only *.tga, *.ppm and *.png are read) - drawing %s white\n", argv[ai + 2], argv[ai]);
+				all_files = false;
+			}
+		}
+
+		meshes.push_back(mesh);
+		textured.push_back(has_texture);
+		blended.push_back(blend);
+		ai += 3;
+	}
+
+	CameraMatrix((float)width / height, backend.state.wvp);
+	backend.state.lights[0].brightness = 0.1f;
+	backend.state.lights[0].dir[2] = 1.0f;
+	backend.state.lights[1].brightness = 0.5f;
+	for (int c = 0; c < 3; c++)
+		backend.state.lights[1].dir[c] = 1.0f;
+	const float bg_color[3] = { 0.0f, 0.005f * 50, 0.007f * 50 };
+
+	double draw_ms = 0.0;
+	double raster_ms = 0.0;
+	long long total_triangles = 0;
+	unsigned long long frames_hash = 14695981039346656037ULL;
+	for (int fi = 0; fi < num_frames; fi++)
+	{
+		std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+		backend.Clear(bg_color);
+		armature.Animate(0.65f);
+		for (int mi = 0; mi < meshes.size(); mi++)
+		{
+			armature.PrepareMesh(meshes[mi]);
+			backend.state.textured = textured[mi];
+			backend.state.alphaBlending = blended[mi];
+			backend.state.cullBack = !blended[mi];
+			backend.SetPixelTexture(0, meshes[mi]->objTexture);
+			meshes[mi]->DrawObject(&backend, &ring);
+		}
+		total_triangles += backend.GetNumTriangles();
+
+		std::chrono::steady_clock::time_point raster_time = std::chrono::steady_clock::now();
+		backend.Flush();
+		std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+
+		draw_ms += std::chrono::duration<double, std::milli>(raster_time - start_time).count();
+		raster_ms += std::chrono::duration<double, std::milli>(end_time - raster_time).count();
+
+		const unsigned char* pixels = backend.GetPixels();
+		for (int bi = 0; bi < width * height * 4; bi++)
+		{
+			frames_hash ^= pixels[bi];
+			frames_hash *= 1099511628211ULL;
+		}
+
+		if (strcmp(out_pattern, "-") != 0)
+		{
+			char filename[1024];
+			snprintf(filename, sizeof(filename), out_pattern, fi);
+			if (!backend.WriteImage(filename))
+			{
+				printf("can't write %s\n", filename);
+				all_files = false;
+			}
+		}
+	}
+
+	if (num_frames > 0)
+	{
+		printf("%d frames of %d meshes at %dx%d: %.3f ms per frame animating and drawing, %.3f ms rasterizing\n", num_frames,
+			(int)meshes.size(), width, height, draw_ms / num_frames, raster_ms / num_frames);
+		printf("per frame: %.1f triangles binned\n", (double)total_triangles / num_frames);
+		printf("image hash: %016llx\n", frames_hash);
+	}
+
+	for (int mi = 0; mi < meshes.size(); mi++)
+	{
+		meshes[mi]->ReleaseD3D();
+		delete meshes[mi];
+	}
+	ring.Release();
+	return all_files;
+}
+
+static void PrintAllocations(const char* stage, const AllocationCounts& counts)
+{
+	printf("%s: %lld allocations, %.1f KB\n", stage, counts.numAllocations, counts.numBytes / 1024.0);
+}
+
+static bool CheckAllocationsTool(int argc, char** argv)
+{
+	//the threads of the job system, at the end of the command line - 0 (every core) like JOB_THREADS in main.cpp
+	int num_threads = 0;
+	if (argc >= 2 && strcmp(argv[argc - 2], "-threads") == 0)
+	{
+		num_threads = atoi(argv[argc - 1]);
+		argc -= 2;
+	}
+
+	if (argc < 6 || (argc - 4) % 2 != 0)
+	{
+		printf("usage: -check_allocations <armature> <num frames> <mesh.obj> <vertex groups> [<mesh.obj> <vertex groups> ...] [-threads <num threads>]\n");
+		return false;
+	}
+
+	int num_frames = atoi(argv[3]);
+
+	NullRenderBackend backend;
+	DynamicVertexRing ring;
+	ring.Create(&backend, 4 * 1024 * 1024);
+
+	AllocationCounts stage_start = GetAllocationCounts();
+	Armature armature;
+	armature.Load(&backend, argv[2], NULL);
+	PrintAllocations(argv[2], GetAllocationCounts() - stage_start);
+
+	std::vector<Object3D*> meshes;
+	std::vector<MeshJob> mesh_jobs;
+	for (int ai = 4; ai + 1 < argc; ai += 2)
+	{
+		stage_start = GetAllocationCounts();
+		Object3D* mesh = new Object3D();
+		mesh->vertexFormat = VERTEX_FORMAT_PACKED;
+		mesh->Load(&backend, argv[ai], true, argv[ai + 1]);
+		armature.AssignBoneIndicesToVertexGroups(mesh);
+		meshes.push_back(mesh);
+		PrintAllocations(argv[ai], GetAllocationCounts() - stage_start);
+
+		MeshJob mesh_job = { mesh };
+		mesh_jobs.push_back(mesh_job);
+	}
+
+	JobSystem job_system;
+	job_system.Start(num_threads);
+	DeformScheduler deform_scheduler;
+	AnimationClock animation_clock;
+
+	//The frames of the application (see messageloop in main.cpp) - UpdateScene on the update thread of a FramePipeline,
+	//every frame a step of the animation, the pose and then the jobs of UpdateFrame on all the threads of job_system,
+	//while this thread draws the frame staged before. The meshes are never culled, all of them are drawn.
+	FrameUpdate update;
+	update.armature = &armature;
+	update.jobSystem = &job_system;
+	update.deformScheduler = &deform_scheduler;
+	FramePipeline frame_pipeline;
+	frame_pipeline.Start([&](int slot)
+	{
+		int num_steps = animation_clock.Advance(animation_clock.GetStepSeconds());
+		armature.AnimateSteps(num_steps, 0.65f, animation_clock.GetAlpha());
+		armature.PreparePose();
+
+		update.step = animation_clock.GetStepCount();
+		UpdateFrame(update, mesh_jobs.data(), (int)mesh_jobs.size(), true, slot);
+	});
+
+	//Every frame counts the allocations of all the threads from one BeginDraw to the next, so whatever the update
+	//thread and the jobs allocate meanwhile is in it. Past the warm up none of them may allocate.
+	AllocationCounts warmup;
+	AllocationCounts after_warmup;
+	int frames_allocating = 0;
+	for (int fi = 0; fi < ALLOCATION_WARMUP_FRAMES + num_frames; fi++)
+	{
+		AllocationCounts frame_start = GetAllocationCounts();
+
+		int slot = frame_pipeline.BeginDraw();
+		backend.ResetCommands();
+		for (int mi = 0; mi < meshes.size(); mi++)
+		{
+			meshes[mi]->DrawStaged(&backend, &ring, slot);
+		}
+		armature.DrawStaged(&backend, &ring, slot);
+		frame_pipeline.EndDraw();
+
+		AllocationCounts frame = GetAllocationCounts() - frame_start;
+		if (fi < ALLOCATION_WARMUP_FRAMES)
+		{
+			warmup.numAllocations += frame.numAllocations;
+			warmup.numBytes += frame.numBytes;
+			continue;
+		}
+
+		if (frame.numAllocations > 0)
+		{
+			printf("frame %d: %lld allocations, %lld bytes\n", fi, frame.numAllocations, frame.numBytes);
+			frames_allocating++;
+		}
+		after_warmup.numAllocations += frame.numAllocations;
+		after_warmup.numBytes += frame.numBytes;
+	}
+	frame_pipeline.Stop();
+
+	printf("%d threads (and the update thread), %d meshes\n", job_system.GetNumThreads(), (int)meshes.size());
+	PrintAllocations("the first frames (warm up)", warmup);
+	PrintAllocations("the frames after the warm up", after_warmup);
+	if (frames_allocating > 0)
+		printf("FAILED: %d of %d frames allocated\n", frames_allocating, num_frames);
+	else
+		printf("OK: no allocations in %d frames\n", num_frames);
+
+	job_system.Stop();
+	for (int mi = 0; mi < meshes.size(); mi++)
+	{
+		meshes[mi]->ReleaseD3D();
+		delete meshes[mi];
+	}
+	ring.Release();
+	return frames_allocating == 0;
+}
+
+bool RunCommandLineTool(int argc, char** argv, int* exitCode)
+{
+	if (argc < 2)
+		return false;
+
+	if (strcmp(argv[1], "-reduce_keys") == 0)
+	{
+		AttachParentConsole();
+		*exitCode = ReduceKeysTool(argc, argv) ? 0 : 1;
+		return true;
+	}
+
+	if (strcmp(argv[1], "-bake_cache") == 0)
+	{
+		AttachParentConsole();
+		*exitCode = BakeCacheTool(argc, argv) ? 0 : 1;
+		return true;
+	}
+
+	if (strcmp(argv[1], "-bench_frames") == 0)
+	{
+		AttachParentConsole();
+		*exitCode = BenchFramesTool(argc, argv) ? 0 : 1;
+		return true;
+	}
+
+	if (strcmp(argv[1], "-render_frames") == 0)
+	{
+		AttachParentConsole();
+		*exitCode = RenderFramesTool(argc, argv) ? 0 : 1;
+		return true;
+	}
+
+	if (strcmp(argv[1], "-check_allocations") == 0)
+	{
+		AttachParentConsole();
+		*exitCode = CheckAllocationsTool(argc, argv) ? 0 : 1;
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+//Offline tools working on the model files without opening a window or creating a Direct3D device.
+//They are run by passing one of the following command lines to the executable:
+//
+//-reduce_keys <armature in> <armature out> <angular tolerance> <positional tolerance>
+//	drops the keyframes Armature::ReduceKeyframes finds redundant and writes the rest to a new armature file
+//
+//-bake_cache <armature> <first frame> <last frame> <num frames> <mesh.obj> <vertex groups> <out.pcache> [<mesh.obj> <vertex groups> <out.pcache> ...]
+//	samples the animation at num frames evenly spaced frames and writes the deformed meshes to point cache files (see point_cache.h)
+//
+//-bench_frames <armature> <num frames> <mesh.obj> <vertex groups> [<mesh.obj> <vertex groups> ...] [-expect <upload hash>]
+//	runs num frames of animating, deforming and drawing the meshes on a NullRenderBackend (see render_backend.h) and prints
+//	the time, the bytes uploaded and the draws per frame, with a hash of everything uploaded for comparing builds - fails
+//	if it isn't the one after -expect (the one of the Megan model is checked in with CMakeLists.txt)
+//
+//-render_frames <armature> <num frames> <width> <height> <out file pattern> <mesh.obj> <vertex groups> <texture> [...] [-blend <mesh.obj> <vertex groups> <texture> ...]
+//	draws num frames of the animated meshes from the camera of the application on a SoftwareRenderBackend (see
+//	render_backend_software.h) and writes every frame to a *.tga or *.ppm file named by the printf pattern (e.g. frame%04d.tga,
+//	- for none). A texture of - leaves the mesh untextured, the meshes after -blend are drawn like the hair. Prints the time
+//	per frame and a hash of all the pixels for comparing the images with the ones of an earlier build
+//
+//-check_allocations <armature> <num frames> <mesh.obj> <vertex groups> [<mesh.obj> <vertex groups> ...] [-threads <num threads>]
+//	runs the frames of the application - the update of UpdateFrame (see frame_update.h) on the update thread of a
+//	FramePipeline and its jobs on num threads (every core by default), the drawing on this thread - on a NullRenderBackend
+//	and counts their heap allocations (see allocation_tracker.h) - prints FAILED if any of num frames past the warm up
+//	allocated, along with the allocations of loading the armature and every mesh
+//
+//Returns true if the command line requested a tool (which has been run by then), false otherwise. exitCode gets what
+//the program is to exit with - 0 if the tool succeeded, 1 if it failed (a wrong command line, a file that couldn't
+//be written, allocations found by -check_allocations).
+bool RunCommandLineTool(int argc, char** argv, int* exitCode);
@@ -0,0 +1,24 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//The entry point of the tools (see tools.h) where there is no Direct3D - on Windows they are run by the
+//application itself, from WinMain in main.cpp.
+
+
+
+#ifndef _WIN32
+
+#include "tools.h"
+
+#include <cstdio>
+
+int main(int argc, char** argv)
+{
+	int exit_code;
+	if (RunCommandLineTool(argc, argv, &exit_code))
+		return exit_code;
+
+	printf("usage: %s -<tool> <arguments> - see tools.h for the tools and their arguments\n", argc > 0 ? argv[0] : "armature_tools");
+	return 1;
+}
+
+#endif
@@ -0,0 +1,189 @@
+﻿//Copyright © 2023 by Pawel Oriol
+
+//Triangle ordering for the post-transform vertex cache - see vertex_cache.h.
+
+
+
+#include "vertex_cache.h"
+
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+
+
+//the constants of the scoring function, as tuned by Forsyth
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRIANGLE_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+static float VertexScore(int cachePosition, int numActiveTriangles)
+{
+	//a vertex no triangle needs any more is worth nothing
+	if (numActiveTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		//the vertices of the triangle drawn last get a fixed score, so the next triangle does not simply
+		//take the same ones again, the rest less and less the older they are
+		if (cachePosition < 3)
+		{
+			score = LAST_TRIANGLE_SCORE;
+		}
+		else
+		{
+			float scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+			score = powf(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+		}
+	}
+
+	//the vertices with few triangles left get a boost, so they are finished off instead of left behind
+	score += VALENCE_BOOST_SCALE * powf((float)numActiveTriangles, -VALENCE_BOOST_POWER);
+	return score;
+}
+
+void OptimizeTriangleOrder(const std::vector<int>& indices, int numVertices, std::vector<int>& triangleOrder)
+{
+	int num_triangles = indices.size() / 3;
+	triangleOrder.clear();
+	triangleOrder.reserve(num_triangles);
+
+	//the triangles of every vertex, one vertex after another
+	std::vector<int> num_active(numVertices, 0);
+	for (int ii = 0; ii < indices.size(); ii++)
+	{
+		num_active[indices[ii]]++;
+	}
+	std::vector<int> first_triangle(numVertices + 1, 0);
+	for (int vi = 0; vi < numVertices; vi++)
+	{
+		first_triangle[vi + 1] = first_triangle[vi] + num_active[vi];
+	}
+	std::vector<int> vertex_triangles(indices.size());
+	std::vector<int> fill(first_triangle.begin(), first_triangle.end() - 1);
+	for (int ii = 0; ii < indices.size(); ii++)
+	{
+		vertex_triangles[fill[indices[ii]]++] = ii / 3;
+	}
+
+	std::vector<int> cache_position(numVertices, -1);
+	std::vector<float> vertex_score(numVertices);
+	for (int vi = 0; vi < numVertices; vi++)
+	{
+		vertex_score[vi] = VertexScore(-1, num_active[vi]);
+	}
+
+	std::vector<char> triangle_added(num_triangles, 0);
+	std::vector<float> triangle_score(num_triangles);
+	for (int ti = 0; ti < num_triangles; ti++)
+	{
+		triangle_score[ti] = vertex_score[indices[ti * 3]] + vertex_score[indices[ti * 3 + 1]] + vertex_score[indices[ti * 3 + 2]];
+	}
+
+	//one more place than the cache has, for the vertices pushed out by the last triangle
+	std::vector<int> cache;
+	std::vector<int> new_cache;
+	cache.reserve(VERTEX_CACHE_SIZE + 3);
+	new_cache.reserve(VERTEX_CACHE_SIZE + 3);
+
+	int best_triangle = -1;
+	int scan_start = 0;
+	while (triangleOrder.size() < num_triangles)
+	{
+		//nothing in the cache leads anywhere - the best of all the triangles left
+		if (best_triangle == -1)
+		{
+			while (scan_start < num_triangles && triangle_added[scan_start])
+				scan_start++;
+			float best_score = -FLT_MAX;
+			for (int ti = scan_start; ti < num_triangles; ti++)
+			{
+				if (!triangle_added[ti] && triangle_score[ti] > best_score)
+				{
+					best_score = triangle_score[ti];
+					best_triangle = ti;
+				}
+			}
+		}
+
+		triangle_added[best_triangle] = 1;
+		triangleOrder.push_back(best_triangle);
+
+		//the vertices of the triangle go to the front of the cache, the rest move back
+		new_cache.clear();
+		for (int k = 0; k < 3; k++)
+		{
+			int vi = indices[best_triangle * 3 + k];
+			new_cache.push_back(vi);
+
+			//the triangle is no longer waiting for its vertices
+			int* triangles = &vertex_triangles[first_triangle[vi]];
+			for (int ti = 0; ti < num_active[vi]; ti++)
+			{
+				if (triangles[ti] == best_triangle)
+				{
+					std::swap(triangles[ti], triangles[num_active[vi] - 1]);
+					break;
+				}
+			}
+			num_active[vi]--;
+		}
+		for (int ci = 0; ci < cache.size(); ci++)
+		{
+			int vi = cache[ci];
+			if (vi != new_cache[0] && vi != new_cache[1] && vi != new_cache[2])
+				new_cache.push_back(vi);
+		}
+		cache.swap(new_cache);
+
+		//the vertices that fell out of the cache and the ones still in it get new scores, and so do their triangles
+		for (int ci = 0; ci < cache.size(); ci++)
+		{
+			int vi = cache[ci];
+			cache_position[vi] = ci < VERTEX_CACHE_SIZE ? ci : -1;
+			vertex_score[vi] = VertexScore(cache_position[vi], num_active[vi]);
+		}
+		best_triangle = -1;
+		float best_score = -FLT_MAX;
+		for (int ci = 0; ci < cache.size(); ci++)
+		{
+			int vi = cache[ci];
+			const int* triangles = &vertex_triangles[first_triangle[vi]];
+			for (int ti = 0; ti < num_active[vi]; ti++)
+			{
+				int tri = triangles[ti];
+				float score = vertex_score[indices[tri * 3]] + vertex_score[indices[tri * 3 + 1]] + vertex_score[indices[tri * 3 + 2]];
+				triangle_score[tri] = score;
+				if (score > best_score)
+				{
+					best_score = score;
+					best_triangle = tri;
+				}
+			}
+		}
+		if (cache.size() > VERTEX_CACHE_SIZE)
+			cache.resize(VERTEX_CACHE_SIZE);
+	}
+}
+
+void VertexCacheStatistics(const std::vector<int>& indices, int numVertices, int cacheSize, float* acmr, float* atvr)
+{
+	std::vector<int> cache_time(numVertices, -1);
+	int num_misses = 0;
+	for (int ii = 0; ii < indices.size(); ii++)
+	{
+		int vi = indices[ii];
+		//a FIFO cache - the vertex is still there if fewer than cacheSize vertices were loaded since it was
+		if (cache_time[vi] == -1 || num_misses - cache_time[vi] >= cacheSize)
+		{
+			cache_time[vi] = num_misses;
+			num_misses++;
+		}
+	}
+
+	*acmr = indices.size() > 0 ? (float)num_misses / (indices.size() / 3) : 0.0f;
+	*atvr = numVertices > 0 ? (float)num_misses / numVertices : 0.0f;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+
+//the number of vertices the optimizer assumes the post-transform cache of the GPU holds
+#define VERTEX_CACHE_SIZE 32
+
+//Orders the triangles (3 vertex indices each in indices) so that the vertices they share are still in the
+//post-transform cache when they are used again - Tom Forsyth's "Linear-Speed Vertex Cache Optimisation". Every vertex
+//gets a score from its place in a simulated cache of VERTEX_CACHE_SIZE vertices and the number of triangles still
+//waiting for it, and the triangle with the highest sum is drawn next.
+//triangleOrder receives the original index of every triangle in the new order.
+void OptimizeTriangleOrder(const std::vector<int>& indices, int numVertices, std::vector<int>& triangleOrder);
+
+//The average cache miss ratio (vertices transformed per triangle) and the average transformed vertex ratio
+//(vertices transformed per vertex - 1 is the best possible) of drawing the triangles through a FIFO cache
+//of cacheSize vertices.
+void VertexCacheStatistics(const std::vector<int>& indices, int numVertices, int cacheSize, float* acmr, float* atvr);